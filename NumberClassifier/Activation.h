@@ -5,6 +5,7 @@
 #include "Utility.h"
 #include <cmath>
 #include <numeric>
+#include <string>
 
 namespace net
 {
@@ -17,6 +18,15 @@ namespace net
 			SOFTMAX
 		};
 
+		// command line / config names: sigmoid, relu, softmax
+		inline bool FromString(const std::string& name, ACTIVATION_TYPE& type)
+		{
+			if (name == "sigmoid") { type = ACTIVATION_TYPE::SIGMOID; return true; }
+			if (name == "relu") { type = ACTIVATION_TYPE::RELU; return true; }
+			if (name == "softmax") { type = ACTIVATION_TYPE::SOFTMAX; return true; }
+			return false;
+		}
+
 		template<typename T>
 		inline util::Matrix<T> Sigmoid(util::Matrix<T> nodes)
 		{
@@ -139,5 +149,81 @@ namespace net
 				break;
 			}
 		}
+
+		// batched variant, every row of nodes is one sample so softmax is normalised per row
+		template<typename T>
+		inline util::Matrix<T> Activation_rows(ACTIVATION_TYPE type, util::Matrix<T> nodes)
+		{
+			if (type != ACTIVATION_TYPE::SOFTMAX || nodes.GetRows() == 1)
+			{
+				return Activation(type, nodes);
+			}
+
+			util::Matrix<T> res{ {}, nodes.GetRows(), nodes.GetColumns() };
+			for (int r = 0; r < nodes.GetRows(); r++)
+			{
+				T expSum = 0.0;
+				for (int c = 0; c < nodes.GetColumns(); c++)
+				{
+					expSum += std::exp(nodes(r, c));
+				}
+				for (int c = 0; c < nodes.GetColumns(); c++)
+				{
+					res(r, c) = std::exp(nodes(r, c)) / expSum;
+				}
+			}
+			return res;
+		}
+
+		// -----------------------------------------------------------------------------------------------------------
+		// compile time activation policies for fixed size buffers (see StaticNetwork.h)
+
+		struct SigmoidPolicy
+		{
+			static constexpr ACTIVATION_TYPE type = ACTIVATION_TYPE::SIGMOID;
+
+			template<int N, typename T>
+			static void Apply(T* nodes)
+			{
+				for (int i = 0; i < N; i++)
+				{
+					nodes[i] = (T)1.0 / ((T)1.0 + std::exp(-nodes[i]));
+				}
+			}
+		};
+
+		struct ReLUPolicy
+		{
+			static constexpr ACTIVATION_TYPE type = ACTIVATION_TYPE::RELU;
+
+			template<int N, typename T>
+			static void Apply(T* nodes)
+			{
+				for (int i = 0; i < N; i++)
+				{
+					nodes[i] = nodes[i] > (T)0.0 ? nodes[i] : (T)0.0;
+				}
+			}
+		};
+
+		struct SoftmaxPolicy
+		{
+			static constexpr ACTIVATION_TYPE type = ACTIVATION_TYPE::SOFTMAX;
+
+			template<int N, typename T>
+			static void Apply(T* nodes)
+			{
+				T expSum = 0.0;
+				for (int i = 0; i < N; i++)
+				{
+					nodes[i] = std::exp(nodes[i]);
+					expSum += nodes[i];
+				}
+				for (int i = 0; i < N; i++)
+				{
+					nodes[i] /= expSum;
+				}
+			}
+		};
 	}
 }
\ No newline at end of file
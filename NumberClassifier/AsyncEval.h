@@ -0,0 +1,171 @@
+#pragma once
+
+#include "Network.h"
+#include "Cost.h"
+#include "Metrics.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util
+{
+	// full test set evaluation on a thread of its own, the trainer never waits for it
+	// Offer copies the weights into the pending snapshot, the evaluator swaps it with its working copy and evaluates that
+	// with the const batched forward pass while training continues; an offer made while the pending snapshot is still
+	// unclaimed replaces it, so a slow evaluation skips steps instead of queueing them
+	class AsyncEvaluator
+	{
+	public:
+		AsyncEvaluator(const std::vector<DataPoint<double>>& test)
+			: n_test((int)test.size())
+		{
+			const int cols = test.empty() ? 0 : test[0].input.GetSize();
+			const int outs = test.empty() ? 0 : test[0].expected.GetSize();
+			inputs = Matrix<double>{ {}, n_test, cols };
+			expected = Matrix<double>{ {}, n_test, outs };
+			labels.resize(n_test);
+			for (int r = 0; r < n_test; r++)
+			{
+				std::copy(test[r].input.GetValues().begin(), test[r].input.GetValues().end(), inputs.GetValues().begin() + (std::size_t)r * cols);
+				std::copy(test[r].expected.GetValues().begin(), test[r].expected.GetValues().end(), expected.GetValues().begin() + (std::size_t)r * outs);
+				labels[r] = (int)test[r].label;
+			}
+			worker = std::thread([this]() { Run(); });
+		}
+		~AsyncEvaluator()
+		{
+			Finish();
+		}
+
+		AsyncEvaluator(const AsyncEvaluator&) = delete;
+		AsyncEvaluator& operator=(const AsyncEvaluator&) = delete;
+
+		// record carries the step, epoch and training metrics the result is tagged with
+		void Offer(const net::Network& model, const MetricRecord& record)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				if (pending)
+				{
+					pending->CopyParameters(model);
+				}
+				else
+				{
+					pending = std::make_unique<net::Network>(model);
+				}
+				skipped += hasPending;
+				pendingRecord = record;
+				hasPending = true;
+			}
+			cv.notify_one();
+		}
+
+		// hands the finished results to f on the calling thread, never blocks
+		template<typename F>
+		void Drain(F&& f)
+		{
+			std::vector<MetricRecord> done;
+			{
+				std::unique_lock<std::mutex> lock(resultMtx, std::try_to_lock);
+				if (!lock.owns_lock() || results.empty())
+				{
+					return;
+				}
+				done.swap(results);
+			}
+			for (const MetricRecord& r : done)
+			{
+				f(r);
+			}
+		}
+
+		// evaluates the last offer and stops the thread
+		void Finish()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				if (stopping)
+				{
+					return;
+				}
+				stopping = true;
+			}
+			cv.notify_one();
+			worker.join();
+		}
+
+		// offers replaced before the evaluator got to them, read on the offering thread
+		int Skipped() const { return skipped; }
+	private:
+		void Run()
+		{
+			std::unique_ptr<net::Network> working;
+			for (;;)
+			{
+				MetricRecord r;
+				{
+					std::unique_lock<std::mutex> lock(mtx);
+					cv.wait(lock, [this]() { return stopping || hasPending; });
+					if (!hasPending)
+					{
+						return;
+					}
+					// the working copy becomes the next pending buffer, its weights are overwritten by the next offer
+					std::swap(working, pending);
+					r = pendingRecord;
+					hasPending = false;
+				}
+				Evaluate(*working, r);
+				std::lock_guard<std::mutex> lock(resultMtx);
+				results.push_back(r);
+			}
+		}
+
+		void Evaluate(net::Network& model, MetricRecord& r) const
+		{
+			model.Pack();
+			int correct = 0;
+			double cost = 0.0;
+			for (int first = 0; first < n_test; first += 256)
+			{
+				const int n = std::min(256, n_test - first);
+				Matrix<double> batch{ {}, n, inputs.GetColumns() };
+				std::copy(inputs.GetValues().begin() + (std::size_t)first * inputs.GetColumns(),
+					inputs.GetValues().begin() + (std::size_t)(first + n) * inputs.GetColumns(), batch.GetValues().begin());
+				Matrix<double> outputs = model.FeedBatch(batch);
+				for (int row = 0; row < n; row++)
+				{
+					correct += TopClass(outputs, row).label == labels[(std::size_t)first + row];
+					for (int c = 0; c < outputs.GetColumns(); c++)
+					{
+						cost += net::cstf::CrossEntropy(outputs(row, c), expected(first + row, c));
+					}
+				}
+			}
+			r.kind = METRIC::EVAL;
+			r.testAccuracy = n_test ? (double)correct / n_test : 0.0;
+			r.testLoss = n_test ? cost / n_test : 0.0;
+			r.testSamples = n_test;
+		}
+	private:
+		int n_test;
+		Matrix<double> inputs;
+		Matrix<double> expected;
+		std::vector<int> labels;
+
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::unique_ptr<net::Network> pending;
+		MetricRecord pendingRecord;
+		bool hasPending = false;
+		bool stopping = false;
+		int skipped = 0;
+
+		std::mutex resultMtx;
+		std::vector<MetricRecord> results;
+
+		std::thread worker;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,320 @@
+#pragma once
+
+#include "Network.h"
+#include "DataParallel.h"
+#include "MNISTReader.h"
+#include "Random.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace util
+{
+	inline std::string HostName()
+	{
+		std::string name;
+#ifdef _WIN32
+		const char* env = std::getenv("COMPUTERNAME");
+		name = env ? env : "";
+#else
+		char buf[256] = {};
+		if (gethostname(buf, sizeof(buf) - 1) == 0)
+		{
+			name = buf;
+		}
+#endif
+		// the name ends up in a file name
+		for (char& c : name)
+		{
+			if (!std::isalnum((unsigned char)c) && c != '-' && c != '_' && c != '.')
+			{
+				c = '_';
+			}
+		}
+		return name.empty() ? "localhost" : name;
+	}
+
+	inline std::string HostTuningPath()
+	{
+		return "tuning-" + HostName() + ".txt";
+	}
+
+	// the fastest measured configuration of one host and network
+	struct HostTuning
+	{
+		std::string host;
+		std::vector<int> layers;        // batch size and threads were measured for these layers only
+		int batchSize = 100;
+		int threads = 1;
+		KernelTuning kernels;
+		double trainSamplesPerSecond = 0.0;
+		double inferSamplesPerSecond = 0.0;
+
+		// one "key value" pair per line
+		bool Save(const std::string& path) const
+		{
+			std::ofstream out(path);
+			out << "host " << host << '\n' << "layers ";
+			for (std::size_t i = 0; i < layers.size(); i++)
+			{
+				out << (i ? "," : "") << layers[i];
+			}
+			out << '\n'
+				<< "batch " << batchSize << '\n'
+				<< "threads " << threads << '\n'
+				<< "gemm_block " << kernels.gemmBlock << '\n'
+				<< "row_block " << kernels.rowBlock << '\n'
+				<< "train_samples_per_second " << trainSamplesPerSecond << '\n'
+				<< "infer_samples_per_second " << inferSamplesPerSecond << '\n';
+			return (bool)out;
+		}
+
+		bool Load(const std::string& path)
+		{
+			std::ifstream in(path);
+			if (!in)
+			{
+				return false;
+			}
+			std::string key;
+			while (in >> key)
+			{
+				if (key == "host") in >> host;
+				else if (key == "layers")
+				{
+					std::string list;
+					in >> list;
+					layers.clear();
+					std::stringstream ss(list);
+					std::string item;
+					while (std::getline(ss, item, ','))
+					{
+						layers.push_back(std::atoi(item.c_str()));
+					}
+				}
+				else if (key == "batch") in >> batchSize;
+				else if (key == "threads") in >> threads;
+				else if (key == "gemm_block") in >> kernels.gemmBlock;
+				else if (key == "row_block") in >> kernels.rowBlock;
+				else if (key == "train_samples_per_second") in >> trainSamplesPerSecond;
+				else if (key == "infer_samples_per_second") in >> inferSamplesPerSecond;
+				else
+				{
+					std::string skip;
+					std::getline(in, skip);
+				}
+			}
+			// a file without a measured training rate came from a run where no candidate qualified
+			return batchSize > 0 && threads > 0 && kernels.gemmBlock >= 0 && kernels.rowBlock >= 0 && trainSamplesPerSecond > 0.0;
+		}
+	};
+
+	// reads this host's tuning file if there is one and applies its kernel blocking, the batch size and
+	// thread count are left to the caller since they only hold for the tuned layers
+	inline bool LoadHostTuning(HostTuning& tuning)
+	{
+		if (!tuning.Load(HostTuningPath()))
+		{
+			tuning = HostTuning{};
+			return false;
+		}
+		SetKernelTuning(tuning.kernels);
+		return true;
+	}
+
+	struct AutotuneConfig
+	{
+		std::vector<int> layers{ 784, 256, 256, 10 };
+		std::vector<int> batchSizes{ 32, 64, 100, 128, 256 };
+		std::vector<int> threads;                       // empty tries 1, 2, 4, ... up to the hardware threads
+		std::vector<int> gemmBlocks{ 0, 32, 64, 128, 256 };
+		std::vector<int> rowBlocks{ 8, 16, 32, 64, 128 };
+
+		// convergence-safe bounds: batches outside [minBatch, maxBatch] change the learning dynamics too much
+		// to be swapped in at the same learning rate, and every thread gets at least minSlice samples
+		int minBatch = 16;
+		int maxBatch = 256;
+		int minSlice = 8;
+		double tieFraction = 0.05;      // a bigger batch or more threads must be this much faster to win
+
+		double trialSeconds = 0.5;
+		int inferenceBatch = 256;
+		int samples = 4096;             // synthetic digits the trials train and infer on
+		std::string outPath;            // empty writes HostTuningPath()
+	};
+
+	// short timed trials over the kernel blocking, then over batch size x threads of Network::Learn
+	// trials only measure throughput, the weights they train are thrown away
+	class Autotuner
+	{
+	public:
+		Autotuner(AutotuneConfig config)
+			: config(config)
+		{
+			if (this->config.threads.empty())
+			{
+				const int hw = (int)std::max(1u, std::thread::hardware_concurrency());
+				for (int t = 1; t < hw; t *= 2)
+				{
+					this->config.threads.push_back(t);
+				}
+				this->config.threads.push_back(hw);
+			}
+		}
+
+		// returns false if no batch size x thread count candidate was inside the bounds, res is then not a tuning
+		bool Run(HostTuning& res)
+		{
+			data = SyntheticDigits(DATATYPE::TRAIN, config.samples);
+			res = HostTuning{};
+			res.host = HostName();
+			res.layers = config.layers;
+
+			// unpacked batched inference runs the blocked Multiply, packed inference the row blocked panels
+			KernelTuning tuning = GetKernelTuning();
+			std::cout << std::fixed << std::setprecision(1) << "gemm block   inference samples/s\n";
+			double best = 0.0;
+			for (int block : config.gemmBlocks)
+			{
+				tuning.gemmBlock = block;
+				SetKernelTuning(tuning);
+				double rate = InferenceRate(false);
+				std::cout << std::left << std::setw(13) << BlockString(block) << std::right << std::setw(10) << rate << '\n';
+				if (rate > best)
+				{
+					best = rate;
+					res.kernels.gemmBlock = block;
+				}
+			}
+			tuning.gemmBlock = res.kernels.gemmBlock;
+
+			std::cout << "row block    packed inference samples/s\n";
+			best = 0.0;
+			for (int block : config.rowBlocks)
+			{
+				tuning.rowBlock = block;
+				SetKernelTuning(tuning);
+				double rate = InferenceRate(true);
+				std::cout << std::left << std::setw(13) << BlockString(block) << std::right << std::setw(10) << rate << '\n';
+				if (rate > best)
+				{
+					best = rate;
+					res.kernels.rowBlock = block;
+				}
+			}
+			res.inferSamplesPerSecond = best;
+			SetKernelTuning(res.kernels);
+
+			// candidates in order of preference, the smallest batch and fewest threads first
+			std::vector<int> batches = config.batchSizes;
+			std::vector<int> threads = config.threads;
+			std::sort(batches.begin(), batches.end());
+			std::sort(threads.begin(), threads.end());
+			std::cout << "batch  threads  train samples/s\n";
+			best = 0.0;
+			for (int batch : batches)
+			{
+				if (batch < config.minBatch || batch > config.maxBatch || batch > (int)data.size())
+				{
+					continue;
+				}
+				for (int t : threads)
+				{
+					if (t > 1 && batch / t < config.minSlice)
+					{
+						continue;
+					}
+					double rate = TrainRate(batch, t);
+					std::cout << std::setw(5) << batch << "  " << std::setw(7) << t << "  " << std::setw(15) << rate << '\n';
+					if (rate > best * (1.0 + config.tieFraction))
+					{
+						best = rate;
+						res.batchSize = batch;
+						res.threads = t;
+					}
+				}
+			}
+			res.trainSamplesPerSecond = best;
+			std::cout << std::defaultfloat << std::setprecision(6);
+			return best > 0.0;
+		}
+
+		const AutotuneConfig& GetConfig() const { return config; }
+	private:
+		double InferenceRate(bool packed)
+		{
+			SetRandomSeed(1);
+			net::Network model{ config.layers, net::actf::ACTIVATION_TYPE::RELU, net::actf::ACTIVATION_TYPE::SOFTMAX };
+			if (packed)
+			{
+				model.Pack();
+			}
+			const int rows = std::min(config.inferenceBatch, (int)data.size());
+			Matrix<double> inputs{ {}, rows, config.layers.front() };
+			for (int r = 0; r < rows; r++)
+			{
+				std::copy(data[r].input.GetValues().begin(), data[r].input.GetValues().end(), inputs.GetValues().begin() + (std::size_t)r * inputs.GetColumns());
+			}
+
+			model.FeedBatch(inputs);     // warm up
+			return Timed([&]() { model.FeedBatch(inputs); return rows; });
+		}
+
+		double TrainRate(int batchSize, int threads)
+		{
+			SetRandomSeed(1);
+			net::Network model{ config.layers, net::actf::ACTIVATION_TYPE::RELU, net::actf::ACTIVATION_TYPE::SOFTMAX };
+			net::DataParallel parallel{ model, threads };
+			std::vector<DataPoint<double>> batch;
+			std::size_t next = 0;
+			auto step = [&]()
+			{
+				batch.clear();
+				for (int i = 0; i < batchSize; i++, next++)
+				{
+					batch.push_back(data[next % data.size()]);
+				}
+				parallel.Learn(batch, 0.01);
+				return batchSize;
+			};
+
+			step();                     // warm up
+			return Timed(step);
+		}
+
+		// samples per second of repeated calls for at least trialSeconds
+		template<typename F>
+		double Timed(F&& run)
+		{
+			using clock = std::chrono::steady_clock;
+			auto start = clock::now();
+			long long samples = 0;
+			double elapsed = 0.0;
+			do
+			{
+				samples += run();
+				elapsed = std::chrono::duration<double>(clock::now() - start).count();
+			} while (elapsed < config.trialSeconds);
+			return (double)samples / elapsed;
+		}
+
+		static std::string BlockString(int block)
+		{
+			return block > 0 ? std::to_string(block) : std::string("off");
+		}
+	private:
+		AutotuneConfig config;
+		std::vector<DataPoint<double>> data;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,249 @@
+#pragma once
+
+#include "Network.h"
+#include "ImageDecoder.h"
+#include "Concurrent.h"
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+namespace util
+{
+	struct ClassifyConfig
+	{
+		int ioWorkers = 4;
+		int batchSize = 256;
+		std::size_t queueDepth = 4096;  // decoded images waiting for the classifier
+	};
+
+	// a directory (searched recursively for .bmp/.pgm files) or a text file with one image path per line
+	inline std::vector<std::string> ListImages(const std::string& input)
+	{
+		namespace fs = std::filesystem;
+		std::vector<std::string> files;
+		std::error_code ec;
+
+		if (fs::is_directory(input, ec))
+		{
+			for (auto it = fs::recursive_directory_iterator(input, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+			{
+				if (!it->is_regular_file(ec))
+				{
+					continue;
+				}
+				std::string ext = it->path().extension().string();
+				std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+				if (ext == ".bmp" || ext == ".pgm")
+				{
+					files.push_back(it->path().string());
+				}
+			}
+			std::sort(files.begin(), files.end());
+		}
+		else
+		{
+			std::ifstream list(input);
+			std::string line;
+			while (std::getline(list, line))
+			{
+				if (!line.empty() && line.back() == '\r')
+				{
+					line.pop_back();
+				}
+				if (!line.empty())
+				{
+					files.push_back(line);
+				}
+			}
+		}
+		return files;
+	}
+
+	// decode -> batch -> classify -> write pipeline, decoding runs on ioWorkers threads and the csv is written on its own thread
+	// rows are written in completion order: path,label,probability,error
+	class BatchClassifier
+	{
+	public:
+		BatchClassifier(const net::Network& model, ClassifyConfig config)
+			: model(model), config(config)
+		{}
+
+		void Run(const std::vector<std::string>& files, std::ostream& csv)
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			BoundedQueue<Decoded> decoded{ config.queueDepth };
+			BoundedQueue<std::vector<Row>> results{ 64 };
+
+			std::atomic<std::size_t> next{ 0 };
+			std::atomic<int> activeWorkers{ config.ioWorkers };
+			std::vector<std::thread> workers;
+			for (int w = 0; w < config.ioWorkers; w++)
+			{
+				workers.emplace_back([&]()
+				{
+					GrayImage image;
+					for (std::size_t i = next++; i < files.size(); i = next++)
+					{
+						Decoded item;
+						item.path = &files[i];
+						if (DecodeImageFile(files[i], image, item.error))
+						{
+							if (image.width == 28 && image.height == 28)
+							{
+								std::copy(image.pixels.begin(), image.pixels.end(), item.pixels.begin());
+							}
+							else
+							{
+								item.error = "image is not 28x28";
+							}
+						}
+						else if (item.error.empty())
+						{
+							item.error = "decode failed";
+						}
+						decoded.Push(std::move(item));
+					}
+					if (--activeWorkers == 0)
+					{
+						decoded.Close();
+					}
+				});
+			}
+
+			std::thread writer([&]()
+			{
+				std::vector<Row> rows;
+				csv << "path,label,probability,error\n";
+				while (results.Pop(rows))
+				{
+					for (const Row& row : rows)
+					{
+						WriteCsvField(csv, *row.path);
+						csv << ',' << row.prediction.label << ',' << row.prediction.probability << ',';
+						WriteCsvField(csv, row.error);
+						csv << '\n';
+						if (!row.error.empty())
+						{
+							failed++;
+						}
+					}
+				}
+				csv.flush();
+			});
+
+			// classifier stage runs on the calling thread
+			std::vector<Decoded> batch;
+			batch.reserve(config.batchSize);
+			std::vector<Row> errors;
+			Decoded item;
+			while (decoded.Pop(item))
+			{
+				if (!item.error.empty())
+				{
+					errors.push_back({ item.path, {}, item.error });
+					if (errors.size() >= (std::size_t)config.batchSize)
+					{
+						results.Push(std::move(errors));
+						errors.clear();
+					}
+					continue;
+				}
+				batch.push_back(std::move(item));
+				if ((int)batch.size() == config.batchSize)
+				{
+					results.Push(Classify(batch));
+					batch.clear();
+				}
+			}
+			if (!batch.empty())
+			{
+				results.Push(Classify(batch));
+			}
+			if (!errors.empty())
+			{
+				results.Push(std::move(errors));
+			}
+			results.Close();
+
+			for (std::thread& t : workers)
+			{
+				t.join();
+			}
+			writer.join();
+
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			processed = files.size();
+		}
+
+		std::size_t GetProcessed() const { return processed; }
+		std::size_t GetFailed() const { return failed; }
+		double GetSeconds() const { return seconds; }
+	private:
+		struct Decoded
+		{
+			const std::string* path = nullptr;
+			std::array<std::uint8_t, 28 * 28> pixels;
+			std::string error;
+		};
+
+		struct Row
+		{
+			const std::string* path;
+			Prediction prediction;
+			std::string error;
+		};
+
+		std::vector<Row> Classify(const std::vector<Decoded>& batch) const
+		{
+			util::Matrix<double> inputs{ {}, (int)batch.size(), 28 * 28 };
+			for (int r = 0; r < (int)batch.size(); r++)
+			{
+				const std::uint8_t* px = batch[r].pixels.data();
+				for (int c = 0; c < 28 * 28; c++)
+				{
+					inputs(r, c) = (double)px[c] / 255.0;
+				}
+			}
+			util::Matrix<double> outputs = model.FeedBatch(inputs);
+
+			std::vector<Row> rows;
+			rows.reserve(batch.size());
+			for (int r = 0; r < (int)batch.size(); r++)
+			{
+				rows.push_back({ batch[r].path, TopClass(outputs, r), {} });
+			}
+			return rows;
+		}
+
+		static void WriteCsvField(std::ostream& out, const std::string& field)
+		{
+			if (field.find_first_of(",\"\n") == std::string::npos)
+			{
+				out << field;
+				return;
+			}
+			out << '"';
+			for (char c : field)
+			{
+				if (c == '"')
+				{
+					out << '"';
+				}
+				out << c;
+			}
+			out << '"';
+		}
+	private:
+		const net::Network& model;
+		ClassifyConfig config;
+
+		std::size_t processed = 0;
+		std::size_t failed = 0;
+		double seconds = 0.0;
+	};
+}
\ No newline at end of file
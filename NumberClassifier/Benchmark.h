@@ -0,0 +1,267 @@
+#pragma once
+
+#include "Network.h"
+#include "Trainer.h"
+#include "MNISTReader.h"
+#include "Random.h"
+#include "Signal.h"
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+namespace util
+{
+	// peak resident set size of this process in MiB
+	inline double PeakRssMb()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS pmc{};
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		{
+			return 0.0;
+		}
+		return (double)pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+		rusage usage{};
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+		{
+			return 0.0;
+		}
+#ifdef __APPLE__
+		return (double)usage.ru_maxrss / (1024.0 * 1024.0);  // bytes
+#else
+		return (double)usage.ru_maxrss / 1024.0;             // KiB
+#endif
+#endif
+	}
+
+	struct BenchmarkConfig
+	{
+		std::vector<int> layers{ 784, 256, 256, 10 };
+		double target = 0.90;           // test accuracy that stops the run
+		int maxEpochs = 20;
+		int batchSize = 100;
+		double learnRate = 0.05;
+		std::uint64_t seed = 1;
+		int evalInterval = 0;           // steps between evaluations, 0 evaluates at the end of each epoch
+		int evalSamples = 0;            // test points per evaluation, 0 uses the full test set
+
+		std::string trainImages = "train-images.idx3-ubyte";
+		std::string trainLabels = "train-labels.idx1-ubyte";
+		std::string testImages = "t10k-images.idx3-ubyte";
+		std::string testLabels = "t10k-labels.idx1-ubyte";
+		bool forceSynthetic = false;    // ignore the MNIST files even if they exist
+		int syntheticTrain = 20000;
+		int syntheticTest = 2000;
+	};
+
+	struct BenchmarkResult
+	{
+		std::string dataset;            // "mnist" or "synthetic-<train>-<test>", only equal datasets are comparable
+		bool reached = false;
+		long long steps = 0;            // until the target or the end of the run
+		double epochs = 0.0;
+		double trainSeconds = 0.0;      // time inside Learn only
+		double wallSeconds = 0.0;       // including evaluations
+		double samplesPerSecond = 0.0;
+		double accuracy = 0.0;          // last evaluation
+		double peakRssMb = 0.0;
+
+		// one "key value" pair per line
+		bool Save(const std::string& path) const
+		{
+			std::ofstream out(path);
+			out << std::setprecision(10)
+				<< "dataset " << dataset << '\n'
+				<< "reached " << reached << '\n'
+				<< "steps " << steps << '\n'
+				<< "epochs " << epochs << '\n'
+				<< "train_seconds " << trainSeconds << '\n'
+				<< "wall_seconds " << wallSeconds << '\n'
+				<< "samples_per_second " << samplesPerSecond << '\n'
+				<< "accuracy " << accuracy << '\n'
+				<< "peak_rss_mb " << peakRssMb << '\n';
+			return (bool)out;
+		}
+
+		bool Load(const std::string& path)
+		{
+			std::ifstream in(path);
+			if (!in)
+			{
+				return false;
+			}
+			std::string key;
+			while (in >> key)
+			{
+				if (key == "dataset") in >> dataset;
+				else if (key == "reached") in >> reached;
+				else if (key == "steps") in >> steps;
+				else if (key == "epochs") in >> epochs;
+				else if (key == "train_seconds") in >> trainSeconds;
+				else if (key == "wall_seconds") in >> wallSeconds;
+				else if (key == "samples_per_second") in >> samplesPerSecond;
+				else if (key == "accuracy") in >> accuracy;
+				else if (key == "peak_rss_mb") in >> peakRssMb;
+				else
+				{
+					std::string skip;
+					std::getline(in, skip);
+				}
+			}
+			return !dataset.empty();
+		}
+	};
+
+	// trains the configured network from a fixed seed until it reaches the target accuracy
+	class EndToEndBenchmark
+	{
+	public:
+		EndToEndBenchmark(BenchmarkConfig config)
+			: config(config)
+		{}
+
+		BenchmarkResult Run()
+		{
+			using clock = std::chrono::steady_clock;
+			auto wallStart = clock::now();
+			SetRandomSeed(config.seed);
+
+			BenchmarkResult res;
+			std::vector<DataPoint<double>> train, test;
+			if (!config.forceSynthetic && FileExists(config.trainImages) && FileExists(config.trainLabels) && FileExists(config.testImages) && FileExists(config.testLabels))
+			{
+				train = MNISTReader{ config.trainImages, config.trainLabels }.GetData(DATATYPE::TRAIN);
+				test = MNISTReader{ config.testImages, config.testLabels }.GetData(DATATYPE::TEST);
+				res.dataset = "mnist";
+			}
+			if (train.empty() || test.empty())
+			{
+				train = SyntheticDigits(DATATYPE::TRAIN, config.syntheticTrain);
+				test = SyntheticDigits(DATATYPE::TEST, config.syntheticTest);
+				res.dataset = "synthetic-" + std::to_string(config.syntheticTrain) + "-" + std::to_string(config.syntheticTest);
+			}
+			const double n_train = (double)train.size();
+			std::cout << "Benchmark on " << res.dataset << ": " << train.size() << " train / " << test.size() << " test, target "
+				<< config.target * 100.0 << "%\n";
+
+			// the test set is evaluated batched, the first evalSamples points every time
+			int n_test = config.evalSamples <= 0 ? (int)test.size() : std::min(config.evalSamples, (int)test.size());
+			Matrix<double> testInputs{ {}, n_test, test[0].input.GetColumns() };
+			std::vector<int> testLabels(n_test);
+			for (int r = 0; r < n_test; r++)
+			{
+				std::copy(test[r].input.GetValues().begin(), test[r].input.GetValues().end(), testInputs.GetValues().begin() + (std::size_t)r * testInputs.GetColumns());
+				testLabels[r] = (int)test[r].label;
+			}
+
+			net::Network model{ config.layers, net::actf::ACTIVATION_TYPE::RELU, net::actf::ACTIVATION_TYPE::SOFTMAX };
+			Trainer trainer{ config.batchSize, std::move(train), {} };
+			const int n_batches = (int)trainer.GetTrainingDataBatches().size();
+
+			long long samples = 0;
+			for (int epoch = 0; epoch < config.maxEpochs && !res.reached && !StopRequested(); epoch++)
+			{
+				for (int b = 0; b < n_batches && !res.reached && !StopRequested(); b++)
+				{
+					auto start = clock::now();
+					trainer.Train(model, config.learnRate, b);
+					res.trainSeconds += std::chrono::duration<double>(clock::now() - start).count();
+					samples += (long long)trainer.GetTrainingDataBatches()[b].size();
+					res.steps++;
+
+					const bool epochEnd = b == n_batches - 1;
+					if (config.evalInterval > 0 ? res.steps % config.evalInterval == 0 || epochEnd : epochEnd)
+					{
+						res.accuracy = Evaluate(model, testInputs, testLabels);
+						res.reached = res.accuracy >= config.target;
+						std::cout << std::fixed << std::setprecision(2) << "epoch " << (double)samples / n_train << " | test acc "
+							<< res.accuracy * 100.0 << "% | " << res.trainSeconds << " s\n" << std::defaultfloat << std::setprecision(6);
+					}
+				}
+			}
+
+			res.epochs = (double)samples / n_train;
+			res.samplesPerSecond = res.trainSeconds > 0.0 ? (double)samples / res.trainSeconds : 0.0;
+			res.wallSeconds = std::chrono::duration<double>(clock::now() - wallStart).count();
+			res.peakRssMb = PeakRssMb();
+			return res;
+		}
+	private:
+		static double Evaluate(net::Network& model, const Matrix<double>& inputs, const std::vector<int>& labels)
+		{
+			model.Pack();
+			Matrix<double> outputs = model.FeedBatch(inputs);
+			int correct = 0;
+			for (int r = 0; r < outputs.GetRows(); r++)
+			{
+				correct += TopClass(outputs, r).label == labels[r];
+			}
+			return labels.empty() ? 0.0 : (double)correct / labels.size();
+		}
+
+		static bool FileExists(const std::string& path)
+		{
+			return (bool)std::ifstream(path, std::ios::binary);
+		}
+	private:
+		BenchmarkConfig config;
+	};
+
+	inline void PrintBenchmark(const BenchmarkResult& r)
+	{
+		std::cout << std::fixed << std::setprecision(2)
+			<< (r.reached ? "reached" : "did not reach") << " the target after " << r.epochs << " epochs (" << r.steps << " steps)\n"
+			<< "time to accuracy " << r.trainSeconds << " s training, " << r.wallSeconds << " s wall | "
+			<< std::setprecision(1) << r.samplesPerSecond << " samples/s | accuracy " << std::setprecision(2) << r.accuracy * 100.0
+			<< "% | peak RSS " << std::setprecision(1) << r.peakRssMb << " MiB\n"
+			<< std::defaultfloat << std::setprecision(6);
+	}
+
+	// relative tolerance per metric in the direction that counts as a regression, returns true if nothing regressed
+	inline bool CompareBenchmark(const BenchmarkResult& now, const BenchmarkResult& base, double tolerance)
+	{
+		if (now.dataset != base.dataset)
+		{
+			std::cout << "Baseline was measured on " << base.dataset << ", this run on " << now.dataset << ": not comparable\n";
+			return false;
+		}
+
+		bool pass = true;
+		auto row = [&](const char* name, double current, double baseline, bool higherIsBetter)
+		{
+			double limit = higherIsBetter ? baseline * (1.0 - tolerance) : baseline * (1.0 + tolerance);
+			bool ok = higherIsBetter ? current >= limit : current <= limit;
+			pass = pass && ok;
+			std::cout << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(3)
+				<< std::setw(12) << current << std::setw(12) << baseline << std::setw(9) << std::setprecision(1)
+				<< (baseline != 0.0 ? (current / baseline - 1.0) * 100.0 : 0.0) << "%  " << (ok ? "ok" : "REGRESSION") << '\n'
+				<< std::defaultfloat << std::setprecision(6);
+		};
+
+		std::cout << "metric                   current    baseline   change\n";
+		if (base.reached && !now.reached)
+		{
+			std::cout << "target                   missed     reached            REGRESSION\n";
+			pass = false;
+		}
+		row("train seconds", now.trainSeconds, base.trainSeconds, false);
+		row("epochs", now.epochs, base.epochs, false);
+		row("samples/s", now.samplesPerSecond, base.samplesPerSecond, true);
+		row("peak RSS MiB", now.peakRssMb, base.peakRssMb, false);
+		std::cout << (pass ? "PASS" : "FAIL") << " (tolerance " << tolerance * 100.0 << "%)\n";
+		return pass;
+	}
+}
\ No newline at end of file
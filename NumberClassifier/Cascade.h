@@ -0,0 +1,197 @@
+#pragma once
+
+#include "Network.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <vector>
+
+namespace net
+{
+	// early-exit inference: a small network answers when its top probability reaches the threshold,
+	// everything else falls through to the large network
+	class Cascade
+	{
+	public:
+		Cascade(const Network& small, const Network& large, double threshold)
+			: small(small), large(large), threshold(threshold)
+		{}
+
+		// one sample per row of inputs, exited (optional) marks the rows the small network answered
+		std::vector<util::Prediction> ClassifyBatch(const util::Matrix<double>& inputs, std::vector<char>* exited = nullptr) const
+		{
+			const int n = inputs.GetRows();
+			const int cols = inputs.GetColumns();
+			util::Matrix<double> first = small.FeedBatch(inputs);
+
+			std::vector<util::Prediction> res(n);
+			std::vector<int> hard;
+			for (int r = 0; r < n; r++)
+			{
+				res[r] = util::TopClass(first, r);
+				if (res[r].probability < threshold)
+				{
+					hard.push_back(r);
+				}
+			}
+			if (exited)
+			{
+				exited->assign(n, 1);
+				for (int r : hard)
+				{
+					(*exited)[r] = 0;
+				}
+			}
+			if (hard.empty())
+			{
+				return res;
+			}
+
+			// only the rows below the threshold go through the large network
+			util::Matrix<double> rest{ {}, (int)hard.size(), cols };
+			for (std::size_t i = 0; i < hard.size(); i++)
+			{
+				std::copy(inputs.GetValues().begin() + (std::size_t)hard[i] * cols, inputs.GetValues().begin() + (std::size_t)(hard[i] + 1) * cols,
+					rest.GetValues().begin() + i * cols);
+			}
+			util::Matrix<double> second = large.FeedBatch(rest);
+			for (std::size_t i = 0; i < hard.size(); i++)
+			{
+				res[hard[i]] = util::TopClass(second, (int)i);
+			}
+			return res;
+		}
+
+		util::Prediction Classify(const util::Matrix<double>& input, bool* exited = nullptr) const
+		{
+			std::vector<char> e;
+			util::Prediction p = ClassifyBatch(input, &e)[0];
+			if (exited)
+			{
+				*exited = e[0] != 0;
+			}
+			return p;
+		}
+
+		void SetThreshold(double t) { threshold = t; }
+		double GetThreshold() const { return threshold; }
+	private:
+		const Network& small;
+		const Network& large;
+		double threshold;
+	};
+
+	struct CascadeCalibration
+	{
+		double threshold = std::numeric_limits<double>::infinity();
+		double accuracy = 0.0;          // cascade accuracy on the calibration data at the threshold
+		double exitFraction = 0.0;
+		bool reached = false;           // false if no threshold reaches the target, the threshold then maximizes accuracy
+	};
+
+	// lowest threshold (most early exits) at which the cascade still reaches targetAccuracy on the given samples
+	inline CascadeCalibration CalibrateCascade(const Network& small, const Network& large, const util::Matrix<double>& inputs, const std::vector<int>& labels, double targetAccuracy)
+	{
+		const int n = inputs.GetRows();
+		CascadeCalibration res;
+		if (n == 0)
+		{
+			return res;
+		}
+
+		util::Matrix<double> first = small.FeedBatch(inputs);
+		util::Matrix<double> second = large.FeedBatch(inputs);
+
+		struct Sample
+		{
+			double confidence;
+			bool smallCorrect;
+			bool largeCorrect;
+		};
+		std::vector<Sample> samples(n);
+		int largeCorrect = 0;
+		for (int r = 0; r < n; r++)
+		{
+			util::Prediction p = util::TopClass(first, r);
+			samples[r] = { p.probability, p.label == labels[r], util::TopClass(second, r).label == labels[r] };
+			largeCorrect += samples[r].largeCorrect;
+		}
+		std::sort(samples.begin(), samples.end(), [](const Sample& a, const Sample& b) { return a.confidence > b.confidence; });
+
+		// the k most confident samples exit early, only cuts between distinct confidences are reachable with a threshold
+		int correct = largeCorrect;
+		res.accuracy = (double)largeCorrect / n;
+		res.reached = res.accuracy >= targetAccuracy;
+		CascadeCalibration best = res;
+		for (int k = 1; k <= n; k++)
+		{
+			const Sample& s = samples[k - 1];
+			correct += (int)s.smallCorrect - (int)s.largeCorrect;
+			if (k < n && samples[k].confidence == s.confidence)
+			{
+				continue;
+			}
+			double acc = (double)correct / n;
+			if (acc >= targetAccuracy)
+			{
+				res = { s.confidence, acc, (double)k / n, true };
+			}
+			if (acc >= best.accuracy)
+			{
+				best = { s.confidence, acc, (double)k / n, false };
+			}
+		}
+		return res.reached ? res : best;
+	}
+
+	struct CascadeReport
+	{
+		double accuracy = 0.0;
+		double smallAccuracy = 0.0;
+		double largeAccuracy = 0.0;
+		double exitFraction = 0.0;
+		double cascadeLatencyUs = 0.0;  // mean single sample latency
+		double largeLatencyUs = 0.0;
+	};
+
+	// accuracy and single sample latency of the cascade against the large network alone
+	inline CascadeReport EvaluateCascade(const Cascade& cascade, const Network& small, const Network& large, const util::Matrix<double>& inputs, const std::vector<int>& labels)
+	{
+		CascadeReport res;
+		const int n = inputs.GetRows();
+		const int cols = inputs.GetColumns();
+		if (n == 0)
+		{
+			return res;
+		}
+
+		int correct = 0, smallCorrect = 0, largeCorrect = 0, exits = 0;
+		double cascadeUs = 0.0, largeUs = 0.0;
+		util::Matrix<double> row{ {}, 1, cols };
+		for (int r = 0; r < n; r++)
+		{
+			std::copy(inputs.GetValues().begin() + (std::size_t)r * cols, inputs.GetValues().begin() + (std::size_t)(r + 1) * cols, row.GetValues().begin());
+
+			auto t0 = std::chrono::steady_clock::now();
+			bool exited = false;
+			util::Prediction p = cascade.Classify(row, &exited);
+			auto t1 = std::chrono::steady_clock::now();
+			util::Prediction pl = util::TopClass(large.FeedBatch(row));
+			auto t2 = std::chrono::steady_clock::now();
+
+			cascadeUs += std::chrono::duration<double, std::micro>(t1 - t0).count();
+			largeUs += std::chrono::duration<double, std::micro>(t2 - t1).count();
+			correct += p.label == labels[r];
+			largeCorrect += pl.label == labels[r];
+			smallCorrect += util::TopClass(small.FeedBatch(row)).label == labels[r];
+			exits += exited;
+		}
+		res.accuracy = (double)correct / n;
+		res.smallAccuracy = (double)smallCorrect / n;
+		res.largeAccuracy = (double)largeCorrect / n;
+		res.exitFraction = (double)exits / n;
+		res.cascadeLatencyUs = cascadeUs / n;
+		res.largeLatencyUs = largeUs / n;
+		return res;
+	}
+}
\ No newline at end of file
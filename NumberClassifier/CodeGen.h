@@ -0,0 +1,205 @@
+#pragma once
+
+#include "Network.h"
+#include "MNISTReader.h"
+#include <fstream>
+#include <algorithm>
+#include <iomanip>
+#include <string>
+
+namespace net
+{
+	// writes `network` as a self-contained C++17 header: the weights as aligned constexpr arrays and an inference
+	// function for exactly this topology, every loop bound a template argument, nothing but <cmath> included
+	// values are written as hex floats so the header reproduces the weights bit for bit
+	class HeaderExporter
+	{
+	public:
+		HeaderExporter(const Network& network, std::string name)
+			: network(network), name(name)
+		{}
+
+		// the name becomes the namespace of the generated header, so it has to be a C++ identifier and not a keyword
+		static bool IsValidName(const std::string& name)
+		{
+			static const char* const keywords[] = {
+				"alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case", "catch", "char",
+				"char8_t", "char16_t", "char32_t", "class", "compl", "concept", "const", "consteval", "constexpr", "constinit",
+				"const_cast", "continue", "co_await", "co_return", "co_yield", "decltype", "default", "delete", "do", "double",
+				"dynamic_cast", "else", "enum", "explicit", "export", "extern", "false", "float", "for", "friend", "goto", "if",
+				"inline", "int", "long", "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or",
+				"or_eq", "private", "protected", "public", "register", "reinterpret_cast", "requires", "return", "short", "signed",
+				"sizeof", "static", "static_assert", "static_cast", "struct", "switch", "template", "this", "thread_local", "throw",
+				"true", "try", "typedef", "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile",
+				"wchar_t", "while", "xor", "xor_eq"
+			};
+			auto alpha = [](char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; };
+			auto alnum = [&](char c) { return alpha(c) || (c >= '0' && c <= '9'); };
+			return !name.empty() && alpha(name[0]) && std::all_of(name.begin(), name.end(), alnum)
+				&& std::find(std::begin(keywords), std::end(keywords), name) == std::end(keywords);
+		}
+
+		bool WriteHeader(const std::string& path, const std::string& source) const
+		{
+			const std::vector<int>& sizes = network.GetLayerSizes();
+			const int n_layers = (int)sizes.size();
+			std::ofstream out(path);
+			out << std::hexfloat
+				<< "#pragma once\n\n"
+				<< "// generated from " << source << " by NumberClassifier export, do not edit\n"
+				<< "// " << Topology() << " network, " << ActivationName(network.GetHiddenActivation()) << " hidden / "
+				<< ActivationName(network.GetOutputActivation()) << " output\n\n"
+				<< "#include <cmath>\n\n"
+				<< "namespace " << name << "\n{\n"
+				<< "\tconstexpr int n_layers = " << n_layers << ";\n"
+				<< "\tconstexpr int input_size = " << sizes.front() << ";\n"
+				<< "\tconstexpr int output_size = " << sizes.back() << ";\n\n";
+
+			for (int l = 1; l < n_layers; l++)
+			{
+				const Layer& layer = network.GetLayer(l);
+				out << "\t// layer " << l << ": " << sizes[l - 1] << " inputs x " << sizes[l] << " outputs, row major like Layer\n";
+				WriteArray(out, "w" + std::to_string(l), layer.GetWeights().GetValues().data(), layer.GetWeights().GetValues().size());
+				WriteArray(out, "b" + std::to_string(l), layer.GetBiases().GetValues().data(), layer.GetBiases().GetValues().size());
+				out << '\n';
+			}
+
+			out << "\tnamespace detail\n\t{\n"
+				<< "\t\t// y = x * w + b, summed in the same order as Network::Feed\n"
+				<< "\t\ttemplate<int In, int Out>\n"
+				<< "\t\tinline void Dense(const double* x, const double* w, const double* b, double* y)\n"
+				<< "\t\t{\n"
+				<< "\t\t\tfor (int j = 0; j < Out; j++)\n\t\t\t{\n\t\t\t\ty[j] = 0.0;\n\t\t\t}\n"
+				<< "\t\t\tfor (int k = 0; k < In; k++)\n\t\t\t{\n"
+				<< "\t\t\t\tconst double xk = x[k];\n"
+				<< "\t\t\t\tfor (int j = 0; j < Out; j++)\n\t\t\t\t{\n\t\t\t\t\ty[j] += xk * w[k * Out + j];\n\t\t\t\t}\n\t\t\t}\n"
+				<< "\t\t\tfor (int j = 0; j < Out; j++)\n\t\t\t{\n\t\t\t\ty[j] += b[j];\n\t\t\t}\n"
+				<< "\t\t}\n";
+			if (Uses(actf::ACTIVATION_TYPE::SIGMOID))
+			{
+				out << "\n\t\ttemplate<int N>\n"
+					<< "\t\tinline void Sigmoid(double* y)\n\t\t{\n"
+					<< "\t\t\tfor (int i = 0; i < N; i++)\n\t\t\t{\n\t\t\t\ty[i] = 1.0 / (1.0 + std::exp(-y[i]));\n\t\t\t}\n\t\t}\n";
+			}
+			if (Uses(actf::ACTIVATION_TYPE::RELU))
+			{
+				out << "\n\t\ttemplate<int N>\n"
+					<< "\t\tinline void ReLU(double* y)\n\t\t{\n"
+					<< "\t\t\tfor (int i = 0; i < N; i++)\n\t\t\t{\n\t\t\t\ty[i] = y[i] > 0.0 ? y[i] : 0.0;\n\t\t\t}\n\t\t}\n";
+			}
+			if (Uses(actf::ACTIVATION_TYPE::SOFTMAX))
+			{
+				out << "\n\t\ttemplate<int N>\n"
+					<< "\t\tinline void Softmax(double* y)\n\t\t{\n"
+					<< "\t\t\tdouble expSum = 0.0;\n"
+					<< "\t\t\tfor (int i = 0; i < N; i++)\n\t\t\t{\n\t\t\t\texpSum += std::exp(y[i]);\n\t\t\t}\n"
+					<< "\t\t\tfor (int i = 0; i < N; i++)\n\t\t\t{\n\t\t\t\ty[i] = std::exp(y[i]) / expSum;\n\t\t\t}\n\t\t}\n";
+			}
+			out << "\t}\n\n";
+
+			out << "\t// input: input_size values, output: output_size values\n"
+				<< "\tinline void Infer(const double* input, double* output)\n\t{\n";
+			for (int l = 1; l < n_layers - 1; l++)
+			{
+				out << "\t\talignas(64) double h" << l << "[" << sizes[l] << "];\n";
+			}
+			for (int l = 1; l < n_layers; l++)
+			{
+				const std::string x = l == 1 ? "input" : "h" + std::to_string(l - 1);
+				const std::string y = l == n_layers - 1 ? "output" : "h" + std::to_string(l);
+				const actf::ACTIVATION_TYPE activation = network.GetLayer(l).GetActivation();
+				out << "\t\tdetail::Dense<" << sizes[l - 1] << ", " << sizes[l] << ">(" << x << ", w" << l << ", b" << l << ", " << y << ");\n"
+					<< "\t\tdetail::" << ActivationName(activation, true) << "<" << sizes[l] << ">(" << y << ");\n";
+			}
+			out << "\t}\n\n"
+				<< "\t// index of the largest output\n"
+				<< "\tinline int Classify(const double* input)\n\t{\n"
+				<< "\t\tdouble output[output_size];\n"
+				<< "\t\tInfer(input, output);\n"
+				<< "\t\tint best = 0;\n"
+				<< "\t\tfor (int i = 1; i < output_size; i++)\n\t\t{\n\t\t\tbest = output[i] > output[best] ? i : best;\n\t\t}\n"
+				<< "\t\treturn best;\n\t}\n"
+				<< "}\n";
+			return (bool)out;
+		}
+
+		// a standalone program that compares Infer from the header with the outputs Network::Feed gave for
+		// `probes` synthetic digits, exits with 0 if every output is within `tolerance`
+		bool WriteCheck(const std::string& path, const std::string& headerInclude, int probes, double tolerance) const
+		{
+			Network model = network;
+			const int n_in = network.GetInputSize();
+			std::vector<double> inputs, outputs;
+			for (int i = 0; i < probes; i++)
+			{
+				util::DataPoint<double> dp = util::SyntheticDigit(util::DATATYPE::TEST, i);
+				util::Matrix<double> x{ {}, 1, n_in };
+				std::copy_n(dp.input.GetValues().begin(), std::min(n_in, dp.input.GetSize()), x.GetValues().begin());
+				util::Matrix<double> y = model.Feed(x);
+				inputs.insert(inputs.end(), x.GetValues().begin(), x.GetValues().end());
+				outputs.insert(outputs.end(), y.GetValues().begin(), y.GetValues().end());
+			}
+
+			std::ofstream out(path);
+			out << std::hexfloat
+				<< "// generated by NumberClassifier export: checks " << headerInclude << " against Network::Feed\n\n"
+				<< "#include \"" << headerInclude << "\"\n"
+				<< "#include <cmath>\n#include <cstdio>\n\n"
+				<< "constexpr int n_probes = " << probes << ";\n";
+			WriteArray(out, "inputs", inputs.data(), inputs.size(), "");
+			WriteArray(out, "expected", outputs.data(), outputs.size(), "");
+			out << std::defaultfloat << std::setprecision(17)
+				<< "\nint main()\n{\n"
+				<< "\tdouble worst = 0.0;\n"
+				<< "\tfor (int p = 0; p < n_probes; p++)\n\t{\n"
+				<< "\t\tdouble output[" << name << "::output_size];\n"
+				<< "\t\t" << name << "::Infer(inputs + p * " << name << "::input_size, output);\n"
+				<< "\t\tfor (int i = 0; i < " << name << "::output_size; i++)\n\t\t{\n"
+				<< "\t\t\tconst double err = std::fabs(output[i] - expected[p * " << name << "::output_size + i]);\n"
+				<< "\t\t\tworst = err > worst ? err : worst;\n\t\t}\n\t}\n"
+				<< "\tconst bool ok = worst <= " << tolerance << ";\n"
+				<< "\tstd::printf(\"%d probes, max abs error %g: %s\\n\", n_probes, worst, ok ? \"ok\" : \"MISMATCH\");\n"
+				<< "\treturn ok ? 0 : 1;\n}\n";
+			return (bool)out;
+		}
+	private:
+		static void WriteArray(std::ostream& out, const std::string& id, const double* values, std::size_t n, const char* indent = "\t")
+		{
+			out << indent << "alignas(64) inline constexpr double " << id << "[" << n << "] = {";
+			for (std::size_t i = 0; i < n; i++)
+			{
+				out << (i % 8 == 0 ? "\n\t" + std::string(indent) : " ") << values[i] << (i + 1 < n ? "," : "");
+			}
+			out << '\n' << indent << "};\n";
+		}
+
+		static std::string ActivationName(actf::ACTIVATION_TYPE type, bool function = false)
+		{
+			switch (type)
+			{
+			case actf::ACTIVATION_TYPE::SIGMOID: return function ? "Sigmoid" : "sigmoid";
+			case actf::ACTIVATION_TYPE::RELU: return function ? "ReLU" : "relu";
+			case actf::ACTIVATION_TYPE::SOFTMAX: return function ? "Softmax" : "softmax";
+			default: return "unknown";
+			}
+		}
+
+		bool Uses(actf::ACTIVATION_TYPE type) const
+		{
+			return network.GetOutputActivation() == type || (network.GetLayerSizes().size() > 2 && network.GetHiddenActivation() == type);
+		}
+
+		std::string Topology() const
+		{
+			std::string res;
+			for (int s : network.GetLayerSizes())
+			{
+				res += (res.empty() ? "" : "-") + std::to_string(s);
+			}
+			return res;
+		}
+	private:
+		const Network& network;
+		std::string name;
+	};
+}
\ No newline at end of file
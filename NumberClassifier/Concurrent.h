@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace util
+{
+	enum class POP
+	{
+		ITEM,
+		TIMEOUT,
+		CLOSED
+	};
+
+	// multi-producer multi-consumer queue, Push blocks while full so a slow stage throttles the ones before it
+	template<typename T>
+	class BoundedQueue
+	{
+	public:
+		BoundedQueue(std::size_t capacity)
+			: capacity(capacity)
+		{}
+
+		// returns false if the queue was closed
+		bool Push(T item)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			notFull.wait(lock, [this]() { return closed || items.size() < capacity; });
+			if (closed)
+			{
+				return false;
+			}
+			items.push_back(std::move(item));
+			notEmpty.notify_one();
+			return true;
+		}
+
+		// returns false once the queue is closed and drained
+		bool Pop(T& item)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			notEmpty.wait(lock, [this]() { return closed || !items.empty(); });
+			if (items.empty())
+			{
+				return false;
+			}
+			item = std::move(items.front());
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+
+		// like Pop but gives up at the deadline
+		template<typename Clock, typename Duration>
+		POP PopUntil(T& item, const std::chrono::time_point<Clock, Duration>& deadline)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			if (!notEmpty.wait_until(lock, deadline, [this]() { return closed || !items.empty(); }))
+			{
+				return POP::TIMEOUT;
+			}
+			if (items.empty())
+			{
+				return POP::CLOSED;
+			}
+			item = std::move(items.front());
+			items.pop_front();
+			notFull.notify_one();
+			return POP::ITEM;
+		}
+
+		// wakes all waiters, remaining items can still be popped
+		void Close()
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			closed = true;
+			notEmpty.notify_all();
+			notFull.notify_all();
+		}
+	private:
+		std::size_t capacity;
+		std::deque<T> items;
+		bool closed = false;
+
+		std::mutex mtx;
+		std::condition_variable notEmpty;
+		std::condition_variable notFull;
+	};
+
+	// single-producer single-consumer ring that never blocks or allocates after construction, for handing records off a hot loop
+	// the capacity is rounded up to a power of two, head and tail sit on their own cache lines
+	template<typename T>
+	class SpscRing
+	{
+	public:
+		SpscRing(std::size_t capacity)
+			: mask(RoundUp(capacity) - 1), slots(mask + 1)
+		{}
+
+		// producer side, returns false if the ring is full
+		bool TryPush(const T& item)
+		{
+			const std::size_t h = head.load(std::memory_order_relaxed);
+			if (h - cachedTail > mask)
+			{
+				cachedTail = tail.load(std::memory_order_acquire);
+				if (h - cachedTail > mask)
+				{
+					return false;
+				}
+			}
+			slots[h & mask] = item;
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+
+		// consumer side, returns false if the ring is empty
+		bool TryPop(T& item)
+		{
+			const std::size_t t = tail.load(std::memory_order_relaxed);
+			if (t == head.load(std::memory_order_acquire))
+			{
+				return false;
+			}
+			item = slots[t & mask];
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		std::size_t Capacity() const { return mask + 1; }
+	private:
+		static std::size_t RoundUp(std::size_t n)
+		{
+			std::size_t res = 1;
+			while (res < n)
+			{
+				res <<= 1;
+			}
+			return res;
+		}
+	private:
+		std::size_t mask;
+		std::vector<T> slots;
+
+		alignas(64) std::atomic<std::size_t> head{ 0 };
+		std::size_t cachedTail = 0;     // producer's last view of tail
+		alignas(64) std::atomic<std::size_t> tail{ 0 };
+	};
+}
\ No newline at end of file
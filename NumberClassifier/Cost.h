@@ -1,6 +1,8 @@
 #pragma once
 
 #include "Utility.h"
+#include <algorithm>
+#include <cmath>
 
 #define COST(data) net::cstf::CrossEntropy(data)
 #define COST_DERIVATIVE(pred, expe) net::cstf::CrossEntropy_derivative(pred, expe)
@@ -16,7 +18,7 @@ namespace net
 		}
 
 		template<typename T>
-		inline T MSE(util::DataPoint<T> data)
+		inline T MSE(const util::DataPoint<T>& data)
 		{
 			T res = 0;
 			for (int i = 0; i < data.expected.GetSize(); i++)
@@ -27,10 +29,10 @@ namespace net
 		}
 
 		template<typename T>
-		inline T MSE(std::vector<util::DataPoint<T>> data)
+		inline T MSE(const std::vector<util::DataPoint<T>>& data)
 		{
 			T res = (T)0;
-			for (util::DataPoint<T> dp : data)
+			for (const util::DataPoint<T>& dp : data)
 			{
 				res += MSE(dp);
 			}
@@ -38,12 +40,12 @@ namespace net
 		}
 
 		template<typename T>
-		inline T MSE(std::vector<std::vector<util::DataPoint<T>>> data)
+		inline T MSE(const std::vector<std::vector<util::DataPoint<T>>>& data)
 		{
 			T res = (T)0;
-			for (std::vector<util::DataPoint<T>> batch : data)
+			for (const std::vector<util::DataPoint<T>>& batch : data)
 			{
-				for (util::DataPoint<T> dp : batch)
+				for (const util::DataPoint<T>& dp : batch)
 				{
 					res += MSE(dp);
 				}
@@ -67,7 +69,7 @@ namespace net
 		}
 		
 		template<typename T>
-		inline T CrossEntropy(util::DataPoint<T> data)
+		inline T CrossEntropy(const util::DataPoint<T>& data)
 		{
 			T cost = 0.0;
 			for (int i = 0; i < data.expected.GetSize(); i++)
@@ -78,10 +80,10 @@ namespace net
 		}
 
 		template<typename T>
-		inline T CrossEntropy(std::vector<util::DataPoint<T>> data)
+		inline T CrossEntropy(const std::vector<util::DataPoint<T>>& data)
 		{
 			T cost = 0.0;
-			for (util::DataPoint<T> dp : data)
+			for (const util::DataPoint<T>& dp : data)
 			{
 				cost += CrossEntropy(dp);
 			}
@@ -89,12 +91,12 @@ namespace net
 		}
 
 		template<typename T>
-		inline T CrossEntropy(std::vector<std::vector<util::DataPoint<T>>> data)
+		inline T CrossEntropy(const std::vector<std::vector<util::DataPoint<T>>>& data)
 		{
 			T res = (T)0;
-			for (std::vector<util::DataPoint<T>> batch : data)
+			for (const std::vector<util::DataPoint<T>>& batch : data)
 			{
-				for (util::DataPoint<T> dp : batch)
+				for (const util::DataPoint<T>& dp : batch)
 				{
 					res += CrossEntropy(dp);
 				}
@@ -115,10 +117,10 @@ namespace net
 		// ---------------------------------------------------------------------------------------
 
 		template<typename T>
-		inline double Accuracy(std::vector<util::DataPoint<T>> data)
+		inline double Accuracy(const std::vector<util::DataPoint<T>>& data)
 		{
 			int correct = 0;
-			for (util::DataPoint<T> dp : data)
+			for (const util::DataPoint<T>& dp : data)
 			{
 				int chosen = (int)(std::max_element(dp.output.GetValues().begin(), dp.output.GetValues().end()) - dp.output.GetValues().begin());
 				if (chosen == (int)dp.label)
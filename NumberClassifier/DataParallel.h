@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Network.h"
+#include <thread>
+#include <vector>
+
+namespace net
+{
+	// splits every batch over `threads` replicas of the model, the summed gradients update the model itself
+	// the replicas only hold a copy of the parameters and their own forward state, so threads never share a Layer
+	class DataParallel
+	{
+	public:
+		DataParallel(Network& model, int threads)
+			: model(model)
+		{
+			for (int t = 1; t < threads; t++)
+			{
+				replicas.push_back(model);
+			}
+		}
+
+		// the same update as model.Learn(data, learnRate), the gradient sum is grouped per thread
+		void Learn(std::vector<util::DataPoint<double>>& data, double learnRate)
+		{
+			const int n_threads = std::min((int)replicas.size() + 1, (int)data.size());
+			if (n_threads <= 1)
+			{
+				model.Learn(data, learnRate);
+				return;
+			}
+
+			auto slice = [&](int t) { return data.begin() + (std::ptrdiff_t)(data.size() * t / n_threads); };
+			std::vector<std::thread> workers;
+			for (int t = 1; t < n_threads; t++)
+			{
+				workers.emplace_back([&, t]()
+				{
+					Network& replica = replicas[(std::size_t)t - 1];
+					replica.CopyParameters(model);
+					replica.AccumulateGradients(slice(t), slice(t + 1));
+				});
+			}
+			model.AccumulateGradients(slice(0), slice(1));
+			for (std::thread& w : workers)
+			{
+				w.join();
+			}
+			for (int t = 1; t < n_threads; t++)
+			{
+				model.MergeGradients(replicas[(std::size_t)t - 1]);
+			}
+			model.ApplyAccumulated(learnRate, (int)data.size());
+		}
+
+		int GetThreads() const { return (int)replicas.size() + 1; }
+		Network& GetModel() { return model; }
+	private:
+		Network& model;
+		std::vector<Network> replicas;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,775 @@
+#pragma once
+
+#include "Network.h"
+#include "MNISTReader.h"
+#include "TrainDriver.h"
+#include "Signal.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <iostream>
+#include <iomanip>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+
+namespace util
+{
+	// IEEE half precision, round to nearest even
+	inline std::uint16_t FloatToHalf(float f)
+	{
+		std::uint32_t x;
+		std::memcpy(&x, &f, sizeof(x));
+		std::uint32_t sign = (x >> 16) & 0x8000;
+		std::uint32_t fexp = (x >> 23) & 0xff;
+		std::uint32_t mant = x & 0x7fffff;
+
+		if (fexp == 0xff)
+		{
+			return (std::uint16_t)(sign | 0x7c00 | (mant ? 0x200 : 0)); // inf / nan
+		}
+		int exp = (int)fexp - 127 + 15;
+		if (exp >= 31)
+		{
+			return (std::uint16_t)(sign | 0x7c00); // overflow
+		}
+		if (exp <= 0)
+		{
+			if (exp < -10)
+			{
+				return (std::uint16_t)sign; // underflow
+			}
+			mant |= 0x800000;
+			int shift = 14 - exp;
+			std::uint32_t half = mant >> shift;
+			std::uint32_t rem = mant & ((1u << shift) - 1);
+			std::uint32_t mid = 1u << (shift - 1);
+			if (rem > mid || (rem == mid && (half & 1)))
+			{
+				half++;
+			}
+			return (std::uint16_t)(sign | half);
+		}
+		std::uint32_t half = sign | ((std::uint32_t)exp << 10) | (mant >> 13);
+		std::uint32_t rem = mant & 0x1fff;
+		if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+		{
+			half++; // a carry into the exponent is still the correctly rounded value
+		}
+		return (std::uint16_t)half;
+	}
+
+	inline float HalfToFloat(std::uint16_t h)
+	{
+		std::uint32_t sign = (std::uint32_t)(h & 0x8000) << 16;
+		std::uint32_t exp = (h >> 10) & 0x1f;
+		std::uint32_t mant = h & 0x3ff;
+		std::uint32_t bits;
+		if (exp == 0)
+		{
+			if (mant == 0)
+			{
+				bits = sign;
+			}
+			else
+			{
+				exp = 127 - 15 + 1;
+				while (!(mant & 0x400))
+				{
+					mant <<= 1;
+					exp--;
+				}
+				bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+			}
+		}
+		else if (exp == 31)
+		{
+			bits = sign | 0x7f800000 | (mant << 13);
+		}
+		else
+		{
+			bits = sign | ((exp + 112) << 23) | (mant << 13);
+		}
+		float f;
+		std::memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+
+	// ring link of one worker: sends to rank + 1 while receiving from rank - 1
+	// both directions progress together so neither side can fill its buffer and deadlock
+	class Transport
+	{
+	public:
+		virtual ~Transport() = default;
+		virtual bool Exchange(const std::uint8_t* send, std::size_t n_send, std::uint8_t* recv, std::size_t n_recv) = 0;
+	};
+
+#ifndef _WIN32
+	// single producer / single consumer byte rings in a POSIX shared memory segment, channel i carries rank i -> rank i + 1
+	class ShmTransport : public Transport
+	{
+	public:
+		static constexpr std::size_t CAPACITY = 1 << 20;
+		static constexpr int STALL_SECONDS = 60;     // an Exchange without progress for this long gives up
+
+		// at the start of the segment, set by the launcher when a rank died or could not be started
+		struct Control
+		{
+			alignas(64) std::atomic<int> aborted;
+		};
+
+		struct Channel
+		{
+			alignas(64) std::atomic<std::uint64_t> head;  // written by the sender
+			alignas(64) std::atomic<std::uint64_t> tail;  // written by the receiver
+			alignas(64) std::uint8_t data[CAPACITY];
+		};
+
+		// called once by the launcher before the workers attach
+		static bool Create(const std::string& name, int ranks)
+		{
+			int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+			if (fd < 0)
+			{
+				return false;
+			}
+			std::size_t size = sizeof(Control) + sizeof(Channel) * ranks;
+			bool ok = ftruncate(fd, (off_t)size) == 0;
+			void* mem = ok ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+			close(fd);
+			if (mem == MAP_FAILED)
+			{
+				shm_unlink(name.c_str());
+				return false;
+			}
+			new (&((Control*)mem)->aborted) std::atomic<int>(0);
+			for (int i = 0; i < ranks; i++)
+			{
+				Channel* c = (Channel*)((Control*)mem + 1) + i;
+				new (&c->head) std::atomic<std::uint64_t>(0);
+				new (&c->tail) std::atomic<std::uint64_t>(0);
+			}
+			munmap(mem, size);
+			return true;
+		}
+
+		static void Destroy(const std::string& name)
+		{
+			shm_unlink(name.c_str());
+		}
+
+		// makes every Exchange on the segment return false
+		static void Abort(const std::string& name)
+		{
+			int fd = shm_open(name.c_str(), O_RDWR, 0600);
+			if (fd < 0)
+			{
+				return;
+			}
+			void* mem = mmap(nullptr, sizeof(Control), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			close(fd);
+			if (mem != MAP_FAILED)
+			{
+				((Control*)mem)->aborted.store(1, std::memory_order_release);
+				munmap(mem, sizeof(Control));
+			}
+		}
+
+		ShmTransport(const std::string& name, int rank, int ranks)
+			: size(sizeof(Control) + sizeof(Channel) * ranks)
+		{
+			int fd = shm_open(name.c_str(), O_RDWR, 0600);
+			if (fd < 0)
+			{
+				return;
+			}
+			void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			close(fd);
+			if (mem == MAP_FAILED)
+			{
+				return;
+			}
+			control = (Control*)mem;
+			channels = (Channel*)(control + 1);
+			out = &channels[rank];
+			in = &channels[(rank + ranks - 1) % ranks];
+		}
+		~ShmTransport()
+		{
+			if (control)
+			{
+				munmap(control, size);
+			}
+		}
+
+		bool Valid() const { return control != nullptr; }
+
+		bool Exchange(const std::uint8_t* send, std::size_t n_send, std::uint8_t* recv, std::size_t n_recv) override
+		{
+			std::size_t sent = 0;
+			std::size_t got = 0;
+			int idle = 0;
+			auto lastProgress = std::chrono::steady_clock::now();
+			while (sent < n_send || got < n_recv)
+			{
+				bool progress = false;
+				if (sent < n_send)
+				{
+					std::uint64_t head = out->head.load(std::memory_order_relaxed);
+					std::uint64_t tail = out->tail.load(std::memory_order_acquire);
+					std::size_t n = std::min<std::size_t>(CAPACITY - (std::size_t)(head - tail), n_send - sent);
+					if (n > 0)
+					{
+						CopyIn(out->data, (std::size_t)(head % CAPACITY), send + sent, n);
+						out->head.store(head + n, std::memory_order_release);
+						sent += n;
+						progress = true;
+					}
+				}
+				if (got < n_recv)
+				{
+					std::uint64_t tail = in->tail.load(std::memory_order_relaxed);
+					std::uint64_t head = in->head.load(std::memory_order_acquire);
+					std::size_t n = std::min<std::size_t>((std::size_t)(head - tail), n_recv - got);
+					if (n > 0)
+					{
+						CopyOut(in->data, (std::size_t)(tail % CAPACITY), recv + got, n);
+						in->tail.store(tail + n, std::memory_order_release);
+						got += n;
+						progress = true;
+					}
+				}
+
+				if (progress)
+				{
+					idle = 0;
+					lastProgress = std::chrono::steady_clock::now();
+				}
+				else if (++idle > 1000)
+				{
+					if (StopRequested() || control->aborted.load(std::memory_order_acquire))
+					{
+						return false;
+					}
+					// checked every 1024 idle spins only, the clock is slower than the ring
+					if ((idle & 1023) == 0 && std::chrono::steady_clock::now() - lastProgress > std::chrono::seconds(STALL_SECONDS))
+					{
+						std::cerr << "shared memory ring stalled for " << STALL_SECONDS << " s, giving up\n";
+						return false;
+					}
+					std::this_thread::yield();
+				}
+			}
+			return true;
+		}
+	private:
+		// copy n bytes into / out of the ring starting at pos, wrapping around the end
+		static void CopyIn(std::uint8_t* ring, std::size_t pos, const std::uint8_t* src, std::size_t n)
+		{
+			std::size_t first = std::min(n, CAPACITY - pos);
+			std::memcpy(ring + pos, src, first);
+			std::memcpy(ring, src + first, n - first);
+		}
+
+		static void CopyOut(const std::uint8_t* ring, std::size_t pos, std::uint8_t* dst, std::size_t n)
+		{
+			std::size_t first = std::min(n, CAPACITY - pos);
+			std::memcpy(dst, ring + pos, first);
+			std::memcpy(dst + first, ring, n - first);
+		}
+	private:
+		std::size_t size;
+		Control* control = nullptr;
+		Channel* channels = nullptr;
+		Channel* out = nullptr;
+		Channel* in = nullptr;
+	};
+
+	// TCP on localhost, rank r listens on basePort + r, connects to the next rank and accepts the previous one
+	class TcpTransport : public Transport
+	{
+	public:
+		TcpTransport(int rank, int ranks, int basePort)
+		{
+			int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+			int one = 1;
+			setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			sockaddr_in addr = Address(basePort + rank);
+			if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 1) != 0)
+			{
+				std::cerr << "rank " << rank << ": could not listen on port " << basePort + rank << '\n';
+				if (listen_fd >= 0)
+				{
+					close(listen_fd);
+				}
+				return;
+			}
+
+			// the next rank may not be listening yet
+			sockaddr_in next = Address(basePort + (rank + 1) % ranks);
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+			while (std::chrono::steady_clock::now() < deadline && !StopRequested())
+			{
+				out_fd = socket(AF_INET, SOCK_STREAM, 0);
+				if (connect(out_fd, (sockaddr*)&next, sizeof(next)) == 0)
+				{
+					break;
+				}
+				close(out_fd);
+				out_fd = -1;
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			}
+			// the previous rank may never connect if it failed to start
+			while (out_fd >= 0 && std::chrono::steady_clock::now() < deadline && !StopRequested())
+			{
+				pollfd pfd{ listen_fd, POLLIN, 0 };
+				if (poll(&pfd, 1, 200) > 0)
+				{
+					in_fd = accept(listen_fd, nullptr, nullptr);
+					break;
+				}
+			}
+			close(listen_fd);
+
+			for (int fd : { out_fd, in_fd })
+			{
+				if (fd >= 0)
+				{
+					setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+					fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+				}
+			}
+		}
+		~TcpTransport()
+		{
+			if (out_fd >= 0)
+			{
+				close(out_fd);
+			}
+			if (in_fd >= 0)
+			{
+				close(in_fd);
+			}
+		}
+
+		bool Valid() const { return out_fd >= 0 && in_fd >= 0; }
+
+		bool Exchange(const std::uint8_t* send, std::size_t n_send, std::uint8_t* recv, std::size_t n_recv) override
+		{
+			std::size_t sent = 0;
+			std::size_t got = 0;
+			while (sent < n_send || got < n_recv)
+			{
+				pollfd fds[2] = { { out_fd, (short)(sent < n_send ? POLLOUT : 0), 0 }, { in_fd, (short)(got < n_recv ? POLLIN : 0), 0 } };
+				int ready = poll(fds, 2, 200);
+				if (StopRequested())
+				{
+					return false;
+				}
+				if (ready < 0 && errno != EINTR)
+				{
+					return false;
+				}
+				if (ready <= 0)
+				{
+					continue;
+				}
+
+				if (sent < n_send && (fds[0].revents & (POLLOUT | POLLERR | POLLHUP)))
+				{
+					ssize_t r = ::send(out_fd, send + sent, n_send - sent, MSG_NOSIGNAL);
+					if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+					{
+						return false;
+					}
+					sent += r > 0 ? (std::size_t)r : 0;
+				}
+				if (got < n_recv && (fds[1].revents & (POLLIN | POLLERR | POLLHUP)))
+				{
+					ssize_t r = ::recv(in_fd, recv + got, n_recv - got, 0);
+					if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+					{
+						return false;
+					}
+					got += r > 0 ? (std::size_t)r : 0;
+				}
+			}
+			return true;
+		}
+	private:
+		static sockaddr_in Address(int port)
+		{
+			sockaddr_in addr{};
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons((std::uint16_t)port);
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			return addr;
+		}
+	private:
+		int out_fd = -1;
+		int in_fd = -1;
+	};
+#endif
+
+	// ring allreduce (reduce-scatter then allgather) summing a buffer across all ranks
+	// with compression every hop carries fp16 values, the reduced chunks are rounded to fp16 by their owner too so all replicas end up identical
+	class RingAllreduce
+	{
+	public:
+		RingAllreduce(Transport* transport, int rank, int ranks, bool compress)
+			: transport(transport), rank(rank), ranks(ranks), compress(compress)
+		{}
+
+		bool Sum(std::vector<double>& buf)
+		{
+			if (ranks == 1)
+			{
+				return true;
+			}
+
+			for (int s = 0; s < ranks - 1; s++)
+			{
+				int send_c = (rank - s + ranks) % ranks;
+				int recv_c = (rank - s - 1 + ranks) % ranks;
+				if (!Step(buf, send_c, recv_c, true))
+				{
+					return false;
+				}
+			}
+
+			int own = (rank + 1) % ranks;
+			if (compress)
+			{
+				for (std::size_t i = Begin(buf, own); i < Begin(buf, own + 1); i++)
+				{
+					buf[i] = (double)HalfToFloat(FloatToHalf((float)buf[i]));
+				}
+			}
+
+			for (int s = 0; s < ranks - 1; s++)
+			{
+				int send_c = (rank + 1 - s + ranks) % ranks;
+				int recv_c = (rank - s + ranks) % ranks;
+				if (!Step(buf, send_c, recv_c, false))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// bytes this rank puts on the wire per Sum of n values
+		std::size_t WireBytes(std::size_t n) const
+		{
+			return ranks == 1 ? 0 : 2 * (ranks - 1) * (n / ranks) * (compress ? sizeof(std::uint16_t) : sizeof(double));
+		}
+	private:
+		std::size_t Begin(const std::vector<double>& buf, int chunk) const
+		{
+			return buf.size() * chunk / ranks;
+		}
+
+		bool Step(std::vector<double>& buf, int send_c, int recv_c, bool accumulate)
+		{
+			std::size_t s0 = Begin(buf, send_c), s1 = Begin(buf, send_c + 1);
+			std::size_t r0 = Begin(buf, recv_c), r1 = Begin(buf, recv_c + 1);
+			const std::size_t width = compress ? sizeof(std::uint16_t) : sizeof(double);
+
+			sendBytes.resize((s1 - s0) * width);
+			recvBytes.resize((r1 - r0) * width);
+			if (compress)
+			{
+				std::uint16_t* dst = (std::uint16_t*)sendBytes.data();
+				for (std::size_t i = s0; i < s1; i++)
+				{
+					dst[i - s0] = FloatToHalf((float)buf[i]);
+				}
+			}
+			else
+			{
+				std::memcpy(sendBytes.data(), buf.data() + s0, sendBytes.size());
+			}
+
+			if (!transport->Exchange(sendBytes.data(), sendBytes.size(), recvBytes.data(), recvBytes.size()))
+			{
+				return false;
+			}
+
+			for (std::size_t i = r0; i < r1; i++)
+			{
+				double v;
+				if (compress)
+				{
+					std::uint16_t h;
+					std::memcpy(&h, recvBytes.data() + (i - r0) * width, sizeof(h));
+					v = (double)HalfToFloat(h);
+				}
+				else
+				{
+					std::memcpy(&v, recvBytes.data() + (i - r0) * width, sizeof(v));
+				}
+				buf[i] = accumulate ? buf[i] + v : v;
+			}
+			return true;
+		}
+	private:
+		Transport* transport;
+		int rank;
+		int ranks;
+		bool compress;
+		std::vector<std::uint8_t> sendBytes;
+		std::vector<std::uint8_t> recvBytes;
+	};
+
+	struct DistConfig
+	{
+		TrainConfig train;              // model, batch size (global, split across ranks), learning rate, epochs, data
+		int ranks = 2;
+		std::string transport = "shm";  // shm or tcp
+		bool compress = false;          // fp16 gradients on the wire
+		int basePort = 29500;
+		int maxSteps = 0;               // stop every rank after this many steps, 0 runs the configured epochs
+	};
+
+	// written by rank 0 into memory shared with the launcher
+	struct DistResult
+	{
+		double samplesPerSecond = 0.0;
+		double allreduceSeconds = 0.0;
+		double seconds = 0.0;
+		long long steps = 0;
+		int inSync = 0;
+		int saveFailed = 0;
+	};
+
+#ifndef _WIN32
+	// one worker process: trains on the samples with index % ranks == rank and sums gradients with the other ranks every step
+	inline int RunDistWorker(int rank, const DistConfig& cfg, net::Network model, const std::vector<DataPoint<double>>& data, const std::string& shmName, DistResult* result)
+	{
+		std::unique_ptr<Transport> transport;
+		if (cfg.ranks > 1)
+		{
+			if (cfg.transport == "tcp")
+			{
+				auto tcp = std::make_unique<TcpTransport>(rank, cfg.ranks, cfg.basePort);
+				if (!tcp->Valid())
+				{
+					return 1;
+				}
+				transport = std::move(tcp);
+			}
+			else
+			{
+				auto shm = std::make_unique<ShmTransport>(shmName, rank, cfg.ranks);
+				if (!shm->Valid())
+				{
+					std::cerr << "rank " << rank << ": could not attach shared memory\n";
+					return 1;
+				}
+				transport = std::move(shm);
+			}
+		}
+		RingAllreduce allreduce{ transport.get(), rank, cfg.ranks, cfg.compress };
+
+		const int localBatch = std::max(1, cfg.train.batchSize / cfg.ranks);
+		const int globalBatch = localBatch * cfg.ranks;
+
+		// every rank gets the same number of full batches so the steps line up
+		std::vector<std::vector<DataPoint<double>>> batches;
+		const std::size_t perRank = data.size() / cfg.ranks;
+		const std::size_t n_batches = perRank / localBatch;
+		for (std::size_t b = 0; b < n_batches; b++)
+		{
+			std::vector<DataPoint<double>> batch;
+			for (int i = 0; i < localBatch; i++)
+			{
+				batch.push_back(data[(b * localBatch + i) * cfg.ranks + rank]);
+			}
+			batches.push_back(std::move(batch));
+		}
+		if (batches.empty())
+		{
+			return 1;
+		}
+
+		std::vector<double> grad;
+		long long step = 0;
+		double allreduceSeconds = 0.0;
+		auto start = std::chrono::steady_clock::now();
+		bool done = false;
+		for (int epoch = 0; !done && (cfg.train.epochs == 0 || epoch < cfg.train.epochs); epoch++)
+		{
+			for (std::size_t b = 0; b < batches.size(); b++)
+			{
+				model.AccumulateGradients(batches[b]);
+
+				auto ar_start = std::chrono::steady_clock::now();
+				model.GetGradientBuffer(grad);
+				if (!allreduce.Sum(grad))
+				{
+					return StopRequested() ? 0 : 1;
+				}
+				model.SetGradientBuffer(grad);
+				allreduceSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - ar_start).count();
+
+				model.ApplyAccumulated(cfg.train.learnRate, globalBatch);
+				step++;
+
+				if (rank == 0 && cfg.train.evalInterval > 0 && step % cfg.train.evalInterval == 0)
+				{
+					double cost = COST(batches[b]);
+					std::cout << "step " << step << " epoch " << epoch << " | rank 0 batch acc " << net::cstf::Accuracy(batches[b]) * 100.0 << "% cost " << cost << '\n';
+				}
+				if (cfg.maxSteps > 0 && step >= cfg.maxSteps)
+				{
+					done = true;
+					break;
+				}
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// every replica applied the same summed gradients, so the weights must agree
+		double checksum = 0.0;
+		for (int l = 1; l < (int)model.GetLayerSizes().size(); l++)
+		{
+			for (double w : model.GetLayer(l).GetWeights().GetValues())
+			{
+				checksum += w;
+			}
+		}
+		// always checked at full precision, fp16 would round the checksums differently per rank
+		RingAllreduce exact{ transport.get(), rank, cfg.ranks, false };
+		// the mean alone would let deviations that cancel pass, so the squared deviations from it are summed as well
+		std::vector<double> sums{ checksum };
+		bool inSync = exact.Sum(sums);
+		const double mean = sums[0] / cfg.ranks;
+		const double tolerance = 1e-9 * std::max(1.0, std::abs(mean));
+		std::vector<double> deviation{ (checksum - mean) * (checksum - mean) };
+		inSync = exact.Sum(deviation) && inSync && deviation[0] <= cfg.ranks * tolerance * tolerance;
+
+		if (rank == 0)
+		{
+			result->steps = step;
+			result->seconds = seconds;
+			result->allreduceSeconds = allreduceSeconds;
+			result->samplesPerSecond = step * globalBatch / std::max(seconds, 1e-9);
+			result->inSync = inSync ? 1 : 0;
+			if (!cfg.train.savePath.empty())
+			{
+				result->saveFailed = model.Save(cfg.train.savePath) ? 0 : 1;
+			}
+		}
+		return 0;
+	}
+#endif
+
+	// forks one worker per rank, the dataset and initial model are shared copy-on-write
+	inline bool LaunchDistributed(const DistConfig& cfg, const net::Network& model, const std::vector<DataPoint<double>>& data, DistResult& result)
+	{
+#ifdef _WIN32
+		std::cout << "Distributed training needs fork(), it is not available on this platform\n";
+		return false;
+#else
+		std::string shmName = "/numberclassifier-" + std::to_string(getpid());
+		if (cfg.ranks > 1 && cfg.transport != "tcp" && !ShmTransport::Create(shmName, cfg.ranks))
+		{
+			std::cout << "Could not create shared memory segment " << shmName << '\n';
+			return false;
+		}
+
+		DistResult* shared = (DistResult*)mmap(nullptr, sizeof(DistResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (shared == MAP_FAILED)
+		{
+			ShmTransport::Destroy(shmName);
+			return false;
+		}
+		new (shared) DistResult();
+
+		// a dead rank leaves the others waiting on the ring
+		const bool shm = cfg.ranks > 1 && cfg.transport != "tcp";
+		std::vector<pid_t> workers;
+		auto stopWorkers = [&]()
+		{
+			if (shm)
+			{
+				ShmTransport::Abort(shmName);
+			}
+			for (pid_t w : workers)
+			{
+				if (w > 0)
+				{
+					kill(w, SIGTERM);
+				}
+			}
+		};
+
+		std::cout.flush();
+		bool ok = true;
+		for (int r = 0; r < cfg.ranks; r++)
+		{
+			pid_t pid = fork();
+			if (pid < 0)
+			{
+				std::cout << "Could not start rank " << r << ": " << std::strerror(errno) << '\n';
+				stopWorkers();
+				ok = false;
+				break;
+			}
+			if (pid == 0)
+			{
+				int rc = RunDistWorker(r, cfg, model, data, shmName, shared);
+				std::cout.flush();
+				_exit(rc);
+			}
+			workers.push_back(pid);
+		}
+
+		for (std::size_t remaining = workers.size(); remaining > 0; remaining--)
+		{
+			int status = 0;
+			pid_t pid = waitpid(-1, &status, 0);
+			if (pid < 0)
+			{
+				if (errno == EINTR)
+				{
+					remaining++;
+					continue;
+				}
+				break;
+			}
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			{
+				if (ok)
+				{
+					stopWorkers();
+				}
+				ok = false;
+			}
+		}
+
+		result = *shared;
+		munmap(shared, sizeof(DistResult));
+		if (shm)
+		{
+			ShmTransport::Destroy(shmName);
+		}
+		return ok;
+#endif
+	}
+}
\ No newline at end of file
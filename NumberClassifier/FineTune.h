@@ -0,0 +1,173 @@
+#pragma once
+
+#include "Network.h"
+#include "Trainer.h"
+#include "Pruning.h"
+#include "MNISTReader.h"
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+
+namespace net
+{
+	// outputs of layers 1..prefix of a network for a whole dataset, computed once with the batched forward pass
+	// stored as floats in one block with a label byte per sample, so later epochs only run the head
+	class FeatureCache
+	{
+	public:
+		FeatureCache(const Network& network, int prefix, const std::vector<util::DataPoint<double>>& data, int batchRows = 256)
+			: width(network.GetLayerSizes()[prefix])
+		{
+			features.resize(data.size() * width);
+			labels.resize(data.size());
+			for (std::size_t first = 0; first < data.size(); first += batchRows)
+			{
+				const int n = (int)std::min<std::size_t>(batchRows, data.size() - first);
+				util::Matrix<double> x{ {}, n, network.GetInputSize() };
+				for (int r = 0; r < n; r++)
+				{
+					const util::DataPoint<double>& dp = data[first + r];
+					std::copy_n(dp.input.GetValues().begin(), std::min(dp.input.GetSize(), x.GetColumns()), x.GetValues().begin() + (std::size_t)r * x.GetColumns());
+					labels[first + r] = (std::uint8_t)dp.label;
+				}
+				for (int l = 1; l <= prefix; l++)
+				{
+					x = network.GetLayer(l).ForwardBatch(x);
+				}
+				std::copy(x.GetValues().begin(), x.GetValues().end(), features.begin() + first * width);
+			}
+		}
+
+		// samples [first, first + count) as data points of the head network, the batch buffers are reused
+		void Fill(std::size_t first, std::size_t count, std::vector<util::DataPoint<double>>& batch) const
+		{
+			batch.resize(count);
+			for (std::size_t i = 0; i < count; i++)
+			{
+				util::DataPoint<double>& dp = batch[i];
+				if (dp.input.GetColumns() != width)
+				{
+					dp.input = util::Matrix<double>{ {}, 1, width };
+				}
+				const float* f = features.data() + (first + i) * width;
+				std::copy(f, f + width, dp.input.GetValues().begin());
+				dp.label = labels[first + i];
+				dp.expected = util::LabelToMatrix(labels[first + i]);
+			}
+		}
+
+		std::size_t GetSize() const { return labels.size(); }
+		int GetWidth() const { return width; }
+		std::size_t Bytes() const { return features.size() * sizeof(float) + labels.size(); }
+	private:
+		int width;
+		std::vector<float> features;
+		std::vector<std::uint8_t> labels;
+	};
+
+	// the layers above `prefix` as a network of their own, layer prefix is its input
+	inline Network Head(const Network& network, int prefix)
+	{
+		const std::vector<int>& sizes = network.GetLayerSizes();
+		Network head{ std::vector<int>(sizes.begin() + prefix, sizes.end()), network.GetHiddenActivation(), network.GetOutputActivation() };
+		for (int l = 1; l < (int)sizes.size() - prefix; l++)
+		{
+			head.GetLayer(l).GetWeights() = network.GetLayer(prefix + l).GetWeights();
+			head.GetLayer(l).GetBiases() = network.GetLayer(prefix + l).GetBiases();
+			head.GetLayer(l).WeightsModified();
+		}
+		return head;
+	}
+
+	// writes the head's parameters back into the layers above `prefix`
+	inline void SetHead(Network& network, const Network& head, int prefix)
+	{
+		for (int l = 1; l < (int)head.GetLayerSizes().size(); l++)
+		{
+			network.GetLayer(prefix + l).GetWeights() = head.GetLayer(l).GetWeights();
+			network.GetLayer(prefix + l).GetBiases() = head.GetLayer(l).GetBiases();
+			network.GetLayer(prefix + l).WeightsModified();
+		}
+	}
+
+	struct FineTuneConfig
+	{
+		int freeze = -1;                // layers kept fixed from the input side, -1 trains the output layer only
+		int epochs = 3;
+		double learnRate = 0.01;
+		int batchSize = 100;
+		bool cache = true;              // train the head from cached prefix outputs instead of the full network
+	};
+
+	// trains the layers above the frozen prefix on new data and prints the test accuracy after every epoch
+	class FineTuner
+	{
+	public:
+		FineTuner(FineTuneConfig config, const std::vector<util::DataPoint<double>>& train, const std::vector<util::DataPoint<double>>& test)
+			: config(config), train(train), test(test)
+		{}
+
+		void Run(Network& network)
+		{
+			using clock = std::chrono::steady_clock;
+			const int n_layers = (int)network.GetLayerSizes().size();
+			const int prefix = config.freeze < 0 ? n_layers - 2 : std::min(config.freeze, n_layers - 2);
+			network.FreezePrefix(prefix);
+			network.Pack();
+
+			std::cout << std::fixed << std::setprecision(2) << "Training layers " << prefix + 1 << ".." << n_layers - 1
+				<< " on " << train.size() << " samples | base test acc " << PruneAccuracy(network, test) * 100.0 << "%\n";
+
+			// both paths see the same batches in the same order, the cache only rounds the prefix outputs to float
+			std::unique_ptr<FeatureCache> cache;
+			std::unique_ptr<Network> head;
+			std::unique_ptr<util::Trainer> trainer;
+			if (config.cache)
+			{
+				auto start = clock::now();
+				cache = std::make_unique<FeatureCache>(network, prefix, train);
+				head = std::make_unique<Network>(Head(network, prefix));
+				std::cout << "feature cache: " << cache->GetSize() << " x " << cache->GetWidth() << " in "
+					<< std::chrono::duration<double>(clock::now() - start).count() << " s, "
+					<< (double)cache->Bytes() / (1024.0 * 1024.0) << " MiB\n";
+			}
+			else
+			{
+				trainer = std::make_unique<util::Trainer>(config.batchSize, train, std::vector<util::DataPoint<double>>{});
+			}
+
+			std::vector<util::DataPoint<double>> batch;
+			for (int epoch = 0; epoch < config.epochs; epoch++)
+			{
+				auto start = clock::now();
+				if (cache)
+				{
+					for (std::size_t first = 0; first < cache->GetSize(); first += config.batchSize)
+					{
+						cache->Fill(first, std::min<std::size_t>(config.batchSize, cache->GetSize() - first), batch);
+						head->Learn(batch, config.learnRate);
+					}
+					SetHead(network, *head, prefix);
+				}
+				else
+				{
+					for (int b = 0; b < (int)trainer->GetTrainingDataBatches().size(); b++)
+					{
+						trainer->Train(network, config.learnRate, b);
+					}
+				}
+				double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+				network.Pack();
+				std::cout << "epoch " << epoch + 1 << " | " << seconds << " s | test acc " << PruneAccuracy(network, test) * 100.0 << "%\n";
+			}
+			std::cout << std::defaultfloat << std::setprecision(6);
+		}
+	private:
+		FineTuneConfig config;
+		const std::vector<util::DataPoint<double>>& train;
+		const std::vector<util::DataPoint<double>>& test;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "Network.h"
+#include <thread>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+namespace net
+{
+	struct GradientCheckConfig
+	{
+		int parameters = 1000;          // sampled weights and biases, more than the network has checks all of them
+		double epsilon = 1e-5;          // central difference step
+		int threads = (int)std::max(1u, std::thread::hardware_concurrency());
+		unsigned int seed = 1;          // parameter sampling only, the global rng is left alone
+	};
+
+	struct GradientCheckResult
+	{
+		int checked = 0;
+		double maxRelError = 0.0;
+		double meanRelError = 0.0;
+
+		// parameter with the largest relative error
+		int worstLayer = -1;
+		int worstIndex = -1;
+		bool worstIsBias = false;
+		double worstAnalytic = 0.0;
+		double worstNumeric = 0.0;
+
+		double seconds = 0.0;
+	};
+
+	// compares the backprop gradients of GetGradients against central differences of the batch cost
+	// only a sample of the parameters is perturbed and each perturbation only reruns the layers from the perturbed one onward,
+	// starting from cached weighted inputs and activations of the unperturbed forward pass
+	class GradientChecker
+	{
+	public:
+		GradientChecker(Network& network, GradientCheckConfig config)
+			: network(network), config(config)
+		{}
+
+		GradientCheckResult Run(std::vector<util::DataPoint<double>>& data)
+		{
+			auto start = std::chrono::steady_clock::now();
+			GradientCheckResult res;
+			if (data.empty())
+			{
+				return res;
+			}
+
+			const int n_layers = (int)network.layers.size();
+			const int n = (int)data.size();
+
+			// analytic gradient of the mean cost, the same quantity Learn steps along
+			network.ClearGradients();
+			for (util::DataPoint<double>& dp : data)
+			{
+				network.GetGradients(dp);
+			}
+			std::vector<util::Matrix<double>> weightGrad = network.weight_grad;
+			std::vector<util::Matrix<double>> biasGrad = network.bias_grad;
+			network.ClearGradients();
+
+			// cached forward pass over the whole batch
+			expected = util::Matrix<double>{ {}, n, network.GetOutputSize() };
+			util::Matrix<double> inputs{ {}, n, network.GetInputSize() };
+			for (int r = 0; r < n; r++)
+			{
+				for (int c = 0; c < inputs.GetColumns(); c++)
+				{
+					inputs(r, c) = data[r].input[c];
+				}
+				for (int c = 0; c < expected.GetColumns(); c++)
+				{
+					expected(r, c) = data[r].expected[c];
+				}
+			}
+			weighted.assign(n_layers, {});
+			activations.assign(n_layers, {});
+			activations[0] = inputs;
+			for (int l = 1; l < n_layers; l++)
+			{
+				weighted[l] = network.layers[l].WeightedBatch(activations[l - 1]);
+				activations[l] = network.layers[l].Activate(weighted[l]);
+			}
+
+			// sample parameters, numbered layer by layer with weights before biases
+			std::vector<Param> all;
+			for (int l = 1; l < n_layers; l++)
+			{
+				for (int i = 0; i < network.layers[l].GetWeights().GetSize(); i++)
+				{
+					all.push_back({ l, i, false });
+				}
+				for (int i = 0; i < network.layers[l].GetBiases().GetSize(); i++)
+				{
+					all.push_back({ l, i, true });
+				}
+			}
+			std::mt19937 rng(config.seed);
+			std::size_t count = std::min<std::size_t>(all.size(), (std::size_t)std::max(config.parameters, 1));
+			for (std::size_t i = 0; i < count; i++)
+			{
+				std::uniform_int_distribution<std::size_t> pick(i, all.size() - 1);
+				std::swap(all[i], all[pick(rng)]);
+			}
+			all.resize(count);
+
+			std::vector<double> numeric(count, 0.0);
+			int n_threads = std::max(1, std::min(config.threads, (int)count));
+			std::vector<std::thread> workers;
+			for (int t = 0; t < n_threads; t++)
+			{
+				workers.emplace_back([&, t]()
+				{
+					for (std::size_t i = t; i < count; i += n_threads)
+					{
+						const Param& p = all[i];
+						double plus = PerturbedCost(p, config.epsilon);
+						double minus = PerturbedCost(p, -config.epsilon);
+						numeric[i] = (plus - minus) / (2.0 * config.epsilon);
+					}
+				});
+			}
+			for (std::thread& w : workers)
+			{
+				w.join();
+			}
+
+			double sum = 0.0;
+			for (std::size_t i = 0; i < count; i++)
+			{
+				const Param& p = all[i];
+				double analytic = p.bias ? biasGrad[p.layer][p.index] : weightGrad[p.layer][p.index];
+				analytic /= (double)n;
+
+				double scale = std::max(std::abs(analytic), std::abs(numeric[i]));
+				double err = scale < 1e-12 ? 0.0 : std::abs(analytic - numeric[i]) / scale;
+				sum += err;
+				if (err > res.maxRelError || res.worstLayer < 0)
+				{
+					res.maxRelError = err;
+					res.worstLayer = p.layer;
+					res.worstIndex = p.index;
+					res.worstIsBias = p.bias;
+					res.worstAnalytic = analytic;
+					res.worstNumeric = numeric[i];
+				}
+			}
+			res.checked = (int)count;
+			res.meanRelError = sum / (double)count;
+			res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			return res;
+		}
+	private:
+		struct Param
+		{
+			int layer;
+			int index;
+			bool bias;
+		};
+
+		double PerturbedCost(const Param& p, double delta) const
+		{
+			const Layer& layer = network.layers[p.layer];
+			util::Matrix<double> z = weighted[p.layer];
+			const int n = z.GetRows();
+
+			// only one column of the weighted inputs depends on the parameter
+			if (p.bias)
+			{
+				for (int r = 0; r < n; r++)
+				{
+					z(r, p.index) += delta;
+				}
+			}
+			else
+			{
+				const int in = p.index / z.GetColumns();
+				const int out = p.index % z.GetColumns();
+				const util::Matrix<double>& a = activations[p.layer - 1];
+				for (int r = 0; r < n; r++)
+				{
+					z(r, out) += delta * a(r, in);
+				}
+			}
+
+			util::Matrix<double> a = layer.Activate(z);
+			for (std::size_t l = (std::size_t)p.layer + 1; l < network.layers.size(); l++)
+			{
+				a = network.layers[l].ForwardBatch(a);
+			}
+			return BatchCost(a);
+		}
+
+		// same value as COST() over the batch
+		double BatchCost(const util::Matrix<double>& outputs) const
+		{
+			double cost = 0.0;
+			for (int r = 0; r < outputs.GetRows(); r++)
+			{
+				for (int c = 0; c < outputs.GetColumns(); c++)
+				{
+					cost += cstf::CrossEntropy(outputs(r, c), expected(r, c));
+				}
+			}
+			return cost / outputs.GetRows();
+		}
+	private:
+		Network& network;
+		GradientCheckConfig config;
+
+		util::Matrix<double> expected;
+		std::vector<util::Matrix<double>> weighted;
+		std::vector<util::Matrix<double>> activations;
+	};
+}
\ No newline at end of file
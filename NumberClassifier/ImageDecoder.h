@@ -0,0 +1,275 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+
+namespace util
+{
+	// 8 bit grayscale, row major, top row first
+	struct GrayImage
+	{
+		int width = 0;
+		int height = 0;
+		std::vector<std::uint8_t> pixels;
+	};
+
+	// one read for the whole file instead of a stream read per pixel
+	inline bool ReadFileBytes(const std::string& path, std::vector<std::uint8_t>& bytes)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+		{
+			return false;
+		}
+		std::streamoff size = file.tellg();
+		if (size <= 0)
+		{
+			return false;
+		}
+		bytes.resize((std::size_t)size);
+		file.seekg(0);
+		file.read(reinterpret_cast<char*>(bytes.data()), size);
+		return (bool)file;
+	}
+
+	namespace img
+	{
+		inline std::uint16_t ReadU16(const std::uint8_t* p) { return (std::uint16_t)(p[0] | (p[1] << 8)); }
+		inline std::uint32_t ReadU32(const std::uint8_t* p) { return (std::uint32_t)p[0] | ((std::uint32_t)p[1] << 8) | ((std::uint32_t)p[2] << 16) | ((std::uint32_t)p[3] << 24); }
+		inline std::int32_t ReadI32(const std::uint8_t* p) { return (std::int32_t)ReadU32(p); }
+
+		// channel average, same formula the old Win32 reader used so existing models see identical inputs
+		// the loops are branch free so the compiler can vectorize them
+		inline void BGRRowToGray(const std::uint8_t* src, std::uint8_t* dst, int width, int channels)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				const std::uint8_t* px = src + x * channels;
+				dst[x] = (std::uint8_t)(((unsigned int)px[0] + px[1] + px[2]) / 3);
+			}
+		}
+
+		inline void PaletteRowToGray(const std::uint8_t* src, std::uint8_t* dst, int width, const std::uint8_t* lut)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				dst[x] = lut[src[x]];
+			}
+		}
+
+		inline bool DecodeBMP(const std::vector<std::uint8_t>& file, GrayImage& out, std::string& error)
+		{
+			static constexpr std::size_t FILE_HEADER = 14;
+			if (file.size() < FILE_HEADER + 40)
+			{
+				error = "truncated bitmap header";
+				return false;
+			}
+			const std::uint8_t* data = file.data();
+
+			std::uint32_t offBits = ReadU32(data + 10);
+			std::uint32_t infoSize = ReadU32(data + 14);
+			std::int32_t width = ReadI32(data + 18);
+			std::int32_t height = ReadI32(data + 22);
+			std::uint16_t bitCount = ReadU16(data + 28);
+			std::uint32_t compression = ReadU32(data + 30);
+			std::uint32_t colorsUsed = ReadU32(data + 46);
+
+			if (compression != 0 && !(compression == 3 && bitCount == 32)) // BI_RGB, or BI_BITFIELDS with the default masks
+			{
+				error = "compressed bitmaps are not supported";
+				return false;
+			}
+			if (bitCount != 8 && bitCount != 24 && bitCount != 32)
+			{
+				error = "unsupported bit depth " + std::to_string(bitCount);
+				return false;
+			}
+
+			// negative height means the rows are stored top down
+			bool topDown = height < 0;
+			if (topDown)
+			{
+				height = -height;
+			}
+			if (width <= 0 || height <= 0 || width > 1 << 15 || height > 1 << 15)
+			{
+				error = "invalid bitmap size";
+				return false;
+			}
+
+			const std::size_t stride = (((std::size_t)width * bitCount + 31) / 32) * 4;
+			if ((std::size_t)offBits + stride * height > file.size())
+			{
+				error = "truncated pixel data";
+				return false;
+			}
+
+			std::uint8_t lut[256] = {};
+			if (bitCount == 8)
+			{
+				std::size_t paletteOffset = FILE_HEADER + infoSize;
+				std::size_t n_colors = colorsUsed == 0 ? 256 : std::min<std::size_t>(colorsUsed, 256);
+				if (paletteOffset + n_colors * 4 > offBits)
+				{
+					error = "truncated palette";
+					return false;
+				}
+				for (std::size_t i = 0; i < n_colors; i++)
+				{
+					const std::uint8_t* entry = data + paletteOffset + i * 4;
+					lut[i] = (std::uint8_t)(((unsigned int)entry[0] + entry[1] + entry[2]) / 3);
+				}
+			}
+
+			out.width = width;
+			out.height = height;
+			out.pixels.resize((std::size_t)width * height);
+
+			for (int row = 0; row < height; row++)
+			{
+				const std::uint8_t* src = data + offBits + stride * row;
+				int y = topDown ? row : height - 1 - row;
+				std::uint8_t* dst = out.pixels.data() + (std::size_t)y * width;
+				if (bitCount == 8)
+				{
+					PaletteRowToGray(src, dst, width, lut);
+				}
+				else
+				{
+					BGRRowToGray(src, dst, width, bitCount / 8);
+				}
+			}
+			return true;
+		}
+
+		// skips whitespace and # comments, then parses an unsigned integer
+		inline bool PNMToken(const std::vector<std::uint8_t>& file, std::size_t& pos, unsigned int& value)
+		{
+			while (pos < file.size())
+			{
+				if (file[pos] == '#')
+				{
+					while (pos < file.size() && file[pos] != '\n')
+					{
+						pos++;
+					}
+				}
+				else if (std::isspace(file[pos]))
+				{
+					pos++;
+				}
+				else
+				{
+					break;
+				}
+			}
+			if (pos >= file.size() || !std::isdigit(file[pos]))
+			{
+				return false;
+			}
+			value = 0;
+			while (pos < file.size() && std::isdigit(file[pos]))
+			{
+				value = value * 10 + (file[pos] - '0');
+				pos++;
+			}
+			return true;
+		}
+
+		// binary (P5) and ascii (P2) graymaps, 16 bit samples are reduced to 8 bit
+		inline bool DecodePGM(const std::vector<std::uint8_t>& file, GrayImage& out, std::string& error)
+		{
+			const bool binary = file[1] == '5';
+			std::size_t pos = 2;
+			unsigned int width = 0, height = 0, maxval = 0;
+			if (!PNMToken(file, pos, width) || !PNMToken(file, pos, height) || !PNMToken(file, pos, maxval) ||
+				width == 0 || height == 0 || width > 1 << 15 || height > 1 << 15 || maxval == 0 || maxval > 65535)
+			{
+				error = "invalid graymap header";
+				return false;
+			}
+
+			out.width = (int)width;
+			out.height = (int)height;
+			const std::size_t n = (std::size_t)width * height;
+			out.pixels.resize(n);
+
+			if (binary)
+			{
+				pos++; // single whitespace after maxval
+				const std::size_t bytesPerSample = maxval > 255 ? 2 : 1;
+				if (pos + n * bytesPerSample > file.size())
+				{
+					error = "truncated pixel data";
+					return false;
+				}
+				const std::uint8_t* src = file.data() + pos;
+				if (maxval == 255)
+				{
+					std::copy(src, src + n, out.pixels.begin());
+				}
+				else if (bytesPerSample == 1)
+				{
+					for (std::size_t i = 0; i < n; i++)
+					{
+						out.pixels[i] = (std::uint8_t)((src[i] * 255u) / maxval);
+					}
+				}
+				else
+				{
+					for (std::size_t i = 0; i < n; i++)
+					{
+						unsigned int v = ((unsigned int)src[2 * i] << 8) | src[2 * i + 1]; // big endian
+						out.pixels[i] = (std::uint8_t)((v * 255u) / maxval);
+					}
+				}
+			}
+			else
+			{
+				for (std::size_t i = 0; i < n; i++)
+				{
+					unsigned int v = 0;
+					if (!PNMToken(file, pos, v))
+					{
+						error = "truncated pixel data";
+						return false;
+					}
+					out.pixels[i] = (std::uint8_t)((std::min(v, maxval) * 255u) / maxval);
+				}
+			}
+			return true;
+		}
+	}
+
+	// detects the format from the file contents: BMP (8/24/32 bit uncompressed) or PGM (P2/P5)
+	inline bool DecodeImage(const std::vector<std::uint8_t>& file, GrayImage& out, std::string& error)
+	{
+		if (file.size() >= 2 && file[0] == 'B' && file[1] == 'M')
+		{
+			return img::DecodeBMP(file, out, error);
+		}
+		if (file.size() >= 2 && file[0] == 'P' && (file[1] == '5' || file[1] == '2'))
+		{
+			return img::DecodePGM(file, out, error);
+		}
+		error = "unknown image format";
+		return false;
+	}
+
+	inline bool DecodeImageFile(const std::string& path, GrayImage& out, std::string& error)
+	{
+		std::vector<std::uint8_t> bytes;
+		if (!ReadFileBytes(path, bytes))
+		{
+			error = "could not read file";
+			return false;
+		}
+		return DecodeImage(bytes, out, error);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,542 @@
+#pragma once
+
+#include "Network.h"
+#include "Cascade.h"
+#include "PredictionCache.h"
+#include "ModelHandle.h"
+#include "Signal.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <chrono>
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstdio>
+#include <cerrno>
+#include <iostream>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace util
+{
+	static constexpr int REQUEST_PIXELS = 28 * 28;
+
+	struct BatchingPolicy
+	{
+		int maxBatch = 32;      // requests per forward pass
+		int maxWaitUs = 2000;   // how long the oldest queued request may wait for the batch to fill
+	};
+
+	// request latency (arrival to result) and batch size statistics since the last report
+	class LatencyStats
+	{
+	public:
+		void Record(const std::vector<double>& latenciesUs)
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			latencies.insert(latencies.end(), latenciesUs.begin(), latenciesUs.end());
+			batches++;
+		}
+
+		void Report(std::ostream& out)
+		{
+			std::vector<double> lat;
+			long long n_batches = 0;
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				lat.swap(latencies);
+				n_batches = batches;
+				batches = 0;
+			}
+
+			auto now = std::chrono::steady_clock::now();
+			double seconds = std::chrono::duration<double>(now - since).count();
+			since = now;
+
+			if (lat.empty())
+			{
+				return;
+			}
+
+			out << "requests " << lat.size()
+				<< " | p50 " << Percentile(lat, 0.50) << "us p99 " << Percentile(lat, 0.99) << "us"
+				<< " | " << (seconds > 0.0 ? lat.size() / seconds : 0.0) << " req/s"
+				<< " | avg batch " << (double)lat.size() / n_batches << '\n';
+		}
+	private:
+		static double Percentile(std::vector<double>& values, double p)
+		{
+			std::size_t k = std::min(values.size() - 1, (std::size_t)(p * values.size()));
+			std::nth_element(values.begin(), values.begin() + k, values.end());
+			return values[k];
+		}
+	private:
+		std::mutex mtx;
+		std::vector<double> latencies;
+		long long batches = 0;
+		std::chrono::steady_clock::time_point since = std::chrono::steady_clock::now();
+	};
+
+	// coalesces concurrent requests into one FeedBatch call, a batch is run once it is full or its oldest request has waited maxWaitUs
+	// with a small model the batch goes through a cascade in front of the model, with a cache repeated inputs are answered without queueing
+	// every batch pins the model it started with, so the handle can swap in a new one at any time
+	class MicroBatcher
+	{
+	public:
+		MicroBatcher(ModelHandle& model, BatchingPolicy policy, double reportInterval = 5.0, const net::Network* small = nullptr, double threshold = 1.0, PredictionCache* cache = nullptr)
+			:
+			model(model), policy(policy), reportInterval(reportInterval), small(small), threshold(threshold), cache(cache)
+		{
+			// without a reader slot the worker could not pin a model, so it is not started
+			reader = model.Register();
+			if (reader >= 0)
+			{
+				worker = std::thread([this]() { Run(); });
+			}
+		}
+		~MicroBatcher()
+		{
+			Stop();
+		}
+		MicroBatcher(const MicroBatcher&) = delete;
+		MicroBatcher& operator=(const MicroBatcher&) = delete;
+
+		// false if every reader slot of the handle was taken, Submit must not be called then
+		bool Valid() const { return reader >= 0; }
+
+		std::future<Prediction> Submit(const std::uint8_t* pixels)
+		{
+			Prediction cached;
+			if (cache && cache->Lookup(pixels, cached))
+			{
+				std::promise<Prediction> hit;
+				hit.set_value(cached);
+				return hit.get_future();
+			}
+
+			Request req;
+			req.generation = cache ? cache->Generation() : 0;
+			std::copy(pixels, pixels + REQUEST_PIXELS, req.pixels.begin());
+			req.arrival = std::chrono::steady_clock::now();
+			std::future<Prediction> res = req.result.get_future();
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				queue.push_back(std::move(req));
+			}
+			cv.notify_one();
+			return res;
+		}
+
+		// finishes the queued requests and prints the final statistics
+		void Stop()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				if (stopping)
+				{
+					return;
+				}
+				stopping = true;
+			}
+			if (!Valid())
+			{
+				return;
+			}
+			cv.notify_one();
+			worker.join();
+			model.Unregister(reader);
+			Report();
+		}
+	private:
+		struct Request
+		{
+			std::array<std::uint8_t, REQUEST_PIXELS> pixels;
+			std::promise<Prediction> result;
+			std::chrono::steady_clock::time_point arrival;
+			std::uint64_t generation;
+		};
+
+		void Report()
+		{
+			stats.Report(std::cerr);
+			if (cache)
+			{
+				cache->Report(std::cerr);
+			}
+		}
+
+		void Run()
+		{
+			auto lastReport = std::chrono::steady_clock::now();
+			std::vector<Request> batch;
+			std::vector<Prediction> predictions;
+			std::vector<double> latencies;
+
+			std::unique_lock<std::mutex> lock(mtx);
+			for (;;)
+			{
+				cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+				if (queue.empty())
+				{
+					break;
+				}
+
+				auto deadline = queue.front().arrival + std::chrono::microseconds(policy.maxWaitUs);
+				cv.wait_until(lock, deadline, [this]() { return stopping || (int)queue.size() >= policy.maxBatch; });
+
+				std::size_t n = std::min<std::size_t>(queue.size(), policy.maxBatch);
+				batch.clear();
+				for (std::size_t i = 0; i < n; i++)
+				{
+					batch.push_back(std::move(queue.front()));
+					queue.pop_front();
+				}
+				lock.unlock();
+
+				util::Matrix<double> inputs{ {}, (int)n, REQUEST_PIXELS };
+				for (std::size_t r = 0; r < n; r++)
+				{
+					for (int c = 0; c < REQUEST_PIXELS; c++)
+					{
+						inputs((int)r, c) = (double)batch[r].pixels[c] / 255.0;
+					}
+				}
+				predictions.clear();
+				{
+					ModelHandle::Guard current = model.Read(reader);
+					if (small)
+					{
+						predictions = net::Cascade{ *small, *current, threshold }.ClassifyBatch(inputs);
+					}
+					else
+					{
+						util::Matrix<double> outputs = current->FeedBatch(inputs);
+						for (std::size_t r = 0; r < n; r++)
+						{
+							predictions.push_back(TopClass(outputs, (int)r));
+						}
+					}
+				}
+
+				auto done = std::chrono::steady_clock::now();
+				latencies.clear();
+				for (std::size_t r = 0; r < n; r++)
+				{
+					if (cache)
+					{
+						cache->Insert(batch[r].pixels.data(), predictions[r], batch[r].generation);
+					}
+					batch[r].result.set_value(predictions[r]);
+					latencies.push_back(std::chrono::duration<double, std::micro>(done - batch[r].arrival).count());
+				}
+				stats.Record(latencies);
+
+				if (reportInterval > 0.0 && std::chrono::duration<double>(done - lastReport).count() >= reportInterval)
+				{
+					Report();
+					lastReport = done;
+				}
+
+				lock.lock();
+			}
+		}
+	private:
+		ModelHandle& model;
+		BatchingPolicy policy;
+		double reportInterval;
+		const net::Network* small;
+		double threshold;
+		PredictionCache* cache;
+		int reader = -1;
+
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::deque<Request> queue;
+		bool stopping = false;
+
+		LatencyStats stats;
+		std::thread worker;
+	};
+
+	// blocks until n bytes are read, returns false on end of stream, error or a stop request
+	inline bool ReadFull(int fd, std::uint8_t* buf, std::size_t n)
+	{
+		std::size_t got = 0;
+		while (got < n)
+		{
+#ifdef _WIN32
+			int r = _read(fd, buf + got, (unsigned int)(n - got));
+#else
+			pollfd p{ fd, POLLIN, 0 };
+			int ready = poll(&p, 1, 200);
+			if (StopRequested())
+			{
+				return false;
+			}
+			if (ready == 0 || (ready < 0 && errno == EINTR))
+			{
+				continue;
+			}
+			ssize_t r = read(fd, buf + got, n - got);
+			if (r < 0 && errno == EINTR)
+			{
+				continue;
+			}
+#endif
+			if (r <= 0)
+			{
+				return false;
+			}
+			got += (std::size_t)r;
+		}
+		return true;
+	}
+
+	inline bool WriteFull(int fd, const char* buf, std::size_t n)
+	{
+		std::size_t sent = 0;
+		while (sent < n)
+		{
+#ifdef _WIN32
+			int r = _write(fd, buf + sent, (unsigned int)(n - sent));
+#else
+			ssize_t r = write(fd, buf + sent, n - sent);
+			if (r < 0 && errno == EINTR)
+			{
+				continue;
+			}
+#endif
+			if (r <= 0)
+			{
+				return false;
+			}
+			sent += (std::size_t)r;
+		}
+		return true;
+	}
+
+	// reads 784 byte frames (row major 8 bit grayscale) from in_fd and writes "<label> <probability>\n" to out_fd in request order
+	// frames are submitted as soon as they arrive so one pipelined client can fill a batch on its own
+	inline void ServeStream(MicroBatcher& batcher, int in_fd, int out_fd)
+	{
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::deque<std::future<Prediction>> pending;
+		bool done = false;
+
+		std::thread reader([&]()
+		{
+			std::array<std::uint8_t, REQUEST_PIXELS> frame;
+			while (ReadFull(in_fd, frame.data(), frame.size()))
+			{
+				std::future<Prediction> f = batcher.Submit(frame.data());
+				std::lock_guard<std::mutex> lock(mtx);
+				pending.push_back(std::move(f));
+				cv.notify_one();
+			}
+			std::lock_guard<std::mutex> lock(mtx);
+			done = true;
+			cv.notify_one();
+		});
+
+		bool writable = true;
+		for (;;)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [&]() { return done || !pending.empty(); });
+			if (pending.empty())
+			{
+				break;
+			}
+			std::future<Prediction> f = std::move(pending.front());
+			pending.pop_front();
+			lock.unlock();
+
+			Prediction p = f.get();
+			char line[64];
+			int len = std::snprintf(line, sizeof(line), "%d %.6f\n", p.label, p.probability);
+			if (writable)
+			{
+				writable = WriteFull(out_fd, line, (std::size_t)len); // keep draining replies if the client went away
+			}
+		}
+		reader.join();
+	}
+
+	inline int ServeStdin(MicroBatcher& batcher)
+	{
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+		_setmode(_fileno(stdout), _O_BINARY);
+		ServeStream(batcher, _fileno(stdin), _fileno(stdout));
+#else
+		ServeStream(batcher, STDIN_FILENO, STDOUT_FILENO);
+#endif
+		return 0;
+	}
+
+	inline int ServeUnixSocket(MicroBatcher& batcher, const std::string& path)
+	{
+#ifdef _WIN32
+		std::cerr << "Unix domain sockets are not supported on this platform, use --stdin\n";
+		return 1;
+#else
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(addr.sun_path))
+		{
+			std::cerr << "Socket path too long: " << path << '\n';
+			return 1;
+		}
+		std::copy(path.begin(), path.end(), addr.sun_path);
+
+		int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		unlink(path.c_str());
+		if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0)
+		{
+			std::cerr << "Could not listen on " << path << '\n';
+			if (listen_fd >= 0)
+			{
+				close(listen_fd);
+			}
+			return 1;
+		}
+		std::cerr << "Listening on " << path << '\n';
+
+		struct Connection
+		{
+			int fd;
+			std::thread thread;
+			std::shared_ptr<std::atomic<bool>> finished;
+		};
+		std::vector<Connection> connections;
+
+		while (!StopRequested())
+		{
+			// reap finished connections
+			for (auto it = connections.begin(); it != connections.end();)
+			{
+				if (it->finished->load())
+				{
+					it->thread.join();
+					close(it->fd);
+					it = connections.erase(it);
+				}
+				else
+				{
+					++it;
+				}
+			}
+
+			pollfd p{ listen_fd, POLLIN, 0 };
+			if (poll(&p, 1, 200) <= 0)
+			{
+				continue;
+			}
+			int fd = accept(listen_fd, nullptr, nullptr);
+			if (fd < 0)
+			{
+				continue;
+			}
+
+			Connection c{ fd, {}, std::make_shared<std::atomic<bool>>(false) };
+			std::shared_ptr<std::atomic<bool>> finished = c.finished;
+			c.thread = std::thread([&batcher, fd, finished]()
+			{
+				ServeStream(batcher, fd, fd);
+				finished->store(true);
+			});
+			connections.push_back(std::move(c));
+		}
+
+		close(listen_fd);
+		unlink(path.c_str());
+		for (Connection& c : connections)
+		{
+			shutdown(c.fd, SHUT_RDWR);
+			c.thread.join();
+			close(c.fd);
+		}
+		return 0;
+#endif
+	}
+
+	// a non-empty smallPath serves a cascade that lets the small model answer at or above threshold
+	// with watch the model file is reloaded whenever it changes, requests keep being answered by the old model meanwhile
+	inline int Serve(const std::string& modelPath, const std::string& socketPath, bool useStdin, BatchingPolicy policy, double reportInterval,
+		const std::string& smallPath = "", double threshold = 1.0, std::size_t cacheEntries = 0, bool watch = false)
+	{
+		auto model = std::make_unique<net::Network>(modelPath);
+		if (!model->IsLoaded())
+		{
+			return 1;
+		}
+		std::unique_ptr<net::Network> small;
+		if (!smallPath.empty())
+		{
+			small = std::make_unique<net::Network>(smallPath);
+			if (!small->IsLoaded() || small->GetOutputSize() != model->GetOutputSize())
+			{
+				std::cerr << "Cascade model " << smallPath << " is missing or has a different number of outputs\n";
+				return 1;
+			}
+		}
+		for (const net::Network* m : { model.get(), small.get() })
+		{
+			if (m && m->GetInputSize() != REQUEST_PIXELS)
+			{
+				std::cerr << "Model expects " << m->GetInputSize() << " inputs, requests carry " << REQUEST_PIXELS << '\n';
+				return 1;
+			}
+		}
+		if (policy.maxBatch <= 0 || policy.maxWaitUs < 0)
+		{
+			std::cerr << "Invalid batching policy\n";
+			return 1;
+		}
+
+		InstallStopHandler();
+#ifndef _WIN32
+		std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+		std::unique_ptr<PredictionCache> cache;
+		if (cacheEntries > 0)
+		{
+			cache = std::make_unique<PredictionCache>(cacheEntries);
+		}
+		ModelHandle handle{ std::move(model) };
+		if (cache)
+		{
+			handle.OnPublish([&cache]() { cache->Invalidate(); });
+		}
+		if (watch)
+		{
+			handle.Watch(modelPath);
+		}
+		MicroBatcher batcher{ handle, policy, reportInterval, small.get(), threshold, cache.get() };
+		if (!batcher.Valid())
+		{
+			std::cerr << "No free model reader slot\n";
+			handle.StopWatching();
+			return 1;
+		}
+		int res = useStdin ? ServeStdin(batcher) : ServeUnixSocket(batcher, socketPath);
+		batcher.Stop();
+		handle.StopWatching();
+		return res;
+	}
+}
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include "Activation.h"
 #include "Utility.h"
 #include "Cost.h"
+#include <algorithm>
+#include <cstdint>
 
 namespace net
 {
@@ -11,11 +13,14 @@ namespace net
 	public:
 		Layer(Layer* in, util::Matrix<double> biases, int n_nodes, actf::ACTIVATION_TYPE activation, double wmin = -1.0, double wmax = 1.0)
 			:
-			in(in), n_nodes(n_nodes), weights({}, in->n_nodes, n_nodes), biases(biases), activation(activation)
+			n_nodes(n_nodes), weights({}, in->n_nodes, n_nodes), biases(biases), activation(activation)
 		{
+			util::RandomStream rng = util::NextStream(util::STREAM::WEIGHT_INIT);
+			rng.FillUniform(this->weights.GetValues().data(), this->weights.GetValues().size(), wmin, wmax);
+			const double scale = std::sqrt((double)in->n_nodes);
 			for (double& w : this->weights.GetValues())
 			{
-				w = util::Random<double>(std::uniform_real_distribution<double>(wmin, wmax)) / std::sqrt((double)in->n_nodes);
+				w /= scale;
 			}
 		}
 		Layer(int n_nodes) : n_nodes(n_nodes) {}
@@ -28,17 +33,122 @@ namespace net
 				return input;
 			}
 
-			util::Matrix<double> z = input * weights + biases;
+			util::Matrix<double> z = IsPacked() ? PackedWeighted(input) : input * weights + biases;
 			weightedInputs = z;
 			util::Matrix<double> a = actf::Activation(activation, z);
 			outputs = a;
 			return a;
 		}
+
+		// leaves the layer state untouched so it can run alongside training, one sample per row of input
+		util::Matrix<double> ForwardBatch(const util::Matrix<double>& input) const
+		{
+			return Activate(WeightedBatch(input));
+		}
+
+		util::Matrix<double> WeightedBatch(const util::Matrix<double>& input) const
+		{
+			if (IsPacked())
+			{
+				return PackedWeighted(input);
+			}
+
+			util::Matrix<double> z = input * weights;
+			for (int r = 0; r < z.GetRows(); r++)
+			{
+				for (int c = 0; c < z.GetColumns(); c++)
+				{
+					z(r, c) += biases[c];
+				}
+			}
+			return z;
+		}
+
+		util::Matrix<double> Activate(const util::Matrix<double>& z) const
+		{
+			return actf::Activation_rows(activation, z);
+		}
+	public: // packed weights
+		static constexpr int PANEL = 8; // outputs per panel
+
+		// copies the weights into panels of PANEL outputs, each panel stores the PANEL weights of one input next to each other
+		// (the last panel is zero padded) so the kernel keeps PANEL accumulators in registers and streams the panel linearly
+		// PANEL doubles are one cache line and the buffer is cache line aligned, so every panel row is an aligned load
+		void Pack()
+		{
+			const int n_in = weights.GetRows();
+			const int n_out = weights.GetColumns();
+			const int n_panels = (n_out + PANEL - 1) / PANEL;
+
+			packedWeights.assign((std::size_t)n_panels * n_in * PANEL, 0.0);
+			for (int p = 0; p < n_panels; p++)
+			{
+				double* panel = packedWeights.data() + (std::size_t)p * n_in * PANEL;
+				for (int k = 0; k < n_in; k++)
+				{
+					for (int j = 0; j < PANEL && p * PANEL + j < n_out; j++)
+					{
+						panel[k * PANEL + j] = weights(k, p * PANEL + j);
+					}
+				}
+			}
+			packedVersion = weightsVersion;
+		}
+
+		// must be called after writing to GetWeights(), stale packed weights are ignored until the next Pack()
+		void WeightsModified() { weightsVersion++; }
+
+		bool IsPacked() const { return packedVersion == weightsVersion && !packedWeights.empty(); }
+
+		// input * weights + biases through the packed panels, one sample per row of input
+		util::Matrix<double> PackedWeighted(const util::Matrix<double>& input) const
+		{
+			const int n_in = weights.GetRows();
+			const int n_out = weights.GetColumns();
+			const int n_panels = (n_out + PANEL - 1) / PANEL;
+			assert(input.GetColumns() == n_in);
+
+			// rowBlock input rows stay cached while every panel passes over them
+			const int rows = input.GetRows();
+			const int block = util::GetKernelTuning().rowBlock > 0 ? util::GetKernelTuning().rowBlock : rows;
+			util::Matrix<double> z{ {}, rows, n_out };
+			for (int r0 = 0; r0 < rows; r0 += block)
+			{
+				const int r1 = std::min(rows, r0 + block);
+				for (int p = 0; p < n_panels; p++)
+				{
+					const double* panel = packedWeights.data() + (std::size_t)p * n_in * PANEL;
+					const int width = std::min(PANEL, n_out - p * PANEL);
+					for (int r = r0; r < r1; r++)
+					{
+						const double* x = input.GetValues().data() + (std::size_t)r * n_in;
+						double acc[PANEL] = {};
+						for (int k = 0; k < n_in; k++)
+						{
+							const double xk = x[k];
+							const double* w = panel + k * PANEL;
+							for (int j = 0; j < PANEL; j++)
+							{
+								acc[j] += xk * w[j];
+							}
+						}
+						for (int j = 0; j < width; j++)
+						{
+							z(r, p * PANEL + j) = acc[j] + biases[p * PANEL + j];
+						}
+					}
+				}
+			}
+			return z;
+		}
 	public: // Getters/setters
 		util::Matrix<double>& GetWeights() { return weights; }
 		util::Matrix<double>& GetBiases() { return biases; }
 		util::Matrix<double>& GetWeightedInputs() { return weightedInputs; }
 		util::Matrix<double>& GetOutputs() { return outputs; }
+		const util::Matrix<double>& GetWeights() const { return weights; }
+		actf::ACTIVATION_TYPE GetActivation() const { return activation; }
+		const util::Matrix<double>& GetBiases() const { return biases; }
 	private:
 		int n_nodes = 0;
 		actf::ACTIVATION_TYPE activation;
@@ -46,6 +156,9 @@ namespace net
 		util::Matrix<double> biases;
 		util::Matrix<double> weightedInputs;
 		util::Matrix<double> outputs;
-		Layer* in = nullptr;
+
+		std::vector<double, util::AlignedAllocator<double>> packedWeights;
+		std::uint64_t weightsVersion = 0;
+		std::uint64_t packedVersion = ~0ull;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,361 @@
+#pragma once
+
+#include "Network.h"
+#include "Pruning.h"
+#include "Trainer.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <numeric>
+
+namespace net
+{
+	// eigen decomposition of the symmetric n x n matrix a (row major) with cyclic Jacobi rotations
+	// values are sorted descending, vectors holds the matching eigenvectors as columns
+	inline void SymmetricEigen(std::vector<double> a, int n, std::vector<double>& values, std::vector<double>& vectors)
+	{
+		std::vector<double> v((std::size_t)n * n, 0.0);
+		for (int i = 0; i < n; i++)
+		{
+			v[(std::size_t)i * n + i] = 1.0;
+		}
+
+		double total = 0.0;
+		for (double x : a)
+		{
+			total += x * x;
+		}
+		for (int sweep = 0; sweep < 50; sweep++)
+		{
+			double off = 0.0;
+			for (int p = 0; p < n; p++)
+			{
+				for (int q = p + 1; q < n; q++)
+				{
+					off += a[(std::size_t)p * n + q] * a[(std::size_t)p * n + q];
+				}
+			}
+			if (off <= 1e-24 * total)
+			{
+				break;
+			}
+
+			for (int p = 0; p < n; p++)
+			{
+				for (int q = p + 1; q < n; q++)
+				{
+					const double apq = a[(std::size_t)p * n + q];
+					if (apq == 0.0)
+					{
+						continue;
+					}
+					// the rotation that zeroes a(p, q), t = tan of the angle picked as the smaller root
+					const double theta = (a[(std::size_t)q * n + q] - a[(std::size_t)p * n + p]) / (2.0 * apq);
+					const double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+					const double c = 1.0 / std::sqrt(t * t + 1.0);
+					const double s = t * c;
+
+					for (int k = 0; k < n; k++)
+					{
+						double& akp = a[(std::size_t)k * n + p];
+						double& akq = a[(std::size_t)k * n + q];
+						const double x = akp, y = akq;
+						akp = c * x - s * y;
+						akq = s * x + c * y;
+					}
+					for (int k = 0; k < n; k++)
+					{
+						double& apk = a[(std::size_t)p * n + k];
+						double& aqk = a[(std::size_t)q * n + k];
+						const double x = apk, y = aqk;
+						apk = c * x - s * y;
+						aqk = s * x + c * y;
+					}
+					for (int k = 0; k < n; k++)
+					{
+						double& vkp = v[(std::size_t)k * n + p];
+						double& vkq = v[(std::size_t)k * n + q];
+						const double x = vkp, y = vkq;
+						vkp = c * x - s * y;
+						vkq = s * x + c * y;
+					}
+				}
+			}
+		}
+
+		std::vector<int> order(n);
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](int i, int j) { return a[(std::size_t)i * n + i] > a[(std::size_t)j * n + j]; });
+		values.resize(n);
+		vectors.assign((std::size_t)n * n, 0.0);
+		for (int c = 0; c < n; c++)
+		{
+			values[c] = a[(std::size_t)order[c] * n + order[c]];
+			for (int r = 0; r < n; r++)
+			{
+				vectors[(std::size_t)r * n + c] = v[(std::size_t)r * n + order[c]];
+			}
+		}
+	}
+
+	// w (inputs x outputs) ~ a * b with a: inputs x rank and b: rank x outputs
+	struct LowRankFactors
+	{
+		util::Matrix<double> a;
+		util::Matrix<double> b;
+		double energy = 1.0;    // fraction of the squared Frobenius norm of w the factors keep
+	};
+
+	// truncated SVD through the eigenvectors of the smaller gram matrix, w is projected onto its top `rank` singular vectors
+	inline LowRankFactors Factorize(const util::Matrix<double>& w, int rank)
+	{
+		using M = util::Matrix<double>;
+		const int n_in = w.GetRows();
+		const int n_out = w.GetColumns();
+		const bool outputSide = n_out <= n_in;
+		const int n = outputSide ? n_out : n_in;
+		rank = std::max(1, std::min(rank, n));
+
+		M gram = outputSide ? M::Multiply(w, true, w, false) : M::Multiply(w, false, w, true);
+		std::vector<double> values, vectors;
+		SymmetricEigen(std::vector<double>(gram.GetValues().begin(), gram.GetValues().end()), n, values, vectors);
+
+		M top{ {}, n, rank };
+		for (int r = 0; r < n; r++)
+		{
+			std::copy(vectors.begin() + (std::size_t)r * n, vectors.begin() + (std::size_t)r * n + rank, top.GetValues().begin() + (std::size_t)r * rank);
+		}
+
+		LowRankFactors res;
+		if (outputSide)
+		{
+			res.a = M::Multiply(w, false, top, false);      // w v
+			res.b = top.GetTransposed();                    // v^T
+		}
+		else
+		{
+			res.a = top;                                    // u
+			res.b = M::Multiply(top, true, w, false);       // u^T w
+		}
+
+		double kept = 0.0, total = 0.0;
+		for (int i = 0; i < n; i++)
+		{
+			total += std::max(0.0, values[i]);
+			kept += i < rank ? std::max(0.0, values[i]) : 0.0;
+		}
+		res.energy = total > 0.0 ? kept / total : 1.0;
+		return res;
+	}
+
+	// a rank only pays off if the two thin products are cheaper than the dense one
+	inline bool RankSavesCompute(int n_in, int n_out, int rank)
+	{
+		return rank > 0 && (long long)rank * (n_in + n_out) < (long long)n_in * n_out;
+	}
+
+	// replaces the weights of every layer where `rank` saves compute with their rank `rank` approximation
+	// returns the mean kept energy of the factored layers
+	inline double TruncateRank(Network& network, int rank)
+	{
+		const std::vector<int>& sizes = network.GetLayerSizes();
+		double energy = 0.0;
+		int factored = 0;
+		for (int l = 1; l < (int)sizes.size(); l++)
+		{
+			if (!RankSavesCompute(sizes[l - 1], sizes[l], rank))
+			{
+				continue;
+			}
+			Layer& layer = network.GetLayer(l);
+			LowRankFactors f = Factorize(layer.GetWeights(), rank);
+			layer.GetWeights() = util::Matrix<double>::Multiply(f.a, false, f.b, false);
+			layer.WeightsModified();
+			energy += f.energy;
+			factored++;
+		}
+		return factored ? energy / factored : 1.0;
+	}
+
+	// a layer that is either dense (rank 0) or stored as two thin factors
+	struct LowRankLayer
+	{
+		int n_in = 0;
+		int n_out = 0;
+		int rank = 0;
+		actf::ACTIVATION_TYPE activation;
+		util::Matrix<double> a;         // the dense weights if rank is 0
+		util::Matrix<double> b;
+		util::Matrix<double> biases;
+	};
+
+	// inference with the factored layers executed as two smaller GEMMs, x * a then * b
+	// built by the lowrank report to time the factored layers, saved models keep the dense weights and are served dense
+	class LowRankNetwork
+	{
+	public:
+		LowRankNetwork(const Network& network, int rank)
+		{
+			const std::vector<int>& sizes = network.GetLayerSizes();
+			for (int l = 1; l < (int)sizes.size(); l++)
+			{
+				const Layer& src = network.GetLayer(l);
+				LowRankLayer layer;
+				layer.n_in = sizes[l - 1];
+				layer.n_out = sizes[l];
+				layer.activation = src.GetActivation();
+				layer.biases = src.GetBiases();
+				if (RankSavesCompute(layer.n_in, layer.n_out, rank))
+				{
+					LowRankFactors f = Factorize(src.GetWeights(), rank);
+					layer.rank = f.a.GetColumns();
+					layer.a = std::move(f.a);
+					layer.b = std::move(f.b);
+				}
+				else
+				{
+					layer.a = src.GetWeights();
+				}
+				layers.push_back(std::move(layer));
+			}
+		}
+
+		util::Matrix<double> FeedBatch(const util::Matrix<double>& inputs) const
+		{
+			using M = util::Matrix<double>;
+			M x = inputs;
+			for (const LowRankLayer& layer : layers)
+			{
+				M z = M::Multiply(x, false, layer.a, false);
+				if (layer.rank > 0)
+				{
+					z = M::Multiply(z, false, layer.b, false);
+				}
+				for (int r = 0; r < z.GetRows(); r++)
+				{
+					for (int c = 0; c < z.GetColumns(); c++)
+					{
+						z(r, c) += layer.biases[c];
+					}
+				}
+				x = actf::Activation_rows(layer.activation, z);
+			}
+			return x;
+		}
+
+		// multiply-adds of one sample
+		std::size_t MultiplyAdds() const
+		{
+			std::size_t n = 0;
+			for (const LowRankLayer& layer : layers)
+			{
+				n += layer.rank > 0 ? (std::size_t)layer.rank * (layer.n_in + layer.n_out) : (std::size_t)layer.n_in * layer.n_out;
+			}
+			return n;
+		}
+
+		std::string RankString() const
+		{
+			std::string res;
+			for (const LowRankLayer& layer : layers)
+			{
+				res += (res.empty() ? "" : ",") + (layer.rank > 0 ? std::to_string(layer.rank) : std::string("-"));
+			}
+			return res;
+		}
+	private:
+		std::vector<LowRankLayer> layers;
+	};
+
+	// ---------------------------------------------------------------------------------------
+
+	struct LowRankConfig
+	{
+		std::vector<int> ranks{ 128, 64, 32, 16 };  // descending, every rank starts from the original model
+		int finetuneEpochs = 0;        // the dense weights are trained and projected back to the rank after every epoch
+		double learnRate = 0.01;
+		int batchSize = 100;
+		int latencySamples = 500;
+	};
+
+	// factors the model at every rank and prints accuracy / compute / latency per rank
+	class LowRankCompressor
+	{
+	public:
+		LowRankCompressor(LowRankConfig config, const std::vector<util::DataPoint<double>>& train, const std::vector<util::DataPoint<double>>& test)
+			: config(config), test(test)
+		{
+			if (config.finetuneEpochs > 0 && !train.empty())
+			{
+				trainer = std::make_unique<util::Trainer>(config.batchSize, train, std::vector<util::DataPoint<double>>{});
+			}
+		}
+
+		// returns the rank truncated model of the last rank
+		Network Run(Network network)
+		{
+			network.Pack();
+			LowRankNetwork dense{ network, 0 };
+			dense_madds = dense.MultiplyAdds();
+			base_acc = PruneAccuracy(network, test);
+			double base_us = PruneLatencyUs(network, test, config.latencySamples);
+
+			std::cout << std::fixed << std::setprecision(4)
+				<< "rank   factored     energy    MFLOP     compute   accuracy   delta     dense us    factored us\n"
+				<< "dense  -            " << std::setw(8) << 1.0 << "  " << std::setw(7) << 2.0 * dense_madds / 1e6 << "  "
+				<< std::setw(8) << 1.0 << "  " << std::setw(8) << base_acc * 100.0 << "%  " << std::setw(8) << 0.0 << "  "
+				<< std::setw(10) << base_us << "  -\n";
+
+			Network res = network;
+			for (int rank : config.ranks)
+			{
+				res = network;
+				double energy = TruncateRank(res, rank);
+				Finetune(res, rank);
+				Report(rank, energy, res);
+			}
+			std::cout << std::defaultfloat << std::setprecision(6);
+			return res;
+		}
+	private:
+		void Finetune(Network& network, int rank)
+		{
+			if (!trainer)
+			{
+				return;
+			}
+			for (int e = 0; e < config.finetuneEpochs; e++)
+			{
+				for (int b = 0; b < (int)trainer->GetTrainingDataBatches().size(); b++)
+				{
+					trainer->Train(network, config.learnRate, b);
+				}
+				TruncateRank(network, rank);
+			}
+		}
+
+		void Report(int rank, double energy, Network& network)
+		{
+			network.Pack();
+			LowRankNetwork factored{ network, rank };
+			double acc = PruneAccuracy(factored, test);
+			std::size_t madds = factored.MultiplyAdds();
+
+			std::cout << std::left << std::setw(7) << rank << std::setw(13) << factored.RankString() << std::right
+				<< std::setw(8) << energy << "  " << std::setw(7) << 2.0 * madds / 1e6 << "  "
+				<< std::setw(8) << (double)madds / dense_madds << "  "
+				<< std::setw(8) << acc * 100.0 << "%  " << std::setw(8) << (acc - base_acc) * 100.0 << "  "
+				<< std::setw(10) << PruneLatencyUs(network, test, config.latencySamples) << "  "
+				<< std::setw(10) << PruneLatencyUs(factored, test, config.latencySamples) << '\n';
+		}
+	private:
+		LowRankConfig config;
+		const std::vector<util::DataPoint<double>>& test;
+		std::unique_ptr<util::Trainer> trainer;
+
+		std::size_t dense_madds = 0;
+		double base_acc = 0.0;
+	};
+}
\ No newline at end of file
@@ -3,12 +3,15 @@
 
 #include <vector>
 #include "Utility.h"
+#include "ImageDecoder.h"
 #include <fstream>
 #include <string>
 #include <algorithm>
-#include <Windows.h>
 #include <cassert>
 #include <iostream>
+#include <cctype>
+#include <thread>
+#include <cmath>
 
 namespace util
 {
@@ -69,21 +72,30 @@ namespace util
 		return res;
 	}
 
+	inline Matrix<double> GrayToMatrix(const GrayImage& image)
+	{
+		Matrix<double> res{ {}, 1, image.width * image.height };
+		for (std::size_t i = 0; i < image.pixels.size(); i++)
+		{
+			res[(int)i] = (double)image.pixels[i] / 255.0;
+		}
+		return res;
+	}
+
 	class Noise
 	{
 	public:
-		Noise(Matrix<double>& input)
-			: input(input)
+		Noise(Matrix<double>& input, RandomStream& rng)
+			: input(input), rng(rng)
 		{}
 		Matrix<double> operator()(double level)
 		{
 			Matrix<double> res{ {}, input.GetRows(), input.GetColumns() };
+			rng.FillNormal(res.GetValues().data(), res.GetValues().size(), 0.0, 0.15);
 			int i = 0;
-			static constexpr double acc = 100000.0;
 			for (double& v : input.GetValues())
 			{
-				res[i] = input[i];
-				res[i] += Random<double>(std::normal_distribution<double>(0.0, 0.15)) * level;
+				res[i] = input[i] + res[i] * level;
 				if (res[i] > 1.0)
 				{
 					res[i] = 1.0;
@@ -98,19 +110,20 @@ namespace util
 		}
 	private:
 		Matrix<double>& input;
+		RandomStream& rng;
 	};
 
 	class Offset
 	{
 	public:
-		Offset(Matrix<double>& input)
-			: input(input)
+		Offset(Matrix<double>& input, RandomStream& rng)
+			: input(input), rng(rng)
 		{}
 		Matrix<double> operator()(double level)
 		{
 			Matrix<double> res{ {},input.GetRows(), input.GetColumns() };
-			int xOffset = (int)((double)Random<int>(std::uniform_int_distribution<int>(0,8)) * level);
-			int yOffset = (int)((double)Random<int>(std::uniform_int_distribution<int>(0,8)) * level);
+			int xOffset = (int)((double)rng.UniformInt(0, 8) * level);
+			int yOffset = (int)((double)rng.UniformInt(0, 8) * level);
 
 			int x = 0;
 			int y = 0;
@@ -136,122 +149,172 @@ namespace util
 		}
 	private:
 		Matrix<double>& input;
+		RandomStream& rng;
 	};
 	template<class Processor>
-	void ProcessInput(Processor proc, Matrix<double>& input)
+	void ProcessInput(Processor proc, Matrix<double>& input, RandomStream& rng)
 	{
-		input = proc(Random<double>(std::uniform_real_distribution<double>(-1.0, 1.0)));
+		input = proc(rng.Uniform(-1.0, 1.0));
 	}
 
-	class MNISTReader
+	// offset and noise on one sample, drawn from the stream of (dataset, epoch, index)
+	inline void AugmentSample(Matrix<double>& input, DATATYPE type, std::uint64_t epoch, std::uint64_t index)
 	{
-	public:
-		MNISTReader(std::string dataPath, std::string labelsPath)
-			: dataPath(dataPath), labelsPath(labelsPath), data()
-		{}
+		RandomStream rng{ StreamId(STREAM::AUGMENT, ((std::uint64_t)type << 32) | epoch, index) };
+		Offset offset{ input, rng };
+		Noise noise{ input, rng };
+		ProcessInput(offset, input, rng);
+		ProcessInput(noise, input, rng);
+	}
 
-		static DataPoint<double> ReadBitmap(std::string path)
+	// offset and noise on every sample, each sample draws from its own stream (dataset, epoch, index)
+	// so the result is the same for any number of threads
+	inline void Augment(std::vector<DataPoint<double>>& data, DATATYPE type, std::uint64_t epoch = 0, int threads = (int)std::max(1u, std::thread::hardware_concurrency()))
+	{
+		threads = std::max(1, std::min(threads, (int)data.size()));
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++)
+		{
+			workers.emplace_back([&, t]()
+			{
+				for (std::size_t i = t; i < data.size(); i += threads)
+				{
+					AugmentSample(data[i].input, type, epoch, i);
+				}
+			});
+		}
+		for (std::thread& w : workers)
 		{
-			std::ifstream image;
+			w.join();
+		}
+	}
 
-			image.open(path, std::ios::binary);
-			if (!image)
+	// deterministic stand-in for the MNIST files: seven segment digits with random size, slant, stroke width and wobble,
+	// drawn into the same 28x28 [0, 1] layout and augmented like the real data. sample i of a type is always the same image
+	inline DataPoint<double> SyntheticDigit(DATATYPE type, std::uint64_t index)
+	{
+		// segments a b c d e f g as corner pairs of the 2x3 corner grid (x, y)
+		static constexpr int SEGMENTS[7][4] = { { 0, 0, 1, 0 }, { 1, 0, 1, 1 }, { 1, 1, 1, 2 }, { 0, 2, 1, 2 }, { 0, 1, 0, 2 }, { 0, 0, 0, 1 }, { 0, 1, 1, 1 } };
+		static constexpr std::uint8_t DIGITS[10] = { 0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F }; // bit s = segment s
+
+		RandomStream rng{ StreamId(STREAM::SYNTHETIC, (std::uint64_t)type, index) };
+		const int label = rng.UniformInt(0, 9);
+		const double width = rng.Uniform(7.0, 11.0);
+		const double height = rng.Uniform(14.0, 18.0);
+		const double cx = 14.0 + rng.Uniform(-1.5, 1.5);
+		const double cy = 14.0 + rng.Uniform(-1.5, 1.5);
+		const double slant = rng.Uniform(-0.25, 0.25);
+		const double stroke = rng.Uniform(0.8, 1.8);
+		const double ink = rng.Uniform(0.7, 1.0);
+
+		double px[2][3], py[2][3];
+		for (int gx = 0; gx < 2; gx++)
+		{
+			for (int gy = 0; gy < 3; gy++)
 			{
-				std::cout << "Image not found\n";
-				return {};
+				double y = cy + (gy - 1) * height / 2.0 + rng.Uniform(-1.0, 1.0);
+				px[gx][gy] = cx + (gx - 0.5) * width + slant * (cy - y) + rng.Uniform(-1.0, 1.0);
+				py[gx][gy] = y;
 			}
+		}
 
-			uint8_t* datBuff[2] = { nullptr, nullptr };
-
-			datBuff[0] = new uint8_t[sizeof(BITMAPFILEHEADER)];
-			datBuff[1] = new uint8_t[sizeof(BITMAPINFOHEADER)];
-
-			image.read((char*)datBuff[0], sizeof(BITMAPFILEHEADER));
-			image.read((char*)datBuff[1], sizeof(BITMAPINFOHEADER));
-
-			BITMAPFILEHEADER* bmFileHeader = (BITMAPFILEHEADER*)datBuff[0];
-			BITMAPINFOHEADER* bmInfoHeader = (BITMAPINFOHEADER*)datBuff[1];
-
-			assert(bmFileHeader->bfType == 0x4D42);
-			assert(bmInfoHeader->biBitCount == 24 || bmInfoHeader->biBitCount == 32);
-			assert(bmInfoHeader->biCompression == BI_RGB);
-
-			const bool is32b = bmInfoHeader->biBitCount == 32;
-
-			int width = bmInfoHeader->biWidth;
-			int height;
-
-			// test for reverse row order and control
-			// y loop accordingly
-			int yStart;
-			int yEnd;
-			int dy;
-			if (bmInfoHeader->biHeight < 0)
+		DataPoint<double> dp;
+		dp.label = (double)label;
+		dp.expected = LabelToMatrix(label);
+		dp.input = Matrix<double>{ {}, 1, 28 * 28 };
+		for (int s = 0; s < 7; s++)
+		{
+			if (!(DIGITS[label] >> s & 1))
 			{
-				height = -bmInfoHeader->biHeight;
-				yStart = 0;
-				yEnd = height;
-				dy = 1;
+				continue;
 			}
-			else
+			const double x0 = px[SEGMENTS[s][0]][SEGMENTS[s][1]], y0 = py[SEGMENTS[s][0]][SEGMENTS[s][1]];
+			const double x1 = px[SEGMENTS[s][2]][SEGMENTS[s][3]], y1 = py[SEGMENTS[s][2]][SEGMENTS[s][3]];
+			const double dx = x1 - x0, dy = y1 - y0;
+			const double len2 = dx * dx + dy * dy;
+			// only the pixels within reach of the stroke
+			const double reach = stroke + 1.0;
+			const int xa = std::max(0, (int)std::floor(std::min(x0, x1) - reach)), xb = std::min(27, (int)std::ceil(std::max(x0, x1) + reach));
+			const int ya = std::max(0, (int)std::floor(std::min(y0, y1) - reach)), yb = std::min(27, (int)std::ceil(std::max(y0, y1) + reach));
+			for (int y = ya; y <= yb; y++)
 			{
-				height = bmInfoHeader->biHeight;
-				yStart = height - 1;
-				yEnd = -1;
-				dy = -1;
+				for (int x = xa; x <= xb; x++)
+				{
+					// distance to the segment, antialiased over one pixel
+					double t = len2 > 0.0 ? std::clamp(((x - x0) * dx + (y - y0) * dy) / len2, 0.0, 1.0) : 0.0;
+					double ex = x - (x0 + t * dx), ey = y - (y0 + t * dy);
+					double v = ink * std::clamp(stroke + 0.5 - std::sqrt(ex * ex + ey * ey), 0.0, 1.0);
+					dp.input[y * 28 + x] = std::max(dp.input[y * 28 + x], v);
+				}
 			}
-			image.seekg(bmFileHeader->bfOffBits);
-			// padding is for the case of of 24 bit depth only
-			const int padding = (4 - (width * 3) % 4) % 4;
+		}
+		return dp;
+	}
 
-			assert(height == 28);
-			assert(width == 28);
+	inline std::vector<DataPoint<double>> SyntheticDigits(DATATYPE type, int count)
+	{
+		std::vector<DataPoint<double>> data;
+		data.reserve(count);
+		for (int i = 0; i < count; i++)
+		{
+			data.push_back(SyntheticDigit(type, (std::uint64_t)i));
+		}
+		Augment(data, type);
+		return data;
+	}
 
-			Matrix<double> input{ {}, 1, 28 * 28 };
+	class MNISTReader
+	{
+	public:
+		MNISTReader(std::string dataPath, std::string labelsPath)
+			: dataPath(dataPath), labelsPath(labelsPath), data()
+		{}
 
-			for (int y = yStart; y != yEnd; y += dy)
+		// 28x28 BMP or PGM, the label is taken from the file name (e.g. "5.bmp")
+		static DataPoint<double> ReadBitmap(std::string path)
+		{
+			GrayImage image;
+			std::string error;
+			if (!DecodeImageFile(path, image, error))
 			{
-				for (int x = 0; x < width; x++)
-				{
-					unsigned int color = 0;
-
-					color += image.get();
-					color += image.get();
-					color += image.get();
-
-					color /= 3;
-					double c_res = (double) color / 255;
-					
-					input[y * 28 + x] = c_res;
-
-					if (is32b)
-					{
-						image.seekg(1, std::ios::cur);
-					}
-				}
-				if (!is32b)
-				{
-					image.seekg(padding, std::ios::cur);
-				}
+				std::cout << "Could not read image " << path << ": " << error << '\n';
+				return {};
+			}
+			if (image.width != 28 || image.height != 28)
+			{
+				std::cout << "Image must be 28x28, got " << image.width << 'x' << image.height << '\n';
+				return {};
 			}
-
-			for (int i = 0; i < 2; i++)
-				delete datBuff[i];
 
 			DataPoint<double> res;
-			res.input = input;
-			res.label = (double)std::stoi(path.substr(0, path.find_last_of("."))); // file must be in the same directory for correct label
-			res.expected = LabelToMatrix((int)res.label);
-
-			image.close();
+			res.input = GrayToMatrix(image);
+			res.label = (double)LabelFromFileName(path);
+			res.expected = res.label >= 0.0 ? LabelToMatrix((int)res.label) : Matrix<double>{ {}, 1, 10 };
 
 			return res;
 		}
 
+		// leading digit of the file name, -1 if there is none
+		static int LabelFromFileName(const std::string& path)
+		{
+			std::size_t start = path.find_last_of("/\\");
+			start = start == std::string::npos ? 0 : start + 1;
+			if (start >= path.size() || !std::isdigit((unsigned char)path[start]))
+			{
+				return -1;
+			}
+			return path[start] - '0';
+		}
+
 		std::vector<DataPoint<double>> GetData(DATATYPE type)
 		{
 			std::ifstream labels_f(labelsPath, std::ios::binary);
 			std::ifstream data_f(dataPath, std::ios::binary);
+			if (!labels_f || !data_f)
+			{
+				std::cout << "Data file not found: " << (!data_f ? dataPath : labelsPath) << '\n';
+				return data;
+			}
 	
 			switch (type)
 			{
@@ -288,11 +351,6 @@ namespace util
 
 					dp.input = number;
 
-					Offset offset{ dp.input };
-					Noise noise{ dp.input };
-					ProcessInput(offset, dp.input);
-					ProcessInput(noise, dp.input);
-
 					data.push_back(dp);
 				}
 
@@ -331,11 +389,6 @@ namespace util
 							number[j - (i * 28 * 28)] = (double)testimages->imagesbytes[j] / 255.0;
 						}
 
-						Offset offset{ number };
-						Noise noise{ number };
-						ProcessInput(offset, number);
-						ProcessInput(noise, number);
-
 						dp.input = number;
 
 						data.push_back(dp);
@@ -345,6 +398,7 @@ namespace util
 					delete testimages;
 				}
 			}
+			Augment(data, type);
 			return data;
 		}
 	private:
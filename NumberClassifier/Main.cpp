@@ -2,11 +2,842 @@
 #include "Network.h"
 #include "Cost.h"
 #include "Trainer.h"
+#include "TrainDriver.h"
+#include "InferenceServer.h"
+#include "BatchClassifier.h"
+#include "GradientCheck.h"
+#include "StaticNetwork.h"
+#include "Pruning.h"
+#include "Distributed.h"
+#include "OnlineLearner.h"
+#include "Sweep.h"
+#include "Cascade.h"
+#include "LowRank.h"
+#include "Benchmark.h"
+#include "Streaming.h"
+#include "Autotune.h"
+#include "FineTune.h"
+#include "CodeGen.h"
+#include "Options.h"
+#include "Signal.h"
+#include "Metrics.h"
 #include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <chrono>
+#ifdef _WIN32
 #include <conio.h>
+#endif
 
-int main()
+static void PrintUsage()
 {
+	std::cout << "Usage: NumberClassifier [mode] [--option value ...]\n"
+		<< "  (no mode)   interactive training and classification\n"
+		<< "  train       headless training: --layers 784,256,256,10 --hidden relu --output softmax --batch 100 --threads 1\n"
+		<< "              --task-graph (the threads overlap the backward pass of each batch instead of splitting it)\n"
+		<< "              --lr 0.05 --epochs 1 --eval-interval 100 --eval-samples 1000 --full-eval\n"
+		<< "              --async-eval (full test set evaluations of weight snapshots on a separate thread, training never waits)\n"
+		<< "              --checkpoint-interval 500 --load <path> --save save.txt --warmup 10\n"
+		<< "              --metrics-csv <path> --metrics-jsonl <path> --summary-seconds 10\n"
+		<< "              --train-images/--train-labels/--test-images/--test-labels <path>\n"
+		<< "  train-stream  out-of-core training from IDX files of any size: the train layer/activation/batch/lr/epochs options plus\n"
+		<< "              --memory-mb 256 --window-chunks 8 --augment --read-only (input pipeline only) --eval-samples 2000\n"
+		<< "              --report-seconds 10 --load <path> --save save.txt --train-images/--train-labels/--test-images/--test-labels\n"
+		<< "  gen-idx     writes synthetic seven-segment digits as IDX files: --count 1000000 --images <path> --labels <path>\n"
+		<< "              --test (test stream instead of train) --threads <n>\n"
+		<< "  serve       micro-batched inference: --model save.txt (--socket <path> | --stdin) --max-batch 32\n"
+		<< "              --max-wait-us 2000 --report-interval 5 --cascade small.txt --threshold <from cascade mode>\n"
+		<< "              --cache <entries> (prediction cache for repeated inputs) --watch (reload the model file when it changes)\n"
+		<< "              requests are 784 raw pixel bytes, replies are \"<label> <probability>\\n\"\n"
+		<< "  classify    bulk classification of 28x28 BMP/PGM files: --model save.txt --input <dir|list.txt>\n"
+		<< "              --output results.csv --workers 4 --batch 256\n"
+		<< "  gradcheck   finite difference check of the backprop gradients: --model <path> | --layers 784,256,256,10\n"
+		<< "              --parameters 1000 --batch 32 --eps 1e-5 --threads <n> --seed 1 --tolerance <max rel error>\n"
+		<< "              --test-images/--test-labels <path> (random inputs if missing)\n"
+		<< "  bench-e2e   time-to-accuracy benchmark from a fixed seed: --layers 784,256,256,10 --target 0.9 --max-epochs 20\n"
+		<< "              --batch 100 --lr 0.05 --seed 1 --eval-interval 0 --eval-samples 0 --synthetic (ignore the MNIST files)\n"
+		<< "              --synthetic-train 20000 --synthetic-test 2000 --baseline <path> --write-baseline --tolerance 0.1\n"
+		<< "              --train-images/--train-labels/--test-images/--test-labels <path>\n"
+		<< "  bench-static  single sample latency of Network vs the 784-256-256-10 StaticNetwork: --model save.txt --iterations 2000\n"
+		<< "  prune       magnitude / neuron pruning report: --model save.txt --sparsity 0.5,0.7,0.8,0.9 --neurons 0.25\n"
+		<< "              --finetune-epochs 0 --lr 0.01 --batch 100 --out pruned.txt\n"
+		<< "              (times the CSR kernel for the report only, the saved model is dense with zeroed weights)\n"
+		<< "              --train-images/--train-labels/--test-images/--test-labels <path>\n"
+		<< "  train-dist  data-parallel training in worker processes (POSIX): the train options plus --procs 4\n"
+		<< "              --transport shm|tcp --port 29500 --fp16 --steps <max steps per run>\n"
+		<< "              --procs 1,2,4,8 runs each count from the same initial weights and prints the scaling table\n"
+		<< "  online      incremental learning from a stream of <label byte><784 pixel bytes> records: --model save.txt\n"
+		<< "              --input <path|-> --follow --batch 32 --max-wait-ms 500 --lr 0.01 --replay 5000 --replay-ratio 1\n"
+		<< "              --checkpoint-seconds 10 --report-seconds 10 --save online.txt\n"
+		<< "  sweep       concurrent hyperparameter grid with successive halving: --layers 784,128,10/784,256,10 --lr 0.01,0.05\n"
+		<< "              --batch 32,100 --hidden relu --output softmax --threads <n> --budget 20000 --eta 3 --rungs 3\n"
+		<< "              --eval-samples 2000 --csv sweep.csv --train-images/--train-labels/--test-images/--test-labels <path>\n"
+		<< "  cascade     calibrates the early-exit threshold of a small model in front of the full one: --small small.txt\n"
+		<< "              --model save.txt --target 0.98 --calibration-split 0.5 --test-images/--test-labels <path>\n"
+		<< "  lowrank     truncated SVD compression report: --model save.txt --ranks 128,64,32,16 --finetune-epochs 0\n"
+		<< "              --lr 0.01 --batch 100 --out lowrank.txt (the last rank, saved as dense weights)\n"
+		<< "              --train-images/--train-labels/--test-images/--test-labels <path>\n"
+		<< "  export      writes the model as a self-contained C++ header with constexpr weights: --model save.txt\n"
+		<< "              --out model.h --name digits --check model_check.cpp (program comparing it with Network::Feed)\n"
+		<< "              --probes 16 --tolerance 1e-9\n"
+		<< "  finetune    retrains only the top layers of a model on new data: --model save.txt --freeze <layers from the input\n"
+		<< "              side, default all but the output layer> --epochs 3 --lr 0.01 --batch 100 --no-cache --save finetuned.txt\n"
+		<< "              --train-images/--train-labels/--test-images/--test-labels <path>\n"
+		<< "  autotune    timed trials of the kernel blocking and of batch size x threads, the fastest are written to\n"
+		<< "              tuning-<host>.txt which every later run loads (kernels always, batch/threads for the same layers)\n"
+		<< "              --layers 784,256,256,10 --batch 32,64,100,128,256 --threads 1,2,4 --gemm-blocks 0,32,64,128,256\n"
+		<< "              --row-blocks 8,16,32,64,128 --min-batch 16 --max-batch 256 --trial-seconds 0.5 --out <path>\n";
+}
+
+// tuning is null if this host has not been tuned
+static int RunMode(int argc, char** argv, const util::HostTuning* tuning)
+{
+	std::string mode = argv[1];
+	util::Options opt{ argc, argv, 2 };
+
+	if (mode == "train")
+	{
+		util::TrainConfig cfg;
+		if (!util::TrainConfig::FromOptions(opt, cfg))
+		{
+			return 1;
+		}
+		if (tuning && tuning->layers == cfg.layers)
+		{
+			cfg.batchSize = opt.Has("batch") ? cfg.batchSize : tuning->batchSize;
+			cfg.threads = opt.Has("threads") ? cfg.threads : tuning->threads;
+		}
+		return util::TrainDriver{ cfg }.Run();
+	}
+
+	if (mode == "train-stream")
+	{
+		util::StreamConfig cfg;
+		cfg.layers = opt.GetIntList("layers", cfg.layers);
+		cfg.batchSize = opt.GetInt("batch", cfg.batchSize);
+		cfg.learnRate = opt.GetDouble("lr", cfg.learnRate);
+		cfg.epochs = opt.GetInt("epochs", cfg.epochs);
+		cfg.memoryBudgetMb = (std::size_t)std::max(1, opt.GetInt("memory-mb", (int)cfg.memoryBudgetMb));
+		cfg.windowChunks = opt.GetInt("window-chunks", cfg.windowChunks);
+		cfg.augment = opt.GetFlag("augment");
+		cfg.readOnly = opt.GetFlag("read-only");
+		cfg.evalSamples = opt.GetInt("eval-samples", cfg.evalSamples);
+		cfg.reportSeconds = opt.GetDouble("report-seconds", cfg.reportSeconds);
+		cfg.loadPath = opt.Get("load", cfg.loadPath);
+		cfg.savePath = opt.Get("save", cfg.savePath);
+		cfg.trainImages = opt.Get("train-images", cfg.trainImages);
+		cfg.trainLabels = opt.Get("train-labels", cfg.trainLabels);
+		cfg.testImages = opt.Get("test-images", cfg.testImages);
+		cfg.testLabels = opt.Get("test-labels", cfg.testLabels);
+		if (!net::actf::FromString(opt.Get("hidden", "relu"), cfg.hiddenActiv) || !net::actf::FromString(opt.Get("output", "softmax"), cfg.outputActiv))
+		{
+			std::cout << "Unknown activation, expected sigmoid, relu or softmax\n";
+			return 1;
+		}
+		if (!opt.Valid() || cfg.layers.size() < 2 || cfg.layers.front() != 784 || cfg.layers.back() != 10 || cfg.batchSize <= 0 || cfg.epochs <= 0
+			|| cfg.windowChunks <= 0)
+		{
+			PrintUsage();
+			return 1;
+		}
+		util::InstallStopHandler();
+		return util::StreamingTrainer{ cfg }.Run();
+	}
+
+	if (mode == "gen-idx")
+	{
+		long long count = std::atoll(opt.Get("count", "1000000").c_str());
+		int threads = opt.GetInt("threads", (int)std::max(1u, std::thread::hardware_concurrency()));
+		if (!opt.Valid() || count <= 0 || threads <= 0 || !opt.Has("images") || !opt.Has("labels"))
+		{
+			PrintUsage();
+			return 1;
+		}
+		util::InstallStopHandler();
+		auto start = std::chrono::steady_clock::now();
+		if (!util::GenerateSyntheticIdx(opt.Get("images", ""), opt.Get("labels", ""), (std::uint64_t)count,
+			opt.GetFlag("test") ? util::DATATYPE::TEST : util::DATATYPE::TRAIN, threads))
+		{
+			return 1;
+		}
+		std::cout << "Wrote " << count << " samples in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s\n";
+		return 0;
+	}
+
+	if (mode == "serve")
+	{
+		util::BatchingPolicy policy;
+		policy.maxBatch = opt.GetInt("max-batch", policy.maxBatch);
+		policy.maxWaitUs = opt.GetInt("max-wait-us", policy.maxWaitUs);
+		double reportInterval = opt.GetDouble("report-interval", 5.0);
+		if (!opt.Valid() || (!opt.Has("socket") && !opt.GetFlag("stdin")))
+		{
+			PrintUsage();
+			return 1;
+		}
+		return util::Serve(opt.Get("model", "save.txt"), opt.Get("socket", ""), opt.GetFlag("stdin"), policy, reportInterval,
+			opt.Get("cascade", ""), opt.GetDouble("threshold", 1.0), (std::size_t)std::max(0, opt.GetInt("cache", 0)), opt.GetFlag("watch"));
+	}
+
+	if (mode == "classify")
+	{
+		util::ClassifyConfig cfg;
+		cfg.ioWorkers = opt.GetInt("workers", cfg.ioWorkers);
+		cfg.batchSize = opt.GetInt("batch", cfg.batchSize);
+		if (!opt.Valid() || !opt.Has("input") || cfg.ioWorkers <= 0 || cfg.batchSize <= 0)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		net::Network model{ opt.Get("model", "save.txt") };
+		if (!model.IsLoaded())
+		{
+			return 1;
+		}
+
+		std::vector<std::string> files = util::ListImages(opt.Get("input", ""));
+		std::string outPath = opt.Get("output", "results.csv");
+		std::ofstream out(outPath);
+		if (!out)
+		{
+			std::cout << "Could not open " << outPath << '\n';
+			return 1;
+		}
+
+		util::BatchClassifier classifier{ model, cfg };
+		classifier.Run(files, out);
+		std::cout << "Classified " << classifier.GetProcessed() << " images (" << classifier.GetFailed() << " failed) in "
+			<< classifier.GetSeconds() << "s, " << classifier.GetProcessed() / std::max(classifier.GetSeconds(), 1e-9) << " images/s\n";
+		return 0;
+	}
+
+	if (mode == "gradcheck")
+	{
+		net::GradientCheckConfig cfg;
+		cfg.parameters = opt.GetInt("parameters", cfg.parameters);
+		cfg.epsilon = opt.GetDouble("eps", cfg.epsilon);
+		cfg.threads = opt.GetInt("threads", cfg.threads);
+		cfg.seed = (unsigned int)opt.GetInt("seed", (int)cfg.seed);
+		int batch = opt.GetInt("batch", 32);
+		double tolerance = opt.GetDouble("tolerance", -1.0);
+
+		net::actf::ACTIVATION_TYPE hidden, output;
+		if (!opt.Valid() || batch <= 0 || !net::actf::FromString(opt.Get("hidden", "relu"), hidden) || !net::actf::FromString(opt.Get("output", "softmax"), output))
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		net::Network model{ opt.GetIntList("layers", { 784, 256, 256, 10 }), hidden, output };
+		if (opt.Has("model"))
+		{
+			model = net::Network{ opt.Get("model", "") };
+			if (!model.IsLoaded())
+			{
+				return 1;
+			}
+		}
+
+		util::MNISTReader reader(opt.Get("test-images", "t10k-images.idx3-ubyte"), opt.Get("test-labels", "t10k-labels.idx1-ubyte"));
+		std::vector<util::DataPoint<double>> data = reader.GetData(util::DATATYPE::TEST);
+		if (data.empty() || data[0].input.GetSize() != model.GetInputSize() || model.GetOutputSize() != 10)
+		{
+			std::cout << "Using random inputs\n";
+			data.clear();
+			std::mt19937 rng(cfg.seed);
+			std::uniform_real_distribution<double> pixel(0.0, 1.0);
+			for (int i = 0; i < batch; i++)
+			{
+				util::DataPoint<double> dp;
+				dp.input = util::Matrix<double>{ {}, 1, model.GetInputSize() };
+				for (double& v : dp.input.GetValues())
+				{
+					v = pixel(rng);
+				}
+				dp.label = (double)(i % model.GetOutputSize());
+				dp.expected = util::Matrix<double>{ {}, 1, model.GetOutputSize() };
+				dp.expected[i % model.GetOutputSize()] = 1.0;
+				data.push_back(dp);
+			}
+		}
+		data.resize(std::min<std::size_t>(data.size(), batch));
+
+		net::GradientCheckResult res = net::GradientChecker{ model, cfg }.Run(data);
+		std::cout << "Checked " << res.checked << " parameters on " << data.size() << " samples in " << res.seconds << "s\n"
+			<< "max relative error " << res.maxRelError << ", mean relative error " << res.meanRelError << '\n'
+			<< "worst: layer " << res.worstLayer << (res.worstIsBias ? " bias " : " weight ") << res.worstIndex
+			<< " analytic " << res.worstAnalytic << " numeric " << res.worstNumeric << '\n';
+
+		if (tolerance >= 0.0 && res.maxRelError > tolerance)
+		{
+			std::cout << "FAILED: max relative error above " << tolerance << '\n';
+			return 2;
+		}
+		return 0;
+	}
+
+	if (mode == "bench-e2e")
+	{
+		util::BenchmarkConfig cfg;
+		cfg.layers = opt.GetIntList("layers", cfg.layers);
+		cfg.target = opt.GetDouble("target", cfg.target);
+		cfg.maxEpochs = opt.GetInt("max-epochs", cfg.maxEpochs);
+		cfg.batchSize = opt.GetInt("batch", cfg.batchSize);
+		cfg.learnRate = opt.GetDouble("lr", cfg.learnRate);
+		cfg.seed = (std::uint64_t)opt.GetInt("seed", (int)cfg.seed);
+		cfg.evalInterval = opt.GetInt("eval-interval", cfg.evalInterval);
+		cfg.evalSamples = opt.GetInt("eval-samples", cfg.evalSamples);
+		cfg.forceSynthetic = opt.GetFlag("synthetic");
+		cfg.syntheticTrain = opt.GetInt("synthetic-train", cfg.syntheticTrain);
+		cfg.syntheticTest = opt.GetInt("synthetic-test", cfg.syntheticTest);
+		cfg.trainImages = opt.Get("train-images", cfg.trainImages);
+		cfg.trainLabels = opt.Get("train-labels", cfg.trainLabels);
+		cfg.testImages = opt.Get("test-images", cfg.testImages);
+		cfg.testLabels = opt.Get("test-labels", cfg.testLabels);
+		double tolerance = opt.GetDouble("tolerance", 0.1);
+		std::string baseline = opt.Get("baseline", "");
+		bool writeBaseline = opt.GetFlag("write-baseline");
+		if (!opt.Valid() || cfg.layers.size() < 2 || cfg.layers.front() != 784 || cfg.layers.back() != 10 || cfg.batchSize <= 0
+			|| cfg.maxEpochs <= 0 || cfg.syntheticTrain <= 0 || cfg.syntheticTest <= 0 || tolerance < 0.0 || (writeBaseline && baseline.empty()))
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		util::InstallStopHandler();
+		util::BenchmarkResult result = util::EndToEndBenchmark{ cfg }.Run();
+		util::PrintBenchmark(result);
+		if (baseline.empty())
+		{
+			return 0;
+		}
+		if (writeBaseline)
+		{
+			if (!result.Save(baseline))
+			{
+				std::cout << "Could not write " << baseline << '\n';
+				return 1;
+			}
+			std::cout << "Baseline written to " << baseline << '\n';
+			return 0;
+		}
+		util::BenchmarkResult base;
+		if (!base.Load(baseline))
+		{
+			std::cout << "Could not read baseline " << baseline << '\n';
+			return 1;
+		}
+		return util::CompareBenchmark(result, base, tolerance) ? 0 : 1;
+	}
+
+	if (mode == "bench-static")
+	{
+		int iterations = opt.GetInt("iterations", 2000);
+		if (!opt.Valid() || iterations <= 0)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		net::Network model{ opt.Get("model", "save.txt") };
+		if (!model.IsLoaded())
+		{
+			return 1;
+		}
+		std::unique_ptr<net::MNISTStaticNetwork> fixed = net::MNISTStaticNetwork::Create();
+		if (!fixed->Load(model))
+		{
+			std::cout << "Model is not a 784-256-256-10 relu/softmax network\n";
+			return 1;
+		}
+
+		std::mt19937 rng(1);
+		std::uniform_real_distribution<double> pixel(0.0, 1.0);
+		std::vector<util::Matrix<double>> inputs(64, util::Matrix<double>{ {}, 1, 784 });
+		for (util::Matrix<double>& in : inputs)
+		{
+			for (double& v : in.GetValues())
+			{
+				v = pixel(rng) < 0.8 ? 0.0 : pixel(rng);
+			}
+		}
+
+		double maxDiff = 0.0;
+		for (util::Matrix<double>& in : inputs)
+		{
+			util::Matrix<double> a = model.Feed(in);
+			util::Matrix<double> b = fixed->Feed(in);
+			for (int i = 0; i < 10; i++)
+			{
+				maxDiff = std::max(maxDiff, std::abs(a[i] - b[i]));
+			}
+		}
+
+		volatile double sink = 0.0; // keeps the timed calls from being optimised out
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++)
+		{
+			sink = sink + model.Feed(inputs[i % inputs.size()])[0];
+		}
+		double dynamicUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+		double out[10];
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++)
+		{
+			fixed->Feed(inputs[i % inputs.size()].GetValues().data(), out);
+			sink = sink + out[0];
+		}
+		double staticUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+		std::cout << "Network:       " << dynamicUs << " us/inference\n"
+			<< "StaticNetwork: " << staticUs << " us/inference (" << dynamicUs / staticUs << "x)\n"
+			<< "max output difference " << maxDiff << '\n';
+		return 0;
+	}
+
+	if (mode == "train-dist")
+	{
+		util::DistConfig cfg;
+		std::vector<int> procs = opt.GetIntList("procs", { 2 });
+		cfg.transport = opt.Get("transport", cfg.transport);
+		cfg.basePort = opt.GetInt("port", cfg.basePort);
+		cfg.compress = opt.GetFlag("fp16");
+		cfg.maxSteps = opt.GetInt("steps", cfg.maxSteps);
+		if (!util::TrainConfig::FromOptions(opt, cfg.train) || procs.empty() || (cfg.transport != "shm" && cfg.transport != "tcp"))
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		std::cout << "Loading...\n";
+		util::MNISTReader train_reader(cfg.train.trainImages, cfg.train.trainLabels);
+		std::vector<util::DataPoint<double>> train_data = train_reader.GetData(util::DATATYPE::TRAIN);
+		if (train_data.empty())
+		{
+			return 1;
+		}
+
+		net::Network model{ cfg.train.layers, cfg.train.hiddenActiv, cfg.train.outputActiv };
+		if (!cfg.train.loadPath.empty())
+		{
+			model = net::Network{ cfg.train.loadPath };
+			if (!model.IsLoaded())
+			{
+				return 1;
+			}
+		}
+		// every rank gets a copy of the model, a mismatch would fail in all of them at once
+		if (!model.MatchesData(train_data[0].input.GetSize(), train_data[0].expected.GetSize()))
+		{
+			return 1;
+		}
+		if (procs.size() > 1)
+		{
+			cfg.train.savePath.clear();
+		}
+
+		util::InstallStopHandler();
+		std::cout << "procs  transport  samples/s  speedup  allreduce  steps  replicas\n";
+		double base = 0.0;
+		int rc = 0;
+		for (int p : procs)
+		{
+			if (p <= 0 || util::StopRequested())
+			{
+				continue;
+			}
+			cfg.ranks = p;
+			util::DistResult res;
+			bool ok = util::LaunchDistributed(cfg, model, train_data, res);
+			if (base == 0.0)
+			{
+				base = res.samplesPerSecond;
+			}
+			std::cout << std::fixed << std::setprecision(1)
+				<< std::setw(5) << p << "  " << std::setw(9) << (cfg.transport + (cfg.compress ? "/16" : "")) << "  "
+				<< std::setw(9) << res.samplesPerSecond << "  " << std::setprecision(2) << std::setw(6) << (base > 0.0 ? res.samplesPerSecond / base : 0.0) << "x  "
+				<< std::setw(8) << (res.seconds > 0.0 ? res.allreduceSeconds / res.seconds * 100.0 : 0.0) << "%  "
+				<< std::setw(5) << res.steps << "  " << (!ok ? "failed" : res.inSync ? "in sync" : "DIVERGED")
+				<< (res.saveFailed ? ", not saved" : "") << '\n'
+				<< std::defaultfloat << std::setprecision(6);
+			rc = ok && res.inSync && !res.saveFailed ? rc : 1;
+		}
+		return rc;
+	}
+
+	if (mode == "online")
+	{
+		util::OnlineConfig cfg;
+		cfg.batchSize = opt.GetInt("batch", cfg.batchSize);
+		cfg.maxWaitMs = opt.GetInt("max-wait-ms", cfg.maxWaitMs);
+		cfg.learnRate = opt.GetDouble("lr", cfg.learnRate);
+		cfg.replayCapacity = opt.GetInt("replay", cfg.replayCapacity);
+		cfg.replayRatio = opt.GetDouble("replay-ratio", cfg.replayRatio);
+		cfg.checkpointSeconds = opt.GetDouble("checkpoint-seconds", cfg.checkpointSeconds);
+		cfg.reportSeconds = opt.GetDouble("report-seconds", cfg.reportSeconds);
+		cfg.savePath = opt.Get("save", cfg.savePath);
+		cfg.follow = opt.GetFlag("follow");
+		if (!opt.Valid() || !opt.Has("input") || cfg.batchSize <= 0 || cfg.maxWaitMs < 0 || cfg.replayCapacity < 0 || cfg.learnRate <= 0.0)
+		{
+			PrintUsage();
+			return 1;
+		}
+		return util::RunOnline(opt.Get("model", "save.txt"), opt.Get("input", "-"), cfg);
+	}
+
+	if (mode == "sweep")
+	{
+		util::SweepConfig cfg;
+		if (opt.Has("layers"))
+		{
+			cfg.layers.clear();
+			std::stringstream list(opt.Get("layers", ""));
+			std::string item;
+			while (std::getline(list, item, '/'))
+			{
+				std::vector<int> sizes;
+				std::stringstream ss(item);
+				std::string n;
+				while (std::getline(ss, n, ','))
+				{
+					sizes.push_back(std::atoi(n.c_str()));
+				}
+				cfg.layers.push_back(sizes);
+			}
+		}
+		cfg.learnRates = opt.GetDoubleList("lr", cfg.learnRates);
+		cfg.batchSizes = opt.GetIntList("batch", cfg.batchSizes);
+		cfg.threads = opt.GetInt("threads", cfg.threads);
+		cfg.rungSamples = opt.GetInt("budget", (int)cfg.rungSamples);
+		cfg.eta = opt.GetDouble("eta", cfg.eta);
+		cfg.rungs = opt.GetInt("rungs", cfg.rungs);
+		cfg.evalSamples = opt.GetInt("eval-samples", cfg.evalSamples);
+		cfg.output = opt.Get("csv", cfg.output);
+		bool valid = opt.Valid() && cfg.eta > 1.0 && cfg.rungs > 0 && cfg.rungSamples > 0 &&
+			net::actf::FromString(opt.Get("hidden", "relu"), cfg.hiddenActiv) && net::actf::FromString(opt.Get("output", "softmax"), cfg.outputActiv);
+		for (const std::vector<int>& l : cfg.layers)
+		{
+			valid = valid && l.size() >= 2 && *std::min_element(l.begin(), l.end()) > 0;
+		}
+		for (int b : cfg.batchSizes)
+		{
+			valid = valid && b > 0;
+		}
+		if (!valid || cfg.layers.empty() || cfg.learnRates.empty() || cfg.batchSizes.empty())
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		std::cout << "Loading...\n";
+		util::MNISTReader train_reader(opt.Get("train-images", "train-images.idx3-ubyte"), opt.Get("train-labels", "train-labels.idx1-ubyte"));
+		util::MNISTReader test_reader(opt.Get("test-images", "t10k-images.idx3-ubyte"), opt.Get("test-labels", "t10k-labels.idx1-ubyte"));
+		std::vector<util::DataPoint<double>> test_data = test_reader.GetData(util::DATATYPE::TEST);
+		util::SharedDataset data{ train_reader.GetData(util::DATATYPE::TRAIN), test_data, cfg.evalSamples };
+		if (data.train.empty() || data.testLabels.empty())
+		{
+			return 1;
+		}
+		for (const std::vector<int>& l : cfg.layers)
+		{
+			if (l.front() != data.testInputs.GetColumns() || l.back() != 10)
+			{
+				std::cout << "Every layer list must start with " << data.testInputs.GetColumns() << " inputs and end with 10 outputs\n";
+				return 1;
+			}
+		}
+
+		util::InstallStopHandler();
+		return util::SweepRunner{ cfg, data }.Run();
+	}
+
+	if (mode == "cascade")
+	{
+		double target = opt.GetDouble("target", 0.98);
+		double split = opt.GetDouble("calibration-split", 0.5);
+		if (!opt.Valid() || !opt.Has("small") || target <= 0.0 || target > 1.0 || split <= 0.0 || split >= 1.0)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		net::Network small{ opt.Get("small", "small.txt") };
+		net::Network large{ opt.Get("model", "save.txt") };
+		if (!small.IsLoaded() || !large.IsLoaded())
+		{
+			return 1;
+		}
+		if (small.GetInputSize() != large.GetInputSize() || small.GetOutputSize() != large.GetOutputSize())
+		{
+			std::cout << "The small and the full model need the same inputs and outputs\n";
+			return 1;
+		}
+
+		util::MNISTReader test_reader(opt.Get("test-images", "t10k-images.idx3-ubyte"), opt.Get("test-labels", "t10k-labels.idx1-ubyte"));
+		std::vector<util::DataPoint<double>> test_data = test_reader.GetData(util::DATATYPE::TEST);
+		if (test_data.size() < 2)
+		{
+			return 1;
+		}
+
+		// the threshold is picked on the first part and reported on the rest, so the report is not tuned to its own data
+		int n_cal = std::max(1, std::min((int)test_data.size() - 1, (int)(split * test_data.size())));
+		auto toMatrix = [&](int begin, int end, std::vector<int>& labels)
+		{
+			const int cols = small.GetInputSize();
+			util::Matrix<double> m{ {}, end - begin, cols };
+			for (int r = begin; r < end; r++)
+			{
+				std::copy(test_data[r].input.GetValues().begin(), test_data[r].input.GetValues().end(), m.GetValues().begin() + (std::size_t)(r - begin) * cols);
+				labels.push_back((int)test_data[r].label);
+			}
+			return m;
+		};
+		std::vector<int> cal_labels, eval_labels;
+		util::Matrix<double> cal = toMatrix(0, n_cal, cal_labels);
+		util::Matrix<double> eval = toMatrix(n_cal, (int)test_data.size(), eval_labels);
+
+		net::CascadeCalibration c = net::CalibrateCascade(small, large, cal, cal_labels, target);
+		if (!c.reached)
+		{
+			std::cout << "No threshold reaches the target, using the most accurate one\n";
+		}
+		std::cout << "threshold " << c.threshold << " | calibration (" << cal.GetRows() << "): accuracy " << c.accuracy * 100.0
+			<< "% early exits " << c.exitFraction * 100.0 << "%\n";
+
+		net::Cascade cascade{ small, large, c.threshold };
+		net::CascadeReport r = net::EvaluateCascade(cascade, small, large, eval, eval_labels);
+		std::cout << "held out (" << eval.GetRows() << "): cascade " << r.accuracy * 100.0 << "% | small " << r.smallAccuracy * 100.0
+			<< "% | full " << r.largeAccuracy * 100.0 << "%\n"
+			<< "early exits " << r.exitFraction * 100.0 << "% | latency cascade " << r.cascadeLatencyUs << "us full " << r.largeLatencyUs
+			<< "us (" << (r.cascadeLatencyUs > 0.0 ? r.largeLatencyUs / r.cascadeLatencyUs : 0.0) << "x)\n";
+		return 0;
+	}
+
+	if (mode == "prune")
+	{
+		net::PruneConfig cfg;
+		cfg.sparsity = opt.GetDoubleList("sparsity", cfg.sparsity);
+		cfg.neuronFraction = opt.GetDouble("neurons", cfg.neuronFraction);
+		cfg.finetuneEpochs = opt.GetInt("finetune-epochs", cfg.finetuneEpochs);
+		cfg.learnRate = opt.GetDouble("lr", cfg.learnRate);
+		cfg.batchSize = opt.GetInt("batch", cfg.batchSize);
+		std::sort(cfg.sparsity.begin(), cfg.sparsity.end());
+		if (!opt.Valid() || cfg.batchSize <= 0 || cfg.neuronFraction < 0.0 || cfg.neuronFraction >= 1.0)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		net::Network model{ opt.Get("model", "save.txt") };
+		if (!model.IsLoaded())
+		{
+			return 1;
+		}
+
+		util::MNISTReader test_reader(opt.Get("test-images", "t10k-images.idx3-ubyte"), opt.Get("test-labels", "t10k-labels.idx1-ubyte"));
+		std::vector<util::DataPoint<double>> test_data = test_reader.GetData(util::DATATYPE::TEST);
+		std::vector<util::DataPoint<double>> train_data;
+		if (cfg.finetuneEpochs > 0)
+		{
+			util::MNISTReader train_reader(opt.Get("train-images", "train-images.idx3-ubyte"), opt.Get("train-labels", "train-labels.idx1-ubyte"));
+			train_data = train_reader.GetData(util::DATATYPE::TRAIN);
+		}
+		if (test_data.empty() || !model.MatchesData(test_data[0].input.GetSize(), test_data[0].expected.GetSize()))
+		{
+			return 1;
+		}
+
+		net::Network pruned = net::Pruner{ cfg, train_data, test_data }.Run(model);
+		if (opt.Has("out") && !pruned.Save(opt.Get("out", "pruned.txt")))
+		{
+			return 1;
+		}
+		return 0;
+	}
+
+	if (mode == "lowrank")
+	{
+		net::LowRankConfig cfg;
+		cfg.ranks = opt.GetIntList("ranks", cfg.ranks);
+		cfg.finetuneEpochs = opt.GetInt("finetune-epochs", cfg.finetuneEpochs);
+		cfg.learnRate = opt.GetDouble("lr", cfg.learnRate);
+		cfg.batchSize = opt.GetInt("batch", cfg.batchSize);
+		std::sort(cfg.ranks.rbegin(), cfg.ranks.rend());
+		if (!opt.Valid() || cfg.batchSize <= 0 || cfg.ranks.empty() || cfg.ranks.back() <= 0)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		net::Network model{ opt.Get("model", "save.txt") };
+		if (!model.IsLoaded())
+		{
+			return 1;
+		}
+
+		util::MNISTReader test_reader(opt.Get("test-images", "t10k-images.idx3-ubyte"), opt.Get("test-labels", "t10k-labels.idx1-ubyte"));
+		std::vector<util::DataPoint<double>> test_data = test_reader.GetData(util::DATATYPE::TEST);
+		std::vector<util::DataPoint<double>> train_data;
+		if (cfg.finetuneEpochs > 0)
+		{
+			util::MNISTReader train_reader(opt.Get("train-images", "train-images.idx3-ubyte"), opt.Get("train-labels", "train-labels.idx1-ubyte"));
+			train_data = train_reader.GetData(util::DATATYPE::TRAIN);
+		}
+		if (test_data.empty() || !model.MatchesData(test_data[0].input.GetSize(), test_data[0].expected.GetSize()))
+		{
+			return 1;
+		}
+
+		net::Network compressed = net::LowRankCompressor{ cfg, train_data, test_data }.Run(model);
+		if (opt.Has("out") && !compressed.Save(opt.Get("out", "lowrank.txt")))
+		{
+			return 1;
+		}
+		return 0;
+	}
+
+	if (mode == "export")
+	{
+		std::string modelPath = opt.Get("model", "save.txt");
+		std::string out = opt.Get("out", "model.h");
+		std::string name = opt.Get("name", "digits");
+		std::string check = opt.Get("check", "");
+		int probes = opt.GetInt("probes", 16);
+		double tolerance = opt.GetDouble("tolerance", 1e-9);
+		if (!opt.Valid() || name.empty() || probes <= 0 || tolerance < 0.0)
+		{
+			PrintUsage();
+			return 1;
+		}
+		if (!net::HeaderExporter::IsValidName(name))
+		{
+			std::cout << "--name " << name << " is not a C++ identifier or is a keyword\n";
+			return 1;
+		}
+
+		net::Network model{ modelPath };
+		if (!model.IsLoaded())
+		{
+			return 1;
+		}
+
+		net::HeaderExporter exporter{ model, name };
+		if (!exporter.WriteHeader(out, modelPath))
+		{
+			std::cout << "Could not write " << out << '\n';
+			return 1;
+		}
+		std::cout << "Wrote " << out << '\n';
+		if (!check.empty())
+		{
+			// the check includes the header by its file name, so keep both in one directory
+			std::string include = out.substr(out.find_last_of("/\\") + 1);
+			if (!exporter.WriteCheck(check, include, probes, tolerance))
+			{
+				std::cout << "Could not write " << check << '\n';
+				return 1;
+			}
+			std::cout << "Wrote " << check << '\n';
+		}
+		return 0;
+	}
+
+	if (mode == "finetune")
+	{
+		net::FineTuneConfig cfg;
+		cfg.freeze = opt.GetInt("freeze", cfg.freeze);
+		cfg.epochs = opt.GetInt("epochs", cfg.epochs);
+		cfg.learnRate = opt.GetDouble("lr", cfg.learnRate);
+		cfg.batchSize = opt.GetInt("batch", cfg.batchSize);
+		cfg.cache = !opt.GetFlag("no-cache");
+		std::string savePath = opt.Get("save", "finetuned.txt");
+		if (!opt.Valid() || cfg.epochs <= 0 || cfg.batchSize <= 0 || cfg.learnRate <= 0.0)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		net::Network model{ opt.Get("model", "save.txt") };
+		if (!model.IsLoaded())
+		{
+			return 1;
+		}
+
+		util::MNISTReader train_reader(opt.Get("train-images", "train-images.idx3-ubyte"), opt.Get("train-labels", "train-labels.idx1-ubyte"));
+		std::vector<util::DataPoint<double>> train_data = train_reader.GetData(util::DATATYPE::TRAIN);
+		util::MNISTReader test_reader(opt.Get("test-images", "t10k-images.idx3-ubyte"), opt.Get("test-labels", "t10k-labels.idx1-ubyte"));
+		std::vector<util::DataPoint<double>> test_data = test_reader.GetData(util::DATATYPE::TEST);
+		if (train_data.empty() || test_data.empty() || !model.MatchesData(train_data[0].input.GetSize(), train_data[0].expected.GetSize()))
+		{
+			return 1;
+		}
+
+		net::FineTuner{ cfg, train_data, test_data }.Run(model);
+		if (!model.Save(savePath))
+		{
+			return 1;
+		}
+		std::cout << "Saved to " << savePath << '\n';
+		return 0;
+	}
+
+	if (mode == "autotune")
+	{
+		util::AutotuneConfig cfg;
+		cfg.layers = opt.GetIntList("layers", cfg.layers);
+		cfg.batchSizes = opt.GetIntList("batch", cfg.batchSizes);
+		cfg.threads = opt.GetIntList("threads", cfg.threads);
+		cfg.gemmBlocks = opt.GetIntList("gemm-blocks", cfg.gemmBlocks);
+		cfg.rowBlocks = opt.GetIntList("row-blocks", cfg.rowBlocks);
+		cfg.minBatch = opt.GetInt("min-batch", cfg.minBatch);
+		cfg.maxBatch = opt.GetInt("max-batch", cfg.maxBatch);
+		cfg.trialSeconds = opt.GetDouble("trial-seconds", cfg.trialSeconds);
+		cfg.outPath = opt.Get("out", util::HostTuningPath());
+		auto allAtLeast = [](const std::vector<int>& values, int min)
+		{
+			return std::all_of(values.begin(), values.end(), [min](int v) { return v >= min; });
+		};
+		if (!opt.Valid() || cfg.layers.size() < 2 || cfg.layers.front() != 784 || cfg.batchSizes.empty() || cfg.gemmBlocks.empty()
+			|| cfg.rowBlocks.empty() || cfg.trialSeconds <= 0.0 || !allAtLeast(cfg.batchSizes, 1) || !allAtLeast(cfg.threads, 1)
+			|| !allAtLeast(cfg.gemmBlocks, 0) || !allAtLeast(cfg.rowBlocks, 0) || cfg.minBatch <= 0 || cfg.minBatch > cfg.maxBatch)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		util::HostTuning result;
+		if (!util::Autotuner{ cfg }.Run(result))
+		{
+			std::cout << "No batch size in [" << cfg.minBatch << ", " << cfg.maxBatch << "] with at least " << cfg.minSlice
+				<< " samples per thread was measured, " << cfg.outPath << " not written\n";
+			return 1;
+		}
+		if (!result.Save(cfg.outPath))
+		{
+			std::cout << "Could not write " << cfg.outPath << '\n';
+			return 1;
+		}
+		std::cout << "batch " << result.batchSize << ", " << result.threads << " thread(s), gemm block " << result.kernels.gemmBlock
+			<< ", row block " << result.kernels.rowBlock << " written to " << cfg.outPath << '\n';
+		return 0;
+	}
+
+	PrintUsage();
+	return mode == "help" || mode == "--help" ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	util::HostTuning tuning;
+	const bool tuned = util::LoadHostTuning(tuning);
+	if (argc > 1)
+	{
+		return RunMode(argc, argv, tuned ? &tuning : nullptr);
+	}
+
 	std::cout << "Loading...\n";
 
 	util::MNISTReader train_reader("train-images.idx3-ubyte", "train-labels.idx1-ubyte");
@@ -41,25 +872,38 @@ int main()
 		model = net::Network{ valuePath };
 	}
 
-	util::Trainer trainer{ 100, train_data, test_data };
+	const bool useTuning = tuned && tuning.layers == model.GetLayerSizes();
+	util::Trainer trainer{ useTuning ? tuning.batchSize : 100, train_data, test_data };
+	net::DataParallel parallel{ model, useTuning ? tuning.threads : 1 };
+	// only the training loop polls for Ctrl-C, the prompts before and after it keep the default handling
+	util::InstallStopHandler();
 	std::cout << "\n----STARTED----\n";
+
+	// per batch metrics go to metrics.csv, the console gets a summary every few seconds
+	util::MetricsConfig metricsConfig;
+	metricsConfig.csvPath = "metrics.csv";
+	metricsConfig.summarySeconds = 5.0;
+	util::MetricsLogger metrics{ metricsConfig };
 	for (int i = 0, tr_batch = 0, te_batch = 0, epoch = 0;; tr_batch++, te_batch++)
 	{
-		trainer.Train(model, 0.05, tr_batch);
+		auto start = std::chrono::steady_clock::now();
+		trainer.Train(parallel, 0.05, tr_batch);
+		auto end = std::chrono::steady_clock::now();
 		trainer.Test(model, te_batch);
 
-		std::cout << "\n-----------------------------------------------------------------------------------------\n";
-
-		std::cout << "Epoch: " << epoch << '\n';
-		std::cout << "Batch Epoch: " << i << "\n\n";
-
-		std::cout << "Train Accuracy: " << (net::cstf::Accuracy(trainer.GetTrainingDataBatches()[tr_batch]) * 100.0) << '%' << '\n';
-		std::cout << "Test Accuracy: " << (net::cstf::Accuracy(trainer.GetTestDataBatches()[te_batch]) * 100.0) << '%' << "\n\n";
-
-		std::cout << "Train Cost: " << COST(trainer.GetTrainingDataBatches()[tr_batch]) << '\n';
-		std::cout << "Test Cost: " << COST(trainer.GetTestDataBatches()[te_batch]) << '\n';
-
-		std::cout << "-----------------------------------------------------------------------------------------\n";
+		const std::vector<util::DataPoint<double>>& tr = trainer.GetTrainingDataBatches()[tr_batch];
+		const std::vector<util::DataPoint<double>>& te = trainer.GetTestDataBatches()[te_batch];
+		util::MetricRecord r;
+		r.epoch = epoch;
+		r.step = i;
+		r.trainLoss = COST(tr);
+		r.trainAccuracy = net::cstf::Accuracy(tr);
+		r.testLoss = COST(te);
+		r.testAccuracy = net::cstf::Accuracy(te);
+		r.testSamples = (int)te.size();
+		r.stepSeconds = std::chrono::duration<double>(end - start).count();
+		r.samplesPerSecond = (double)tr.size() / r.stepSeconds;
+		metrics.Push(r);
 
 		if (te_batch == trainer.GetTestDataBatches().size() - 1)
 		{
@@ -77,12 +921,16 @@ int main()
 
 		if (i % 500 == 0)
 		{
-			std::cout << "\nSaving...\n\n";
 			model.Save("save.txt");
 		}
 
+#ifdef _WIN32
 		if (_kbhit()) break;
+#endif
+		if (util::StopRequested()) break;
 	}	
+	metrics.Close();
+	util::RestoreDefaultSignals();
 
 	model.Save("save.txt");
 
@@ -97,7 +945,12 @@ int main()
 			std::cout << "Bitmap / Dataset (b/d): ";
 			std::cin >> choice;
 			std::cout << '\n';
-		} while (!(choice == "b" || choice == "d"));
+		} while (!(choice == "b" || choice == "d") && std::cin);
+
+		if (!std::cin)
+		{
+			break;
+		}
 
 		util::DataPoint<double> data;
 
@@ -115,6 +968,10 @@ int main()
 			std::cin >> path;
 			std::cout << '\n';
 			data = util::MNISTReader::ReadBitmap(path);
+			if (data.input.GetSize() == 0)
+			{
+				continue;
+			}
 		}
 
 		std::cout << "label: " << data.label << '\n';
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+namespace util
+{
+	static constexpr std::size_t MATRIX_ALIGNMENT = 64;     // one cache line, enough for any SIMD width
+	static constexpr std::size_t MATRIX_INLINE_CAPACITY = 16; // 1x10 outputs, labels and biases of the output layer stay inline
+
+	// allocator for std::vector when a buffer outside of Matrix needs the same alignment
+	template<typename T>
+	struct AlignedAllocator
+	{
+		using value_type = T;
+
+		AlignedAllocator() = default;
+		template<typename U>
+		AlignedAllocator(const AlignedAllocator<U>&) {}
+
+		T* allocate(std::size_t n)
+		{
+			return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(MATRIX_ALIGNMENT)));
+		}
+		void deallocate(T* p, std::size_t)
+		{
+			::operator delete(p, std::align_val_t(MATRIX_ALIGNMENT));
+		}
+
+		template<typename U>
+		bool operator==(const AlignedAllocator<U>&) const { return true; }
+		template<typename U>
+		bool operator!=(const AlignedAllocator<U>&) const { return false; }
+	};
+
+	// value storage of Matrix, vector-like but with three modes:
+	// INLINE  up to INLINE_CAP values in the object itself, no allocation
+	// HEAP    MATRIX_ALIGNMENT aligned allocation
+	// VIEW    non-owning window over an external buffer, its size is fixed
+	// copying always produces owning storage, assigning to a view of the same size writes through to the viewed buffer
+	template<typename T, std::size_t INLINE_CAP = MATRIX_INLINE_CAPACITY>
+	class MatrixStorage
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "matrix values are copied with std::copy into raw memory");
+	public:
+		using value_type = T;
+		using iterator = T*;
+		using const_iterator = const T*;
+
+		MatrixStorage() = default;
+		MatrixStorage(const MatrixStorage& other)
+		{
+			assign(other.begin(), other.end());
+		}
+		MatrixStorage(MatrixStorage&& other) noexcept
+		{
+			Steal(other);
+		}
+		~MatrixStorage()
+		{
+			Release();
+		}
+
+		MatrixStorage& operator=(const MatrixStorage& other)
+		{
+			if (this != &other)
+			{
+				assign(other.begin(), other.end());
+			}
+			return *this;
+		}
+		MatrixStorage& operator=(MatrixStorage&& other) noexcept
+		{
+			if (this == &other)
+			{
+				return *this;
+			}
+			if (mode == MODE::VIEW && other.n == n)
+			{
+				std::copy(other.begin(), other.end(), begin());
+				return *this;
+			}
+			Release();
+			Steal(other);
+			return *this;
+		}
+
+		static MatrixStorage View(T* data, std::size_t n)
+		{
+			MatrixStorage res;
+			res.mode = MODE::VIEW;
+			res.ptr = data;
+			res.n = n;
+			res.cap = n;
+			return res;
+		}
+
+		template<typename It>
+		void assign(It first, It last)
+		{
+			std::size_t count = (std::size_t)std::distance(first, last);
+			if (mode == MODE::VIEW && count != n)
+			{
+				Detach();
+			}
+			if (mode != MODE::VIEW)
+			{
+				Reserve(count, false);
+			}
+			std::copy(first, last, data());
+			n = count;
+		}
+
+		void resize(std::size_t count, T init = T())
+		{
+			if (count == n)
+			{
+				return;
+			}
+			assert(mode != MODE::VIEW && "a view cannot change size");
+			Reserve(count, true);
+			if (count > n)
+			{
+				std::fill(data() + n, data() + count, init);
+			}
+			n = count;
+		}
+
+		void clear()
+		{
+			if (mode == MODE::VIEW)
+			{
+				Detach();
+			}
+			n = 0;
+		}
+
+		T* data() { return ptr; }
+		const T* data() const { return ptr; }
+		T* begin() { return data(); }
+		T* end() { return data() + n; }
+		const T* begin() const { return data(); }
+		const T* end() const { return data() + n; }
+		std::size_t size() const { return n; }
+		bool empty() const { return n == 0; }
+
+		T& operator[](std::size_t i) { return data()[i]; }
+		const T& operator[](std::size_t i) const { return data()[i]; }
+
+		bool operator==(const MatrixStorage& rhs) const
+		{
+			return n == rhs.n && std::equal(begin(), end(), rhs.begin());
+		}
+		bool operator!=(const MatrixStorage& rhs) const
+		{
+			return !(*this == rhs);
+		}
+
+		bool IsView() const { return mode == MODE::VIEW; }
+		bool IsInline() const { return mode == MODE::INLINE; }
+	private:
+		enum class MODE
+		{
+			INLINE,
+			HEAP,
+			VIEW
+		};
+
+		// makes room for count values, keeping the current ones if keep is set
+		void Reserve(std::size_t count, bool keep)
+		{
+			if (count <= Capacity())
+			{
+				return;
+			}
+			T* mem = static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(MATRIX_ALIGNMENT)));
+			if (keep)
+			{
+				std::copy(begin(), end(), mem);
+			}
+			Release();
+			mode = MODE::HEAP;
+			ptr = mem;
+			cap = count;
+		}
+
+		// turns a view into owning storage with a copy of the viewed values
+		void Detach()
+		{
+			T* viewed = ptr;
+			std::size_t count = n;
+			mode = MODE::INLINE;
+			ptr = local;
+			cap = 0;
+			n = 0;
+			Reserve(count, false);
+			std::copy(viewed, viewed + count, data());
+			n = count;
+		}
+
+		std::size_t Capacity() const
+		{
+			return mode == MODE::INLINE ? INLINE_CAP : cap;
+		}
+
+		void Release()
+		{
+			if (mode == MODE::HEAP)
+			{
+				::operator delete(ptr, std::align_val_t(MATRIX_ALIGNMENT));
+			}
+			mode = MODE::INLINE;
+			ptr = local;
+			cap = 0;
+		}
+
+		// expects this to be released
+		void Steal(MatrixStorage& other)
+		{
+			mode = other.mode;
+			n = other.n;
+			if (other.mode == MODE::INLINE)
+			{
+				std::copy(other.local, other.local + other.n, local);
+				ptr = local;
+			}
+			else
+			{
+				ptr = other.ptr;
+				cap = other.cap;
+			}
+			other.mode = MODE::INLINE;
+			other.ptr = other.local;
+			other.cap = 0;
+			other.n = 0;
+		}
+	private:
+		MODE mode = MODE::INLINE;
+		T* ptr = local;             // always the current buffer, also when inline, so element access does not branch
+		std::size_t n = 0;
+		std::size_t cap = 0;
+		T local[INLINE_CAP];
+	};
+}
\ No newline at end of file
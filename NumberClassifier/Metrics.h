@@ -0,0 +1,252 @@
+#pragma once
+
+#include "Concurrent.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <string>
+#include <thread>
+
+namespace util
+{
+	enum class METRIC
+	{
+		STEP,   // one training batch
+		EVAL    // one evaluation on test data
+	};
+
+	// fixed size so the training thread only copies it into the ring, NaN marks values that were not measured
+	struct MetricRecord
+	{
+		METRIC kind = METRIC::STEP;
+		int epoch = 0;
+		long long step = 0;
+		double trainLoss = std::numeric_limits<double>::quiet_NaN();
+		double trainAccuracy = std::numeric_limits<double>::quiet_NaN();
+		double testLoss = std::numeric_limits<double>::quiet_NaN();
+		double testAccuracy = std::numeric_limits<double>::quiet_NaN();
+		int testSamples = 0;
+		double stepSeconds = std::numeric_limits<double>::quiet_NaN();
+		double samplesPerSecond = std::numeric_limits<double>::quiet_NaN();
+	};
+
+	struct MetricsConfig
+	{
+		std::string csvPath;            // empty writes no csv
+		std::string jsonPath;           // json lines, empty writes none
+		double summarySeconds = 10.0;   // between the human readable step summaries, 0 disables them
+		std::size_t capacity = 8192;    // records in flight before Push starts dropping
+	};
+
+	// the training thread pushes records into a lock-free ring, a background thread formats them into the
+	// csv / json lines files and prints evaluations and periodic summaries, so the hot loop never does formatted I/O
+	class MetricsLogger
+	{
+	public:
+		MetricsLogger(MetricsConfig config)
+			: config(config), ring(config.capacity)
+		{
+			if (!config.csvPath.empty())
+			{
+				csv.open(config.csvPath);
+				csv << "kind,step,epoch,train_loss,train_accuracy,test_loss,test_accuracy,test_samples,step_ms,samples_per_second\n";
+			}
+			if (!config.jsonPath.empty())
+			{
+				json.open(config.jsonPath);
+			}
+			writer = std::thread([this]() { Run(); });
+		}
+		~MetricsLogger()
+		{
+			Close();
+		}
+
+		MetricsLogger(const MetricsLogger&) = delete;
+		MetricsLogger& operator=(const MetricsLogger&) = delete;
+
+		// single producer, never blocks: a full ring drops the record and counts it
+		void Push(const MetricRecord& record)
+		{
+			if (!ring.TryPush(record))
+			{
+				dropped.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		// writes everything pushed so far and the last summary, then stops the writer
+		void Close()
+		{
+			if (!writer.joinable())
+			{
+				return;
+			}
+			closed.store(true, std::memory_order_release);
+			writer.join();
+		}
+
+		std::uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+	private:
+		struct Window
+		{
+			long long steps = 0;
+			long long lastStep = 0;
+			int lastEpoch = 0;
+			double loss = 0.0;
+			double accuracy = 0.0;
+			double testLoss = 0.0;
+			double testAccuracy = 0.0;
+			long long tested = 0;
+			double seconds = 0.0;
+			double samplesPerSecond = 0.0;
+		};
+
+		void Run()
+		{
+			using clock = std::chrono::steady_clock;
+			auto lastSummary = clock::now();
+			for (;;)
+			{
+				// read before draining so every record pushed before Close() is written
+				const bool stopping = closed.load(std::memory_order_acquire);
+				MetricRecord r;
+				bool any = false;
+				while (ring.TryPop(r))
+				{
+					Write(r);
+					any = true;
+				}
+
+				auto now = clock::now();
+				double elapsed = std::chrono::duration<double>(now - lastSummary).count();
+				if (config.summarySeconds > 0.0 && elapsed >= config.summarySeconds)
+				{
+					Summary(elapsed);
+					lastSummary = now;
+				}
+				if (stopping)
+				{
+					break;
+				}
+				if (!any)
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(20));
+				}
+			}
+			if (config.summarySeconds > 0.0)
+			{
+				Summary(std::chrono::duration<double>(clock::now() - lastSummary).count());
+			}
+			csv.flush();
+			json.flush();
+		}
+
+		void Write(const MetricRecord& r)
+		{
+			const char* kind = r.kind == METRIC::STEP ? "step" : "eval";
+			if (csv.is_open())
+			{
+				csv << kind << ',' << r.step << ',' << r.epoch << ',';
+				Field(csv, r.trainLoss, "") << ',';
+				Field(csv, r.trainAccuracy, "") << ',';
+				Field(csv, r.testLoss, "") << ',';
+				Field(csv, r.testAccuracy, "") << ',' << r.testSamples << ',';
+				Field(csv, r.stepSeconds * 1000.0, "") << ',';
+				Field(csv, r.samplesPerSecond, "") << '\n';
+			}
+			if (json.is_open())
+			{
+				json << "{\"kind\":\"" << kind << "\",\"step\":" << r.step << ",\"epoch\":" << r.epoch << ",\"train_loss\":";
+				Field(json, r.trainLoss, "null") << ",\"train_accuracy\":";
+				Field(json, r.trainAccuracy, "null") << ",\"test_loss\":";
+				Field(json, r.testLoss, "null") << ",\"test_accuracy\":";
+				Field(json, r.testAccuracy, "null") << ",\"test_samples\":" << r.testSamples << ",\"step_ms\":";
+				Field(json, r.stepSeconds * 1000.0, "null") << ",\"samples_per_second\":";
+				Field(json, r.samplesPerSecond, "null") << "}\n";
+			}
+
+			if (r.kind == METRIC::EVAL)
+			{
+				std::cout << std::fixed << std::setprecision(4)
+					<< "step " << r.step << " epoch " << r.epoch
+					<< " | train acc " << r.trainAccuracy * 100.0 << "% cost " << r.trainLoss
+					<< " | test acc " << r.testAccuracy * 100.0 << "% cost " << r.testLoss << " (" << r.testSamples << ")"
+					<< " | " << std::setprecision(1) << r.samplesPerSecond << " samples/s\n"
+					<< std::defaultfloat << std::setprecision(6);
+				return;
+			}
+
+			window.steps++;
+			window.lastStep = r.step;
+			window.lastEpoch = r.epoch;
+			window.loss += std::isnan(r.trainLoss) ? 0.0 : r.trainLoss;
+			window.accuracy += std::isnan(r.trainAccuracy) ? 0.0 : r.trainAccuracy;
+			if (!std::isnan(r.testAccuracy))
+			{
+				window.testLoss += r.testLoss;
+				window.testAccuracy += r.testAccuracy;
+				window.tested++;
+			}
+			window.seconds += std::isnan(r.stepSeconds) ? 0.0 : r.stepSeconds;
+			window.samplesPerSecond = std::isnan(r.samplesPerSecond) ? window.samplesPerSecond : r.samplesPerSecond;
+		}
+
+		// means over the steps since the last summary
+		void Summary(double elapsed)
+		{
+			std::uint64_t lost = Dropped();
+			if (window.steps == 0 && lost == reportedDropped)
+			{
+				return;
+			}
+			if (window.steps > 0)
+			{
+				const double n = (double)window.steps;
+				std::cout << std::fixed << std::setprecision(4)
+					<< "step " << window.lastStep << " epoch " << window.lastEpoch << " | " << std::setprecision(1) << elapsed << " s: "
+					<< window.steps << " steps | train acc " << std::setprecision(4) << window.accuracy / n * 100.0 << "% cost " << window.loss / n;
+				if (window.tested > 0)
+				{
+					std::cout << " | test acc " << window.testAccuracy / window.tested * 100.0 << "% cost " << window.testLoss / window.tested;
+				}
+				std::cout << " | " << std::setprecision(2) << window.seconds / n * 1000.0 << " ms/step | "
+					<< std::setprecision(1) << window.samplesPerSecond << " samples/s\n"
+					<< std::defaultfloat << std::setprecision(6);
+			}
+			if (lost != reportedDropped)
+			{
+				std::cout << "metrics: " << lost - reportedDropped << " records dropped, the writer falls behind\n";
+				reportedDropped = lost;
+			}
+			window = Window{};
+			csv.flush();
+			json.flush();
+		}
+
+		static std::ostream& Field(std::ostream& out, double v, const char* missing)
+		{
+			if (std::isnan(v) || std::isinf(v))
+			{
+				return out << missing;
+			}
+			return out << v;
+		}
+	private:
+		MetricsConfig config;
+		SpscRing<MetricRecord> ring;
+		std::atomic<bool> closed{ false };
+		std::atomic<std::uint64_t> dropped{ 0 };
+		std::thread writer;
+
+		// writer thread only
+		std::ofstream csv;
+		std::ofstream json;
+		Window window;
+		std::uint64_t reportedDropped = 0;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,239 @@
+#pragma once
+
+#include "Network.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace util
+{
+	// the serving model, replaceable while other threads classify with it
+	// readers pin the current model with a Guard (two atomic stores, never a lock or a reference count), a reload publishes
+	// the new model with one pointer swap and deletes the old one on the reloading thread once every reader that could
+	// still see it has released it (epoch based reclamation), so a reload never makes a request wait
+	class ModelHandle
+	{
+	public:
+		static constexpr int MAX_READERS = 64;
+
+		ModelHandle(std::unique_ptr<net::Network> initial)
+			: inputs(initial->GetInputSize()), outputs(initial->GetOutputSize()), current(initial.release())
+		{}
+		~ModelHandle()
+		{
+			StopWatching();
+			delete current.load();
+		}
+
+		ModelHandle(const ModelHandle&) = delete;
+		ModelHandle& operator=(const ModelHandle&) = delete;
+
+		// keeps one model alive until it goes out of scope, at most one Guard per reader slot at a time
+		class Guard
+		{
+		public:
+			Guard(Guard&& other) noexcept
+				: slot(other.slot), model(other.model)
+			{
+				other.slot = nullptr;
+			}
+			~Guard()
+			{
+				if (slot)
+				{
+					slot->store(IDLE, std::memory_order_release);
+				}
+			}
+			Guard(const Guard&) = delete;
+			Guard& operator=(const Guard&) = delete;
+
+			const net::Network& operator*() const { return *model; }
+			const net::Network* operator->() const { return model; }
+		private:
+			friend class ModelHandle;
+			Guard(std::atomic<std::uint64_t>* slot, const net::Network* model)
+				: slot(slot), model(model)
+			{}
+
+			std::atomic<std::uint64_t>* slot;
+			const net::Network* model;
+		};
+
+		// every thread that reads takes a slot once, returns -1 if all are taken
+		int Register()
+		{
+			for (int i = 0; i < MAX_READERS; i++)
+			{
+				bool expected = false;
+				if (slots[i].used.compare_exchange_strong(expected, true))
+				{
+					return i;
+				}
+			}
+			return -1;
+		}
+
+		void Unregister(int reader)
+		{
+			slots[reader].used.store(false);
+		}
+
+		// the epoch is announced before the pointer is read, so a publisher that sees this slot idle or at its
+		// new epoch knows the reader can only get the new model
+		Guard Read(int reader)
+		{
+			std::atomic<std::uint64_t>& slot = slots[reader].epoch;
+			slot.store(epoch.load());
+			return Guard{ &slot, current.load() };
+		}
+
+		// swaps in `next` and blocks the calling thread (never a reader) until the previous model is unreachable and deleted
+		void Publish(std::unique_ptr<net::Network> next)
+		{
+			std::lock_guard<std::mutex> lock(publishMtx);
+			net::Network* old = current.exchange(next.release());
+			const std::uint64_t retired = epoch.fetch_add(1) + 1;
+			// right after the swap, so no request that reaches the new model is answered from the old model's predictions
+			if (onPublish)
+			{
+				onPublish();
+			}
+			for (int i = 0; i < MAX_READERS; i++)
+			{
+				for (;;)
+				{
+					const std::uint64_t e = slots[i].epoch.load();
+					if (e == IDLE || e >= retired)
+					{
+						break;
+					}
+					std::this_thread::sleep_for(std::chrono::microseconds(100));
+				}
+			}
+			delete old;
+			version.fetch_add(1, std::memory_order_release);
+		}
+
+		// loads `path` on the calling thread and publishes it if it has the same inputs and outputs as the first model
+		bool Reload(const std::string& path)
+		{
+			auto next = std::make_unique<net::Network>(path);
+			if (!next->IsLoaded() || next->GetInputSize() != inputs || next->GetOutputSize() != outputs)
+			{
+				std::cerr << "Not reloading " << path << ": missing or a different number of inputs / outputs\n";
+				return false;
+			}
+			Publish(std::move(next));
+			return true;
+		}
+
+		// called on the publishing thread right after every swap, before the old model is released, e.g. to invalidate
+		// a prediction cache; set before Watch()
+		void OnPublish(std::function<void()> callback)
+		{
+			onPublish = std::move(callback);
+		}
+
+		// reloads `path` on a background thread whenever its modification time or size changes, once they have stayed
+		// the same for one more poll so a checkpoint that is still being written is not picked up
+		void Watch(const std::string& path, int pollMs = 500)
+		{
+			StopWatching();
+			watching = true;
+			watcher = std::thread([this, path, pollMs]()
+			{
+				Stamp loaded = GetStamp(path);
+				Stamp seen = loaded;
+				std::unique_lock<std::mutex> lock(watchMtx);
+				while (!watchCv.wait_for(lock, std::chrono::milliseconds(pollMs), [this]() { return !watching; }))
+				{
+					Stamp now = GetStamp(path);
+					if (now.valid && now != loaded && now == seen)
+					{
+						lock.unlock();
+						auto start = std::chrono::steady_clock::now();
+						if (Reload(path))
+						{
+							std::cerr << "Reloaded " << path << " in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+						}
+						lock.lock();
+						loaded = now;
+					}
+					seen = now;
+				}
+			});
+		}
+
+		void StopWatching()
+		{
+			{
+				std::lock_guard<std::mutex> lock(watchMtx);
+				watching = false;
+			}
+			watchCv.notify_all();
+			if (watcher.joinable())
+			{
+				watcher.join();
+			}
+		}
+
+		// number of models published since construction
+		std::uint64_t Version() const { return version.load(std::memory_order_acquire); }
+	private:
+		static constexpr std::uint64_t IDLE = ~0ull;
+
+		struct alignas(64) Slot
+		{
+			std::atomic<std::uint64_t> epoch{ IDLE };
+			std::atomic<bool> used{ false };
+		};
+
+		struct Stamp
+		{
+			bool valid = false;
+			std::filesystem::file_time_type time;
+			std::uintmax_t size = 0;
+
+			bool operator==(const Stamp& o) const { return valid == o.valid && time == o.time && size == o.size; }
+			bool operator!=(const Stamp& o) const { return !(*this == o); }
+		};
+
+		static Stamp GetStamp(const std::string& path)
+		{
+			Stamp s;
+			std::error_code ec;
+			s.time = std::filesystem::last_write_time(path, ec);
+			if (ec)
+			{
+				return s;
+			}
+			s.size = std::filesystem::file_size(path, ec);
+			s.valid = !ec;
+			return s;
+		}
+	private:
+		const int inputs;
+		const int outputs;
+
+		// all seq_cst: a reader's epoch store before its pointer load pairs with the publisher's swap before its slot scan
+		std::atomic<net::Network*> current;
+		std::atomic<std::uint64_t> epoch{ 0 };
+		Slot slots[MAX_READERS];
+
+		std::mutex publishMtx;
+		std::atomic<std::uint64_t> version{ 0 };
+		std::function<void()> onPublish;
+
+		std::mutex watchMtx;
+		std::condition_variable watchCv;
+		bool watching = false;
+		std::thread watcher;
+	};
+}
\ No newline at end of file
@@ -1,11 +1,16 @@
 #pragma once
 
 #include "Layer.h"
+#include "TaskGraph.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
 
 namespace net
 {
 	class Network
 	{
+		friend class GradientChecker;
 	public:
 		Network(std::vector<int> layer_c, actf::ACTIVATION_TYPE hiddenActiv, actf::ACTIVATION_TYPE outputActiv, double bias = 0.0)
 			: n_layers((int)layer_c.size()), layer_c(layer_c), hiddenActiv(hiddenActiv), outputActiv(outputActiv)
@@ -28,6 +33,7 @@ namespace net
 
 			weight_grad.resize(layers.size());
 			bias_grad.resize(layers.size());
+			frozen.assign(layers.size(), false);
 
 			ClearGradients();
 		}
@@ -61,9 +67,66 @@ namespace net
 			return output;
 		}
 
-		void Save(std::string name)
+		// batched inference, one sample per row, returns one row of outputs per sample
+		util::Matrix<double> FeedBatch(const util::Matrix<double>& inputs) const
 		{
-			std::ofstream out(name);
+			util::Matrix<double> output = inputs;
+			for (auto layer_p = layers.begin() + 1; layer_p != layers.end(); ++layer_p)
+			{
+				output = layer_p->ForwardBatch(output);
+			}
+			return output;
+		}
+
+		// packed weights are used by every forward pass until the next weight update, Load() packs automatically
+		void Pack()
+		{
+			for (Layer& layer : layers)
+			{
+				layer.Pack();
+			}
+		}
+
+		bool IsLoaded() const { return !layers.empty(); }
+		int GetInputSize() const { return layer_c.front(); }
+		int GetOutputSize() const { return layer_c.back(); }
+
+		// prints the mismatch if the model does not take `inputs` values or does not produce `outputs`
+		bool MatchesData(int inputs, int outputs) const
+		{
+			if (GetInputSize() == inputs && GetOutputSize() == outputs)
+			{
+				return true;
+			}
+			std::cout << "The model has " << GetInputSize() << " inputs and " << GetOutputSize() << " outputs, the data needs "
+				<< inputs << " and " << outputs << '\n';
+			return false;
+		}
+		const std::vector<int>& GetLayerSizes() const { return layer_c; }
+		actf::ACTIVATION_TYPE GetHiddenActivation() const { return hiddenActiv; }
+		actf::ACTIVATION_TYPE GetOutputActivation() const { return outputActiv; }
+		const Layer& GetLayer(int i) const { return layers[i]; }
+
+		// a frozen layer keeps its weights in Learn, backprop stops at the topmost frozen layer so every layer below it is fixed too
+		void SetFrozen(int layer_i, bool value) { frozen[layer_i] = value; }
+		bool IsFrozen(int layer_i) const { return frozen[layer_i]; }
+
+		// freezes layers 1..count (counted from the input side), the rest are trainable
+		void FreezePrefix(int count)
+		{
+			for (int i = 1; i < n_layers; i++)
+			{
+				frozen[i] = i <= count;
+			}
+		}
+		Layer& GetLayer(int i) { return layers[i]; } // call WeightsModified() after writing to the weights
+
+		// written to a temporary file that replaces the old one, so a process watching the path never loads half a checkpoint
+		// returns false and leaves `name` as it was if the model could not be written completely
+		bool Save(std::string name)
+		{
+			const std::string tmp = name + ".tmp";
+			std::ofstream out(tmp);
 
 			// n layers
 			out << layer_c.size() << '\n';
@@ -103,12 +166,40 @@ namespace net
 				}
 				out << '\n';
 			}
+			// a failed write or flush (e.g. a full disk) sets failbit, close() flushes the rest
+			const bool written = (bool)out;
 			out.close();
+			std::error_code ec;
+			if (!written || !out)
+			{
+				std::cout << "Could not write " << tmp << ", " << name << " is unchanged\n";
+				std::filesystem::remove(tmp, ec);
+				return false;
+			}
+			std::filesystem::rename(tmp, name, ec);
+			if (ec)
+			{
+				std::filesystem::copy_file(tmp, name, std::filesystem::copy_options::overwrite_existing, ec);
+				std::error_code removeEc;
+				std::filesystem::remove(tmp, removeEc);
+				if (ec)
+				{
+					std::cout << "Could not replace " << name << '\n';
+					return false;
+				}
+			}
+			return true;
 		}
 
 		void Load(std::string path)
 		{
 			std::ifstream in(path);
+			if (!in)
+			{
+				std::cout << "Model file not found: " << path << '\n';
+				n_layers = 0;
+				return;
+			}
 			in >> n_layers;
 
 			std::vector<int> layer_c;
@@ -165,10 +256,21 @@ namespace net
 				}
 			}
 
+			// a short or garbled file would otherwise load with zeros in place of the missing values
+			if (!in)
+			{
+				std::cout << "Model file truncated or malformed: " << path << '\n';
+				layers.clear();
+				n_layers = 0;
+				return;
+			}
+
 			weight_grad.resize(layers.size());
 			bias_grad.resize(layers.size());
+			frozen.assign(layers.size(), false);
 
 			ClearGradients();
+			Pack();
 
 			in.close();
 		}
@@ -184,52 +286,158 @@ namespace net
 			ClearGradients();
 		}
 
-		void SlowLearn(std::vector<util::DataPoint<double>>& data, double learnRate)
+		// Learn split in two so the summed gradients can be combined with other workers before the update
+		void AccumulateGradients(std::vector<util::DataPoint<double>>& data)
 		{
-			static constexpr double h = 0.0000001;
+			AccumulateGradients(data.begin(), data.end());
+		}
 
-			for (util::DataPoint<double>& dataP : data)
+		void AccumulateGradients(std::vector<util::DataPoint<double>>::iterator first, std::vector<util::DataPoint<double>>::iterator last)
+		{
+			for (; first != last; ++first)
 			{
-				CalculateOutputs(dataP);
+				GetGradients(*first);
 			}
+		}
 
-			double cost = COST(data);
+		// adds the accumulated gradients of a replica with the same layers to these and clears the replica's
+		void MergeGradients(Network& replica)
+		{
+			for (std::size_t i = 0; i < weight_grad.size(); i++)
+			{
+				util::Matrix<double>::Storage& w = weight_grad[i].GetValues();
+				util::Matrix<double>::Storage& b = bias_grad[i].GetValues();
+				const util::Matrix<double>::Storage& rw = replica.weight_grad[i].GetValues();
+				const util::Matrix<double>::Storage& rb = replica.bias_grad[i].GetValues();
+				for (std::size_t j = 0; j < w.size(); j++)
+				{
+					w[j] += rw[j];
+				}
+				for (std::size_t j = 0; j < b.size(); j++)
+				{
+					b[j] += rb[j];
+				}
+			}
+			replica.ClearGradients();
+		}
 
-			int l_i = 0;
-			for (Layer& layer : layers)
+		// weights, biases and freeze flags of a network with the same layers, the buffers are reused
+		void CopyParameters(const Network& other)
+		{
+			frozen = other.frozen;
+			for (std::size_t i = 1; i < layers.size(); i++)
 			{
-				int w_i = 0;
-				for (double& w : layer.GetWeights().GetValues())
+				layers[i].GetWeights() = other.layers[i].GetWeights();
+				layers[i].GetBiases() = other.layers[i].GetBiases();
+				layers[i].WeightsModified();
+			}
+		}
+
+		// steps along the accumulated gradients summed over `samples` data points, then clears them
+		void ApplyAccumulated(double learnRate, int samples)
+		{
+			ApplyGradients(learnRate / (double)samples);
+			ClearGradients();
+		}
+
+		// the same update as Learn with the work of the batch expressed as a task graph on `pool`:
+		// every sample's forward pass and delta propagation form a chain, the weight gradient of layer l for a sample runs
+		// alongside the propagation to layer l - 1, and layer l is updated as soon as its gradient is final and no delta
+		// propagation needs its old weights anymore; the gradients are still summed in sample order, so the result matches Learn
+		// the per sample forward state lives in the graph, the Layer state of Feed is left untouched
+		void Learn(std::vector<util::DataPoint<double>>& data, double learnRate, util::ThreadPool& pool)
+		{
+			const int n = (int)data.size();
+			const int out = n_layers - 1;
+			const int top = TopFrozen();
+			if (n == 0 || top == out)
+			{
+				Learn(data, learnRate);
+				return;
+			}
+
+			// per sample and layer: weighted inputs, activations (index 0 is the input) and deltas
+			using Row = std::vector<util::Matrix<double>>;
+			std::vector<Row> z(n, Row(n_layers)), a(n, Row(n_layers)), delta(n, Row(n_layers));
+			util::TaskGraph graph;
+			std::vector<int> lastGrad(n_layers, -1);         // accumulation into one layer's gradients stays in sample order
+			std::vector<std::vector<int>> readers(n_layers);  // delta propagations that read a layer's weights
+			for (int s = 0; s < n; s++)
+			{
+				int d = graph.Add([&, s]()
 				{
-					w += h;
-					for (util::DataPoint<double>& dataP : data)
+					a[s][0] = data[s].input;
+					for (int l = 1; l <= out; l++)
 					{
-						CalculateOutputs(dataP);
+						z[s][l] = layers[l].WeightedBatch(a[s][l - 1]);
+						a[s][l] = layers[l].Activate(z[s][l]);
 					}
-					w -= h;
-					double new_cost = COST(data);
-					weight_grad[l_i][w_i] = (new_cost - cost) / h;
-					w_i++;
-				}
-				int b_i = 0;
-				for (double& b : layer.GetBiases().GetValues())
+					data[s].output = a[s][out];
+					delta[s][out] = OutputLayerValues(z[s][out], a[s][out], data[s].expected);
+				});
+				for (int l = out; l > top; l--)
 				{
-					b += h;
-					for (util::DataPoint<double>& dataP : data)
+					if (l < out)
 					{
-						CalculateOutputs(dataP);
+						d = graph.Add([&, s, l]() { delta[s][l] = HiddenLayerValues(l, delta[s][l + 1], z[s][l]); }, { d });
+						readers[(std::size_t)l + 1].push_back(d);
 					}
-					b -= h;
-					double new_cost = COST(data);
-					bias_grad[l_i][b_i] = (new_cost - cost) / h;
-					b_i++;
+					lastGrad[l] = graph.Add([&, s, l]()
+					{
+						util::Matrix<double>::MultiplyAdd(weight_grad[l], a[s][l - 1], true, delta[s][l], false);
+						bias_grad[l] = bias_grad[l] + delta[s][l];
+					}, { d, lastGrad[l] });
 				}
-				l_i++;
 			}
+			// the last gradient task of a layer comes after every forward pass, which read all weights
+			const double rate = learnRate / (double)n;
+			for (int l = out; l > top; l--)
+			{
+				std::vector<int> deps = readers[l];
+				deps.push_back(lastGrad[l]);
+				graph.Add([&, l]()
+				{
+					ApplyLayer(l, rate);
+					weight_grad[l] = { {}, layers[l].GetWeights().GetRows(), layers[l].GetWeights().GetColumns() };
+					bias_grad[l] = { {}, layers[l].GetBiases().GetRows(), layers[l].GetBiases().GetColumns() };
+				}, deps);
+			}
+			graph.Run(pool);
+		}
 
-			ApplyGradients(learnRate);
+		// flattened accumulated gradients: per layer the weights then the biases
+		std::size_t GetGradientSize() const
+		{
+			std::size_t n = 0;
+			for (std::size_t i = 0; i < weight_grad.size(); i++)
+			{
+				n += weight_grad[i].GetValues().size() + bias_grad[i].GetValues().size();
+			}
+			return n;
+		}
 
-			ClearGradients();
+		void GetGradientBuffer(std::vector<double>& out) const
+		{
+			out.clear();
+			out.reserve(GetGradientSize());
+			for (std::size_t i = 0; i < weight_grad.size(); i++)
+			{
+				out.insert(out.end(), weight_grad[i].GetValues().begin(), weight_grad[i].GetValues().end());
+				out.insert(out.end(), bias_grad[i].GetValues().begin(), bias_grad[i].GetValues().end());
+			}
+		}
+
+		void SetGradientBuffer(const std::vector<double>& in)
+		{
+			assert(in.size() == GetGradientSize());
+			auto it = in.begin();
+			for (std::size_t i = 0; i < weight_grad.size(); i++)
+			{
+				std::copy(it, it + weight_grad[i].GetValues().size(), weight_grad[i].GetValues().begin());
+				it += weight_grad[i].GetValues().size();
+				std::copy(it, it + bias_grad[i].GetValues().size(), bias_grad[i].GetValues().begin());
+				it += bias_grad[i].GetValues().size();
+			}
 		}
 
 #ifdef UNIT_TEST
@@ -239,15 +447,10 @@ namespace net
 #endif
 		void ApplyGradients(double learnRate)
 		{
-			int i = 0;
-			for (Layer& l : layers)
+			// layers up to the topmost frozen one have no gradients and keep their packed weights
+			for (int i = TopFrozen() + 1; i < n_layers; i++)
 			{
-				util::Matrix<double>& l_wg = weight_grad[i];
-				util::Matrix<double>& l_bg = bias_grad[i];
-
-				l.GetWeights() = l.GetWeights() - l_wg * learnRate;
-				l.GetBiases() = l.GetBiases() - l_bg * learnRate;
-				i++;
+				ApplyLayer(i, learnRate);
 			}
 
 #ifdef UNIT_TEST
@@ -256,6 +459,27 @@ namespace net
 #endif
 		}
 
+		void ApplyLayer(int layer_i, double learnRate)
+		{
+			Layer& l = layers[layer_i];
+			l.GetWeights() = l.GetWeights() - weight_grad[layer_i] * learnRate;
+			l.GetBiases() = l.GetBiases() - bias_grad[layer_i] * learnRate;
+			l.WeightsModified();
+		}
+
+		// index of the topmost frozen layer, 0 (the input layer) if none is
+		int TopFrozen() const
+		{
+			for (int i = n_layers - 1; i > 0; i--)
+			{
+				if (frozen[i])
+				{
+					return i;
+				}
+			}
+			return 0;
+		}
+
 		void ClearGradients()
 		{
 			int w_i = 0;
@@ -274,21 +498,24 @@ namespace net
 
 		void UpdateGradients(int layer_i, util::Matrix<double> nodeValues)
 		{
-			util::Matrix<double> bias_g = nodeValues;
-			util::Matrix<double> weight_g = layers[(std::size_t)layer_i - 1].GetOutputs().GetTransposed() * nodeValues;
-
-			weight_grad[layer_i] = weight_grad[layer_i] + weight_g;
-			bias_grad[layer_i] = bias_grad[layer_i] + bias_g;
+			// outputs^T * nodeValues accumulated in place
+			util::Matrix<double>::MultiplyAdd(weight_grad[layer_i], layers[(std::size_t)layer_i - 1].GetOutputs(), true, nodeValues, false);
+			bias_grad[layer_i] = bias_grad[layer_i] + nodeValues;
 		}
 		
 		void GetGradients(util::DataPoint<double>& dataP)
 		{
 			CalculateOutputs(dataP);
 
+			const int top = TopFrozen();
+			if (top == n_layers - 1)
+			{
+				return;
+			}
 			util::Matrix<double> nodeValues = OutputLayerValues(dataP);
 			UpdateGradients(n_layers - 1, nodeValues);
 
-			for (int i = n_layers - 2; i > 0; i--)
+			for (int i = n_layers - 2; i > top; i--)
 			{
 				nodeValues = HiddenLayerValues(i, nodeValues);
 				UpdateGradients(i, nodeValues);
@@ -297,11 +524,16 @@ namespace net
 
 		util::Matrix<double> OutputLayerValues(util::DataPoint<double>& dataP)
 		{
-			util::Matrix<double> nodeValues = actf::Activation_derivative(outputActiv, layers[(std::size_t)n_layers - 1].GetWeightedInputs());
+			return OutputLayerValues(layers[(std::size_t)n_layers - 1].GetWeightedInputs(), dataP.output, dataP.expected);
+		}
+
+		util::Matrix<double> OutputLayerValues(const util::Matrix<double>& weightedInputs, const util::Matrix<double>& output, const util::Matrix<double>& expected) const
+		{
+			util::Matrix<double> nodeValues = actf::Activation_derivative(outputActiv, weightedInputs);
 			int i = 0;
 			for (double& value : nodeValues.GetValues())
 			{
-				value *= COST_DERIVATIVE(dataP.output[i], dataP.expected[i]); // a typo right here wasted 2 weeks of my life
+				value *= COST_DERIVATIVE(output[i], expected[i]); // a typo right here wasted 2 weeks of my life
 				i++;
 			}
 			return nodeValues;
@@ -309,7 +541,12 @@ namespace net
 
 		util::Matrix<double> HiddenLayerValues(int layer_i, util::Matrix<double> nodeValues)
 		{
-			return util::Hadamard(nodeValues * layers[(std::size_t)layer_i + 1].GetWeights().GetTransposed(), actf::Activation_derivative(hiddenActiv, layers[layer_i].GetWeightedInputs()));
+			return HiddenLayerValues(layer_i, nodeValues, layers[layer_i].GetWeightedInputs());
+		}
+
+		util::Matrix<double> HiddenLayerValues(int layer_i, const util::Matrix<double>& nodeValues, const util::Matrix<double>& weightedInputs) const
+		{
+			return util::Hadamard(util::Matrix<double>::Multiply(nodeValues, false, layers[(std::size_t)layer_i + 1].GetWeights(), true), actf::Activation_derivative(hiddenActiv, weightedInputs));
 		}
 
 #ifdef UNIT_TEST
@@ -323,6 +560,7 @@ namespace net
 
 		std::vector<util::Matrix<double>> weight_grad;
 		std::vector<util::Matrix<double>> bias_grad;
+		std::vector<bool> frozen;
 
 		std::vector<int> layer_c;
 
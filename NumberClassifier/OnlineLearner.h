@@ -0,0 +1,293 @@
+#pragma once
+
+#include "Network.h"
+#include "MNISTReader.h"
+#include "InferenceServer.h"
+#include "Concurrent.h"
+#include "Random.h"
+#include "Signal.h"
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <iostream>
+#include <iomanip>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+namespace util
+{
+	// one label byte (0-9) followed by 28x28 raw pixel bytes, the same pixels a serve request carries
+	static constexpr int ONLINE_RECORD = 1 + REQUEST_PIXELS;
+
+	struct OnlineConfig
+	{
+		int batchSize = 32;             // new samples per update
+		int maxWaitMs = 500;            // longest a sample waits for its batch to fill before a partial update
+		double learnRate = 0.01;
+		int replayCapacity = 5000;      // reservoir of past samples replayed against forgetting, 0 disables replay
+		double replayRatio = 1.0;       // replayed samples per new sample in each update
+		double checkpointSeconds = 10.0;
+		double reportSeconds = 10.0;
+		std::string savePath = "online.txt";
+		bool follow = false;            // keep waiting at the end of the input, for files that are appended to
+	};
+
+	// consumes labeled samples from a file or pipe and updates the model as they arrive
+	// checkpoints are written to a temporary file and renamed over savePath so readers never see a partial model
+	class OnlineLearner
+	{
+	public:
+		OnlineLearner(net::Network& model, OnlineConfig config)
+			: model(model), config(config), rng(StreamId(STREAM::REPLAY))
+		{}
+
+		int Run(int fd)
+		{
+			BoundedQueue<Sample> queue{ 4096 };
+			std::thread reader([&]() { Read(fd, queue); });
+
+			using clock = std::chrono::steady_clock;
+			lastCheckpoint = lastReport = clock::now();
+			std::vector<Sample> fresh;
+			bool done = false;
+			while (!done)
+			{
+				auto deadline = fresh.empty() ? clock::now() + std::chrono::milliseconds(200)
+					: fresh.front().arrival + std::chrono::milliseconds(config.maxWaitMs);
+
+				Sample s;
+				POP res = queue.PopUntil(s, deadline);
+				if (res == POP::ITEM)
+				{
+					fresh.push_back(std::move(s));
+				}
+				done = res == POP::CLOSED || StopRequested();
+
+				if (!fresh.empty() && ((int)fresh.size() >= config.batchSize || res != POP::ITEM || done))
+				{
+					Update(fresh);
+					fresh.clear();
+				}
+
+				auto now = clock::now();
+				if (config.checkpointSeconds > 0.0 && std::chrono::duration<double>(now - lastCheckpoint).count() >= config.checkpointSeconds && updates > published)
+				{
+					Publish();
+					lastCheckpoint = now;
+				}
+				if (config.reportSeconds > 0.0 && std::chrono::duration<double>(now - lastReport).count() >= config.reportSeconds)
+				{
+					Report();
+					lastReport = now;
+				}
+			}
+
+			// the reader may still be blocked on a full queue after a stop request
+			queue.Close();
+			reader.join();
+
+			if (updates > published)
+			{
+				Publish();
+			}
+			if (latencyCount > 0)
+			{
+				Report();
+			}
+			std::cout << "Consumed " << seen << " samples (" << invalid << " invalid) in " << updates << " updates, saved to " << config.savePath << '\n';
+			return 0;
+		}
+	private:
+		struct Sample
+		{
+			DataPoint<double> dp;
+			std::chrono::steady_clock::time_point arrival;
+		};
+
+		void Read(int fd, BoundedQueue<Sample>& queue)
+		{
+			std::vector<std::uint8_t> buf(ONLINE_RECORD * 64);
+			std::size_t have = 0;
+			while (!StopRequested())
+			{
+#ifdef _WIN32
+				int r = _read(fd, buf.data() + have, (unsigned int)(buf.size() - have));
+#else
+				pollfd p{ fd, POLLIN, 0 };
+				int ready = poll(&p, 1, 200);
+				if (ready == 0 || (ready < 0 && errno == EINTR))
+				{
+					continue;
+				}
+				ssize_t r = read(fd, buf.data() + have, buf.size() - have);
+				if (r < 0 && errno == EINTR)
+				{
+					continue;
+				}
+#endif
+				if (r == 0 && config.follow)
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(200));
+					continue;
+				}
+				if (r <= 0)
+				{
+					break;
+				}
+				have += (std::size_t)r;
+
+				auto now = std::chrono::steady_clock::now();
+				std::size_t used = 0;
+				for (; have - used >= (std::size_t)ONLINE_RECORD; used += ONLINE_RECORD)
+				{
+					const std::uint8_t* rec = buf.data() + used;
+					if (rec[0] > 9)
+					{
+						invalid++;
+						continue;
+					}
+					Sample s;
+					s.dp.label = (double)rec[0];
+					s.dp.expected = LabelToMatrix(rec[0]);
+					s.dp.input = Matrix<double>{ {}, 1, REQUEST_PIXELS };
+					for (int i = 0; i < REQUEST_PIXELS; i++)
+					{
+						s.dp.input[i] = (double)rec[1 + i] / 255.0;
+					}
+					s.arrival = now;
+					if (!queue.Push(std::move(s)))
+					{
+						return;
+					}
+				}
+				std::copy(buf.begin() + used, buf.begin() + have, buf.begin());
+				have -= used;
+			}
+			queue.Close();
+		}
+
+		void Update(std::vector<Sample>& fresh)
+		{
+			std::vector<DataPoint<double>> batch;
+			batch.reserve(fresh.size() * 2);
+			for (Sample& s : fresh)
+			{
+				batch.push_back(s.dp);
+			}
+
+			std::size_t n_replay = std::min(replay.size(), (std::size_t)(config.replayRatio * (double)fresh.size() + 0.5));
+			for (std::size_t i = 0; i < n_replay; i++)
+			{
+				batch.push_back(replay[(std::size_t)(rng.Uniform() * (double)replay.size())]);
+			}
+
+			model.Learn(batch, config.learnRate);
+			updates++;
+
+			auto now = std::chrono::steady_clock::now();
+			for (Sample& s : fresh)
+			{
+				double ms = std::chrono::duration<double, std::milli>(now - s.arrival).count();
+				latencySum += ms;
+				latencyMax = std::max(latencyMax, ms);
+				latencyCount++;
+
+				// reservoir sampling keeps a uniform sample of everything seen so far
+				seen++;
+				if (replay.size() < (std::size_t)config.replayCapacity)
+				{
+					replay.push_back(std::move(s.dp));
+				}
+				else if (config.replayCapacity > 0)
+				{
+					std::size_t j = (std::size_t)(rng.Uniform() * (double)seen);
+					if (j < replay.size())
+					{
+						replay[j] = std::move(s.dp);
+					}
+				}
+			}
+		}
+
+		void Publish()
+		{
+			if (model.Save(config.savePath))
+			{
+				published = updates;
+			}
+		}
+
+		void Report()
+		{
+			std::cout << std::fixed << std::setprecision(1)
+				<< "seen " << seen << " | updates " << updates << " | replay " << replay.size()
+				<< " | arrival to update avg " << (latencyCount ? latencySum / latencyCount : 0.0) << " ms max " << latencyMax << " ms\n"
+				<< std::defaultfloat << std::setprecision(6);
+			latencySum = 0.0;
+			latencyMax = 0.0;
+			latencyCount = 0;
+		}
+	private:
+		net::Network& model;
+		OnlineConfig config;
+		RandomStream rng;
+
+		std::vector<DataPoint<double>> replay;
+		std::uint64_t seen = 0;
+		std::atomic<std::uint64_t> invalid{ 0 };
+		std::uint64_t updates = 0;
+		std::uint64_t published = 0;
+
+		std::chrono::steady_clock::time_point lastCheckpoint;
+		std::chrono::steady_clock::time_point lastReport;
+		double latencySum = 0.0;
+		double latencyMax = 0.0;
+		std::uint64_t latencyCount = 0;
+	};
+
+	// "-" reads stdin
+	inline int RunOnline(const std::string& modelPath, const std::string& input, OnlineConfig config)
+	{
+		net::Network model{ modelPath };
+		if (!model.IsLoaded())
+		{
+			return 1;
+		}
+		// every record is a label byte and REQUEST_PIXELS pixel bytes
+		if (!model.MatchesData(REQUEST_PIXELS, 10))
+		{
+			return 1;
+		}
+
+		int fd;
+#ifdef _WIN32
+		fd = input == "-" ? _fileno(stdin) : _open(input.c_str(), _O_RDONLY | _O_BINARY);
+		if (input == "-")
+		{
+			_setmode(fd, _O_BINARY);
+		}
+#else
+		fd = input == "-" ? STDIN_FILENO : open(input.c_str(), O_RDONLY);
+#endif
+		if (fd < 0)
+		{
+			std::cout << "Could not open " << input << '\n';
+			return 1;
+		}
+
+		InstallStopHandler();
+		int res = OnlineLearner{ model, config }.Run(fd);
+		if (input != "-")
+		{
+#ifdef _WIN32
+			_close(fd);
+#else
+			close(fd);
+#endif
+		}
+		return res;
+	}
+}
\ No newline at end of file
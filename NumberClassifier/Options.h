@@ -0,0 +1,156 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include <iostream>
+
+namespace util
+{
+	// parses "--key value" and "--flag" style command line arguments
+	class Options
+	{
+	public:
+		Options(int argc, char** argv, int first = 1)
+		{
+			for (int i = first; i < argc; i++)
+			{
+				std::string arg = argv[i];
+				if (arg.rfind("--", 0) != 0)
+				{
+					positional.push_back(arg);
+					continue;
+				}
+				arg = arg.substr(2);
+
+				std::size_t eq = arg.find('=');
+				if (eq != std::string::npos)
+				{
+					values[arg.substr(0, eq)] = arg.substr(eq + 1);
+				}
+				else if (i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0)
+				{
+					values[arg] = argv[++i];
+				}
+				else
+				{
+					values[arg] = "1"; // flag
+				}
+			}
+		}
+	public:
+		bool Has(const std::string& key) const
+		{
+			return values.find(key) != values.end();
+		}
+
+		std::string Get(const std::string& key, const std::string& def) const
+		{
+			auto it = values.find(key);
+			return it == values.end() ? def : it->second;
+		}
+
+		int GetInt(const std::string& key, int def) const
+		{
+			auto it = values.find(key);
+			if (it == values.end())
+			{
+				return def;
+			}
+			char* end = nullptr;
+			long v = std::strtol(it->second.c_str(), &end, 10);
+			if (end == it->second.c_str() || *end != '\0')
+			{
+				std::cout << "Invalid integer for --" << key << ": " << it->second << '\n';
+				valid = false;
+				return def;
+			}
+			return (int)v;
+		}
+
+		double GetDouble(const std::string& key, double def) const
+		{
+			auto it = values.find(key);
+			if (it == values.end())
+			{
+				return def;
+			}
+			char* end = nullptr;
+			double v = std::strtod(it->second.c_str(), &end);
+			if (end == it->second.c_str() || *end != '\0')
+			{
+				std::cout << "Invalid number for --" << key << ": " << it->second << '\n';
+				valid = false;
+				return def;
+			}
+			return v;
+		}
+
+		bool GetFlag(const std::string& key) const
+		{
+			std::string v = Get(key, "0");
+			return v == "1" || v == "true" || v == "yes";
+		}
+
+		// comma separated list, e.g. --layers 784,256,256,10
+		std::vector<int> GetIntList(const std::string& key, std::vector<int> def) const
+		{
+			auto it = values.find(key);
+			if (it == values.end())
+			{
+				return def;
+			}
+			std::vector<int> res;
+			const char* p = it->second.c_str();
+			while (*p != '\0')
+			{
+				char* end = nullptr;
+				long v = std::strtol(p, &end, 10);
+				if (end == p)
+				{
+					std::cout << "Invalid list for --" << key << ": " << it->second << '\n';
+					valid = false;
+					return def;
+				}
+				res.push_back((int)v);
+				p = *end == ',' ? end + 1 : end;
+			}
+			return res;
+		}
+
+		std::vector<double> GetDoubleList(const std::string& key, std::vector<double> def) const
+		{
+			auto it = values.find(key);
+			if (it == values.end())
+			{
+				return def;
+			}
+			std::vector<double> res;
+			const char* p = it->second.c_str();
+			while (*p != '\0')
+			{
+				char* end = nullptr;
+				double v = std::strtod(p, &end);
+				if (end == p)
+				{
+					std::cout << "Invalid list for --" << key << ": " << it->second << '\n';
+					valid = false;
+					return def;
+				}
+				res.push_back(v);
+				p = *end == ',' ? end + 1 : end;
+			}
+			return res;
+		}
+
+		const std::vector<std::string>& GetPositional() const { return positional; }
+
+		// false if any getter failed to parse its value
+		bool Valid() const { return valid; }
+	private:
+		std::map<std::string, std::string> values;
+		std::vector<std::string> positional;
+		mutable bool valid = true;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,235 @@
+#pragma once
+
+#include "Utility.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <ostream>
+
+namespace util
+{
+	static constexpr int CACHE_KEY_BYTES = 28 * 28;
+
+	// 64 bit hash of a byte string, 8 bytes per step
+	inline std::uint64_t HashBytes(const std::uint8_t* data, std::size_t n)
+	{
+		constexpr std::uint64_t K = 0x9E3779B97F4A7C15ull;
+		std::uint64_t h = (std::uint64_t)n * K;
+		std::size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			std::uint64_t w;
+			std::memcpy(&w, data + i, 8);
+			h = (h ^ (w * K)) * 0xBF58476D1CE4E5B9ull;
+			h ^= h >> 29;
+		}
+		std::uint64_t tail = 0;
+		std::memcpy(&tail, data + i, n - i);
+		h = (h ^ (tail * K)) * 0x94D049BB133111EBull;
+		return h ^ (h >> 31);
+	}
+
+	// the same 8 bit levels a serve request carries
+	inline void QuantizeInput(const Matrix<double>& input, std::uint8_t* out)
+	{
+		for (int i = 0; i < CACHE_KEY_BYTES; i++)
+		{
+			double v = input.GetValues()[i] * 255.0;
+			out[i] = (std::uint8_t)(v <= 0.0 ? 0.0 : v >= 255.0 ? 255.0 : std::lround(v));
+		}
+	}
+
+	struct CacheStats
+	{
+		std::uint64_t hits = 0;
+		std::uint64_t misses = 0;
+		std::uint64_t evictions = 0;
+		std::uint64_t entries = 0;
+		std::uint64_t capacity = 0;
+		std::size_t bytes = 0;
+
+		double HitRate() const { return hits + misses ? (double)hits / (double)(hits + misses) : 0.0; }
+	};
+
+	// bounded prediction cache keyed by the 28x28 input bytes, the full key is kept so hash collisions are never hits
+	// split into shards with their own lock and CLOCK eviction, Invalidate() drops every entry at once by bumping the generation
+	class PredictionCache
+	{
+	public:
+		static constexpr int SHARDS = 16;
+
+		PredictionCache(std::size_t capacity)
+		{
+			std::size_t perShard = std::max<std::size_t>(1, (capacity + SHARDS - 1) / SHARDS);
+			for (Shard& s : shards)
+			{
+				s.slots.resize(perShard);
+				s.index.reserve(perShard);
+			}
+		}
+
+		bool Lookup(const std::uint8_t* pixels, Prediction& out)
+		{
+			std::uint64_t h = HashBytes(pixels, CACHE_KEY_BYTES);
+			Shard& s = shards[h % SHARDS];
+			std::uint64_t gen = generation.load(std::memory_order_acquire);
+			{
+				std::lock_guard<std::mutex> lock(s.mtx);
+				auto it = s.index.find(h);
+				if (it != s.index.end())
+				{
+					Slot& slot = s.slots[it->second];
+					if (slot.generation == gen && std::memcmp(slot.key.data(), pixels, CACHE_KEY_BYTES) == 0)
+					{
+						slot.referenced = true;
+						out = slot.value;
+						hits.fetch_add(1, std::memory_order_relaxed);
+						return true;
+					}
+				}
+			}
+			misses.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		bool Lookup(const Matrix<double>& input, Prediction& out)
+		{
+			std::uint8_t key[CACHE_KEY_BYTES];
+			QuantizeInput(input, key);
+			return Lookup(key, out);
+		}
+
+		// `gen` is the generation read before the prediction was computed, results of a model that was replaced since are dropped
+		void Insert(const std::uint8_t* pixels, const Prediction& value, std::uint64_t gen)
+		{
+			if (gen != generation.load(std::memory_order_acquire))
+			{
+				return;
+			}
+			std::uint64_t h = HashBytes(pixels, CACHE_KEY_BYTES);
+			Shard& s = shards[h % SHARDS];
+			std::lock_guard<std::mutex> lock(s.mtx);
+
+			std::size_t target;
+			auto it = s.index.find(h);
+			if (it != s.index.end())
+			{
+				target = it->second;
+			}
+			else
+			{
+				target = Victim(s, gen);
+				Slot& old = s.slots[target];
+				if (old.used)
+				{
+					s.index.erase(old.hash);
+					if (old.generation == gen)
+					{
+						evictions.fetch_add(1, std::memory_order_relaxed);
+					}
+				}
+				s.index.emplace(h, target);
+			}
+
+			Slot& slot = s.slots[target];
+			std::memcpy(slot.key.data(), pixels, CACHE_KEY_BYTES);
+			slot.hash = h;
+			slot.value = value;
+			slot.generation = gen;
+			slot.used = true;
+			slot.referenced = false;
+		}
+
+		void Insert(const Matrix<double>& input, const Prediction& value, std::uint64_t gen)
+		{
+			std::uint8_t key[CACHE_KEY_BYTES];
+			QuantizeInput(input, key);
+			Insert(key, value, gen);
+		}
+
+		// call whenever the model behind the cache changes
+		void Invalidate()
+		{
+			generation.fetch_add(1, std::memory_order_acq_rel);
+		}
+
+		std::uint64_t Generation() const
+		{
+			return generation.load(std::memory_order_acquire);
+		}
+
+		CacheStats Stats()
+		{
+			CacheStats st;
+			st.hits = hits.load(std::memory_order_relaxed);
+			st.misses = misses.load(std::memory_order_relaxed);
+			st.evictions = evictions.load(std::memory_order_relaxed);
+			std::uint64_t gen = Generation();
+			for (Shard& s : shards)
+			{
+				std::lock_guard<std::mutex> lock(s.mtx);
+				for (const Slot& slot : s.slots)
+				{
+					st.entries += slot.used && slot.generation == gen;
+				}
+				st.capacity += s.slots.size();
+				st.bytes += s.slots.size() * sizeof(Slot) + s.index.bucket_count() * sizeof(void*) + s.index.size() * (sizeof(std::uint64_t) + sizeof(std::size_t) + 2 * sizeof(void*));
+			}
+			return st;
+		}
+
+		void Report(std::ostream& out)
+		{
+			CacheStats st = Stats();
+			out << "cache hit rate " << st.HitRate() * 100.0 << "% (" << st.hits << '/' << st.hits + st.misses << ")"
+				<< " | entries " << st.entries << '/' << st.capacity << " | evictions " << st.evictions
+				<< " | " << st.bytes / 1024 << " KiB\n";
+		}
+	private:
+		struct Slot
+		{
+			std::array<std::uint8_t, CACHE_KEY_BYTES> key;
+			std::uint64_t hash = 0;
+			std::uint64_t generation = 0;
+			Prediction value;
+			bool used = false;
+			bool referenced = false;
+		};
+
+		struct Shard
+		{
+			std::mutex mtx;
+			std::vector<Slot> slots;
+			std::unordered_map<std::uint64_t, std::size_t> index;
+			std::size_t hand = 0;
+		};
+
+		// CLOCK: free or stale slots first, otherwise the first slot whose reference bit is already clear
+		static std::size_t Victim(Shard& s, std::uint64_t gen)
+		{
+			for (;;)
+			{
+				std::size_t i = s.hand;
+				s.hand = (s.hand + 1) % s.slots.size();
+				Slot& slot = s.slots[i];
+				if (!slot.used || slot.generation != gen || !slot.referenced)
+				{
+					return i;
+				}
+				slot.referenced = false;
+			}
+		}
+	private:
+		std::array<Shard, SHARDS> shards;
+		std::atomic<std::uint64_t> generation{ 0 };
+		std::atomic<std::uint64_t> hits{ 0 };
+		std::atomic<std::uint64_t> misses{ 0 };
+		std::atomic<std::uint64_t> evictions{ 0 };
+	};
+}
\ No newline at end of file
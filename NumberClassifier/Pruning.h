@@ -0,0 +1,394 @@
+#pragma once
+
+#include "Network.h"
+#include "Trainer.h"
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+
+namespace net
+{
+	// per layer keep masks of an unstructured pruning, 0 = pruned
+	using PruneMask = std::vector<std::vector<std::uint8_t>>;
+
+	// zeroes the smallest magnitude weights of every layer until `sparsity` of them are zero
+	// weights that were already pruned stay pruned, so calling it with increasing sparsity gives iterative pruning
+	inline PruneMask MagnitudePrune(Network& network, double sparsity)
+	{
+		PruneMask mask(network.GetLayerSizes().size());
+		for (int l = 1; l < (int)mask.size(); l++)
+		{
+			util::Matrix<double>::Storage& w = network.GetLayer(l).GetWeights().GetValues();
+			std::vector<double> magnitudes(w.size());
+			for (std::size_t i = 0; i < w.size(); i++)
+			{
+				magnitudes[i] = std::abs(w[i]);
+			}
+
+			std::size_t n_prune = std::min(w.size(), (std::size_t)(sparsity * w.size()));
+			mask[l].assign(w.size(), 1);
+			if (n_prune == 0)
+			{
+				continue;
+			}
+			std::nth_element(magnitudes.begin(), magnitudes.begin() + (n_prune - 1), magnitudes.end());
+			double threshold = magnitudes[n_prune - 1];
+
+			// ties at the threshold are pruned in index order so exactly n_prune weights go
+			std::size_t pruned = 0;
+			for (std::size_t i = 0; i < w.size(); i++)
+			{
+				if (std::abs(w[i]) < threshold && pruned < n_prune)
+				{
+					w[i] = 0.0;
+					mask[l][i] = 0;
+					pruned++;
+				}
+			}
+			for (std::size_t i = 0; i < w.size() && pruned < n_prune; i++)
+			{
+				if (mask[l][i] && std::abs(w[i]) == threshold)
+				{
+					w[i] = 0.0;
+					mask[l][i] = 0;
+					pruned++;
+				}
+			}
+			network.GetLayer(l).WeightsModified();
+		}
+		return mask;
+	}
+
+	// keeps pruned weights at zero during fine-tuning
+	inline void ApplyMask(Network& network, const PruneMask& mask)
+	{
+		for (int l = 1; l < (int)mask.size(); l++)
+		{
+			util::Matrix<double>::Storage& w = network.GetLayer(l).GetWeights().GetValues();
+			for (std::size_t i = 0; i < w.size(); i++)
+			{
+				if (!mask[l][i])
+				{
+					w[i] = 0.0;
+				}
+			}
+			network.GetLayer(l).WeightsModified();
+		}
+	}
+
+	// removes `fraction` of the neurons of every hidden layer and returns the smaller network
+	// a neuron is scored by the norm of its incoming weights times the norm of its outgoing weights
+	inline Network PruneNeurons(const Network& network, double fraction)
+	{
+		std::vector<int> sizes = network.GetLayerSizes();
+		std::vector<std::vector<int>> kept(sizes.size());
+		for (int l = 0; l < (int)sizes.size(); l++)
+		{
+			const bool hidden = l > 0 && l < (int)sizes.size() - 1;
+			if (!hidden)
+			{
+				for (int j = 0; j < sizes[l]; j++)
+				{
+					kept[l].push_back(j);
+				}
+				continue;
+			}
+
+			const util::Matrix<double>& in_w = network.GetLayer(l).GetWeights();
+			const util::Matrix<double>& out_w = network.GetLayer(l + 1).GetWeights();
+			std::vector<std::pair<double, int>> scores;
+			for (int j = 0; j < sizes[l]; j++)
+			{
+				double in_n = 0.0, out_n = 0.0;
+				for (int k = 0; k < in_w.GetRows(); k++)
+				{
+					in_n += in_w(k, j) * in_w(k, j);
+				}
+				for (int k = 0; k < out_w.GetColumns(); k++)
+				{
+					out_n += out_w(j, k) * out_w(j, k);
+				}
+				scores.push_back({ std::sqrt(in_n * out_n), j });
+			}
+			int keep = std::max(1, sizes[l] - (int)(fraction * sizes[l]));
+			std::partial_sort(scores.begin(), scores.begin() + keep, scores.end(), [](auto& a, auto& b) { return a.first > b.first; });
+			for (int i = 0; i < keep; i++)
+			{
+				kept[l].push_back(scores[i].second);
+			}
+			std::sort(kept[l].begin(), kept[l].end());
+			sizes[l] = keep;
+		}
+
+		Network res{ sizes, network.GetHiddenActivation(), network.GetOutputActivation() };
+		for (int l = 1; l < (int)sizes.size(); l++)
+		{
+			const util::Matrix<double>& src_w = network.GetLayer(l).GetWeights();
+			const util::Matrix<double>& src_b = network.GetLayer(l).GetBiases();
+			util::Matrix<double>& dst_w = res.GetLayer(l).GetWeights();
+			util::Matrix<double>& dst_b = res.GetLayer(l).GetBiases();
+			for (int r = 0; r < sizes[l - 1]; r++)
+			{
+				for (int c = 0; c < sizes[l]; c++)
+				{
+					dst_w(r, c) = src_w(kept[l - 1][r], kept[l][c]);
+				}
+			}
+			for (int c = 0; c < sizes[l]; c++)
+			{
+				dst_b[c] = src_b[kept[l][c]];
+			}
+			res.GetLayer(l).WeightsModified();
+		}
+		res.Pack();
+		return res;
+	}
+
+	// compressed sparse rows over the inputs: row k lists the outputs input k feeds
+	// the kernel skips zero inputs as well as pruned weights, and most MNIST pixels and ReLU outputs are zero
+	struct SparseLayer
+	{
+		int n_in = 0;
+		int n_out = 0;
+		actf::ACTIVATION_TYPE activation;
+		std::vector<int> rowStart;     // n_in + 1 entries
+		std::vector<int> columns;
+		std::vector<double> values;
+		std::vector<double> biases;
+	};
+
+	// inference with the CSR layers, built by the prune report to time them against the dense kernels
+	// models are still saved and served dense
+	class SparseNetwork
+	{
+	public:
+		explicit SparseNetwork(const Network& network)
+		{
+			const std::vector<int>& sizes = network.GetLayerSizes();
+			for (int l = 1; l < (int)sizes.size(); l++)
+			{
+				const Layer& src = network.GetLayer(l);
+				SparseLayer layer;
+				layer.n_in = sizes[l - 1];
+				layer.n_out = sizes[l];
+				layer.activation = src.GetActivation();
+				layer.biases.assign(src.GetBiases().GetValues().begin(), src.GetBiases().GetValues().end());
+				layer.rowStart.push_back(0);
+				for (int k = 0; k < layer.n_in; k++)
+				{
+					for (int j = 0; j < layer.n_out; j++)
+					{
+						double w = src.GetWeights()(k, j);
+						if (w != 0.0)
+						{
+							layer.columns.push_back(j);
+							layer.values.push_back(w);
+						}
+					}
+					layer.rowStart.push_back((int)layer.values.size());
+				}
+				layers.push_back(std::move(layer));
+			}
+		}
+
+		util::Matrix<double> FeedBatch(const util::Matrix<double>& inputs) const
+		{
+			util::Matrix<double> a = inputs;
+			for (const SparseLayer& layer : layers)
+			{
+				util::Matrix<double> z{ {}, a.GetRows(), layer.n_out };
+				for (int r = 0; r < a.GetRows(); r++)
+				{
+					double* y = z.GetValues().data() + (std::size_t)r * layer.n_out;
+					const double* x = a.GetValues().data() + (std::size_t)r * layer.n_in;
+					std::copy(layer.biases.begin(), layer.biases.end(), y);
+					for (int k = 0; k < layer.n_in; k++)
+					{
+						const double xk = x[k];
+						if (xk == 0.0)
+						{
+							continue;
+						}
+						for (int i = layer.rowStart[k]; i < layer.rowStart[k + 1]; i++)
+						{
+							y[layer.columns[i]] += xk * layer.values[i];
+						}
+					}
+				}
+				a = actf::Activation_rows(layer.activation, z);
+			}
+			return a;
+		}
+
+		std::size_t NonZeros() const
+		{
+			std::size_t n = 0;
+			for (const SparseLayer& layer : layers)
+			{
+				n += layer.values.size();
+			}
+			return n;
+		}
+	private:
+		std::vector<SparseLayer> layers;
+	};
+
+	// ---------------------------------------------------------------------------------------
+
+	struct PruneConfig
+	{
+		std::vector<double> sparsity{ 0.5, 0.7, 0.8, 0.9 };  // pruning rounds, ascending
+		double neuronFraction = 0.0;   // structured pruning applied before the first round
+		int finetuneEpochs = 0;        // after every round
+		double learnRate = 0.01;
+		int batchSize = 100;
+		int latencySamples = 500;      // single sample inferences timed per model
+	};
+
+	template<class Model>
+	inline double PruneAccuracy(const Model& model, const std::vector<util::DataPoint<double>>& data)
+	{
+		int correct = 0;
+		for (std::size_t first = 0; first < data.size(); first += 256)
+		{
+			int n = (int)std::min<std::size_t>(256, data.size() - first);
+			util::Matrix<double> inputs{ {}, n, data[first].input.GetSize() };
+			for (int r = 0; r < n; r++)
+			{
+				std::copy(data[first + r].input.GetValues().begin(), data[first + r].input.GetValues().end(), inputs.GetValues().begin() + (std::size_t)r * inputs.GetColumns());
+			}
+			util::Matrix<double> outputs = model.FeedBatch(inputs);
+			for (int r = 0; r < n; r++)
+			{
+				if (util::TopClass(outputs, r).label == (int)data[first + r].label)
+				{
+					correct++;
+				}
+			}
+		}
+		return data.empty() ? 0.0 : (double)correct / data.size();
+	}
+
+	template<class Model>
+	inline double PruneLatencyUs(const Model& model, const std::vector<util::DataPoint<double>>& data, int samples)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < samples; i++)
+		{
+			model.FeedBatch(data[i % data.size()].input);
+		}
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / samples;
+	}
+
+	// runs the pruning rounds and prints accuracy / sparsity / latency per round
+	class Pruner
+	{
+	public:
+		Pruner(PruneConfig config, const std::vector<util::DataPoint<double>>& train, const std::vector<util::DataPoint<double>>& test)
+			: config(config), test(test)
+		{
+			if (config.finetuneEpochs > 0 && !train.empty())
+			{
+				trainer = std::make_unique<util::Trainer>(config.batchSize, train, std::vector<util::DataPoint<double>>{});
+			}
+		}
+
+		// returns the model of the last round
+		Network Run(Network network)
+		{
+			dense_params = NonZeroWeights(network);
+			network.Pack();
+			base_acc = PruneAccuracy(network, test);
+			double base_us = PruneLatencyUs(network, test, config.latencySamples);
+
+			std::cout << std::fixed << std::setprecision(4)
+				<< "round  layers               sparsity  weights    accuracy   delta     dense us    sparse us\n"
+				<< "base   " << std::left << std::setw(21) << LayerString(network) << std::right
+				<< std::setw(8) << 0.0 << "  " << std::setw(9) << dense_params << "  "
+				<< std::setw(8) << base_acc * 100.0 << "%  " << std::setw(8) << 0.0 << "  " << std::setw(10) << base_us << "  -\n";
+
+			if (config.neuronFraction > 0.0)
+			{
+				network = PruneNeurons(network, config.neuronFraction);
+				Finetune(network, nullptr);
+				Report("neur", network);
+			}
+
+			for (std::size_t round = 0; round < config.sparsity.size(); round++)
+			{
+				PruneMask mask = MagnitudePrune(network, config.sparsity[round]);
+				Finetune(network, &mask);
+				Report(std::to_string(round + 1), network);
+			}
+			std::cout << std::defaultfloat << std::setprecision(6);
+			return network;
+		}
+	private:
+		void Finetune(Network& network, const PruneMask* mask)
+		{
+			if (!trainer)
+			{
+				return;
+			}
+			for (int e = 0; e < config.finetuneEpochs; e++)
+			{
+				for (int b = 0; b < (int)trainer->GetTrainingDataBatches().size(); b++)
+				{
+					trainer->Train(network, config.learnRate, b);
+					if (mask)
+					{
+						ApplyMask(network, *mask);
+					}
+				}
+			}
+			network.Pack();
+		}
+
+		void Report(const std::string& round, Network& network)
+		{
+			network.Pack();
+			SparseNetwork sparse{ network };
+			double acc = PruneAccuracy(network, test);
+			std::size_t nonzero = sparse.NonZeros();
+
+			std::cout << std::left << std::setw(7) << round << std::setw(21) << LayerString(network) << std::right
+				<< std::setw(8) << 1.0 - (double)nonzero / dense_params << "  " << std::setw(9) << nonzero << "  "
+				<< std::setw(8) << acc * 100.0 << "%  " << std::setw(8) << (acc - base_acc) * 100.0 << "  "
+				<< std::setw(10) << PruneLatencyUs(network, test, config.latencySamples) << "  "
+				<< std::setw(10) << PruneLatencyUs(sparse, test, config.latencySamples) << '\n';
+		}
+
+		static std::size_t NonZeroWeights(const Network& network)
+		{
+			std::size_t n = 0;
+			for (int l = 1; l < (int)network.GetLayerSizes().size(); l++)
+			{
+				for (double w : network.GetLayer(l).GetWeights().GetValues())
+				{
+					n += w != 0.0;
+				}
+			}
+			return n;
+		}
+
+		static std::string LayerString(const Network& network)
+		{
+			std::string res;
+			for (int s : network.GetLayerSizes())
+			{
+				res += (res.empty() ? "" : "-") + std::to_string(s);
+			}
+			return res;
+		}
+	private:
+		PruneConfig config;
+		const std::vector<util::DataPoint<double>>& test;
+		std::unique_ptr<util::Trainer> trainer;
+
+		std::size_t dense_params = 0;
+		double base_acc = 0.0;
+	};
+}
\ No newline at end of file
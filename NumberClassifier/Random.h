@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+namespace util
+{
+	// Philox4x32-10 (Salmon et al. 2011), a counter based generator
+	// block i of a key is a pure function of (key, i) so any thread can produce any part of a stream in any order
+	struct Philox4x32
+	{
+		using Counter = std::array<std::uint32_t, 4>;
+		using Key = std::array<std::uint32_t, 2>;
+
+		static constexpr std::uint32_t M0 = 0xD2511F53u;
+		static constexpr std::uint32_t M1 = 0xCD9E8D57u;
+		static constexpr std::uint32_t W0 = 0x9E3779B9u;
+		static constexpr std::uint32_t W1 = 0xBB67AE85u;
+
+		static Counter Block(Counter c, Key k)
+		{
+			for (int r = 0; r < 10; r++)
+			{
+				std::uint64_t p0 = (std::uint64_t)M0 * c[0];
+				std::uint64_t p1 = (std::uint64_t)M1 * c[2];
+				c = { (std::uint32_t)(p1 >> 32) ^ c[1] ^ k[0], (std::uint32_t)p1, (std::uint32_t)(p0 >> 32) ^ c[3] ^ k[1], (std::uint32_t)p0 };
+				k[0] += W0;
+				k[1] += W1;
+			}
+			return c;
+		}
+
+		// LANES consecutive blocks starting at `block`, lanes are independent so the rounds vectorize
+		static constexpr int LANES = 8;
+		static void Blocks(std::uint64_t block, Key k, std::uint32_t* out)
+		{
+			std::uint32_t c0[LANES], c1[LANES], c2[LANES], c3[LANES];
+			for (int j = 0; j < LANES; j++)
+			{
+				c0[j] = (std::uint32_t)(block + j);
+				c1[j] = (std::uint32_t)((block + j) >> 32);
+				c2[j] = 0;
+				c3[j] = 0;
+			}
+			for (int r = 0; r < 10; r++)
+			{
+				for (int j = 0; j < LANES; j++)
+				{
+					std::uint64_t p0 = (std::uint64_t)M0 * c0[j];
+					std::uint64_t p1 = (std::uint64_t)M1 * c2[j];
+					std::uint32_t n0 = (std::uint32_t)(p1 >> 32) ^ c1[j] ^ k[0];
+					std::uint32_t n2 = (std::uint32_t)(p0 >> 32) ^ c3[j] ^ k[1];
+					c1[j] = (std::uint32_t)p1;
+					c3[j] = (std::uint32_t)p0;
+					c0[j] = n0;
+					c2[j] = n2;
+				}
+				k[0] += W0;
+				k[1] += W1;
+			}
+			for (int j = 0; j < LANES; j++)
+			{
+				out[j * 4 + 0] = c0[j];
+				out[j * 4 + 1] = c1[j];
+				out[j * 4 + 2] = c2[j];
+				out[j * 4 + 3] = c3[j];
+			}
+		}
+	};
+
+	// what a stream is used for, part of the stream id so different uses never share numbers
+	enum class STREAM : std::uint64_t
+	{
+		WEIGHT_INIT = 1,
+		AUGMENT,
+		SHUFFLE,
+		REPLAY,
+		GENERIC,
+		SYNTHETIC
+	};
+
+	inline std::uint64_t SplitMix64(std::uint64_t x)
+	{
+		x += 0x9E3779B97F4A7C15ull;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+	// e.g. StreamId(STREAM::AUGMENT, epoch, sample)
+	inline std::uint64_t StreamId(STREAM purpose, std::uint64_t a = 0, std::uint64_t b = 0)
+	{
+		return SplitMix64(SplitMix64(SplitMix64((std::uint64_t)purpose) ^ a) ^ b);
+	}
+
+	inline std::atomic<std::uint64_t> _seed{ 36456355 };
+	inline std::atomic<std::uint64_t> _streamCounter{ 0 };
+
+	// also restarts the NextStream sequence, so the networks built after it are the same however many came before
+	inline void SetRandomSeed(std::uint64_t seed)
+	{
+		_seed = seed;
+		_streamCounter = 0;
+	}
+
+	inline std::uint64_t RandomSeed()
+	{
+		return _seed;
+	}
+
+	// one independent, reproducible sequence of random numbers
+	// single values are buffered from whole blocks, the bulk fills always start at the next unused block
+	class RandomStream
+	{
+	public:
+		explicit RandomStream(std::uint64_t id, std::uint64_t seed = RandomSeed())
+		{
+			std::uint64_t k = SplitMix64(seed ^ SplitMix64(id));
+			key = { (std::uint32_t)k, (std::uint32_t)(k >> 32) };
+		}
+
+		std::uint32_t NextU32()
+		{
+			if (used == 4)
+			{
+				Philox4x32::Counter c = Philox4x32::Block({ (std::uint32_t)block, (std::uint32_t)(block >> 32), 0, 0 }, key);
+				std::copy(c.begin(), c.end(), buffer);
+				block++;
+				used = 0;
+			}
+			return buffer[used++];
+		}
+
+		// [0, 1) with 53 random bits
+		double Uniform()
+		{
+			std::uint64_t hi = NextU32();
+			std::uint64_t lo = NextU32();
+			return ToUnit(hi, lo);
+		}
+
+		double Uniform(double lo, double hi)
+		{
+			return lo + (hi - lo) * Uniform();
+		}
+
+		// [lo, hi]
+		int UniformInt(int lo, int hi)
+		{
+			std::uint64_t range = (std::uint64_t)((std::int64_t)hi - lo) + 1;
+			return lo + (int)(((std::uint64_t)NextU32() * range) >> 32);
+		}
+
+		double Normal(double mean = 0.0, double stddev = 1.0)
+		{
+			if (hasSpare)
+			{
+				hasSpare = false;
+				return mean + stddev * spare;
+			}
+			double u1 = 1.0 - Uniform();
+			double u2 = Uniform();
+			double r = std::sqrt(-2.0 * std::log(u1));
+			spare = r * std::sin(TWO_PI * u2);
+			hasSpare = true;
+			return mean + stddev * r * std::cos(TWO_PI * u2);
+		}
+
+		void FillUniform(double* out, std::size_t n, double lo = 0.0, double hi = 1.0)
+		{
+			constexpr std::size_t PER_CALL = Philox4x32::LANES * 2;
+			std::uint32_t bits[Philox4x32::LANES * 4];
+			const double scale = hi - lo;
+			used = 4;
+			for (std::size_t i = 0; i < n; i += PER_CALL)
+			{
+				Philox4x32::Blocks(block, key, bits);
+				block += Philox4x32::LANES;
+				std::size_t count = n - i < PER_CALL ? n - i : PER_CALL;
+				for (std::size_t j = 0; j < count; j++)
+				{
+					out[i + j] = lo + scale * ToUnit(bits[j * 2], bits[j * 2 + 1]);
+				}
+			}
+		}
+
+		// Box-Muller over a uniform fill, pairs of outputs share one pair of uniforms
+		void FillNormal(double* out, std::size_t n, double mean = 0.0, double stddev = 1.0)
+		{
+			std::size_t even = n & ~(std::size_t)1;
+			FillUniform(out, even);
+			for (std::size_t i = 0; i < even; i += 2)
+			{
+				double r = std::sqrt(-2.0 * std::log(1.0 - out[i]));
+				double t = TWO_PI * out[i + 1];
+				out[i] = mean + stddev * r * std::cos(t);
+				out[i + 1] = mean + stddev * r * std::sin(t);
+			}
+			if (n != even)
+			{
+				double pair[2];
+				FillUniform(pair, 2);
+				out[even] = mean + stddev * std::sqrt(-2.0 * std::log(1.0 - pair[0])) * std::cos(TWO_PI * pair[1]);
+			}
+		}
+	private:
+		static double ToUnit(std::uint64_t hi, std::uint64_t lo)
+		{
+			return (double)(((hi << 32) | lo) >> 11) * (1.0 / 9007199254740992.0);
+		}
+	private:
+		static constexpr double TWO_PI = 6.283185307179586476925;
+
+		Philox4x32::Key key;
+		std::uint64_t block = 0;
+		std::uint32_t buffer[4] = {};
+		int used = 4;
+		bool hasSpare = false;
+		double spare = 0.0;
+	};
+
+	// next stream of a process wide sequence, for sequential consumers like weight initialization
+	// reproducible as long as the streams are taken in the same order since the last SetRandomSeed
+	inline RandomStream NextStream(STREAM purpose)
+	{
+		return RandomStream{ StreamId(purpose, _streamCounter++) };
+	}
+}
\ No newline at end of file
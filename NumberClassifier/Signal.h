@@ -0,0 +1,38 @@
+#pragma once
+
+#include <csignal>
+#include <atomic>
+
+namespace util
+{
+	inline std::atomic<bool> _stopRequested{ false };
+
+	inline void _StopHandler(int)
+	{
+		_stopRequested.store(true, std::memory_order_relaxed);
+	}
+
+	// SIGINT/SIGTERM only set a flag, long running loops poll StopRequested() and shut down on their own
+	inline void InstallStopHandler()
+	{
+		std::signal(SIGINT, _StopHandler);
+		std::signal(SIGTERM, _StopHandler);
+	}
+
+	// SIGINT/SIGTERM terminate again, for prompts that block on input and never poll StopRequested()
+	inline void RestoreDefaultSignals()
+	{
+		std::signal(SIGINT, SIG_DFL);
+		std::signal(SIGTERM, SIG_DFL);
+	}
+
+	inline bool StopRequested()
+	{
+		return _stopRequested.load(std::memory_order_relaxed);
+	}
+
+	inline void RequestStop()
+	{
+		_stopRequested.store(true, std::memory_order_relaxed);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "Network.h"
+#include <tuple>
+#include <utility>
+#include <memory>
+#include <algorithm>
+
+namespace net
+{
+	template<int In, int Out>
+	struct StaticLayer
+	{
+		static constexpr int inputs = In;
+		static constexpr int outputs = Out;
+
+		alignas(64) double weights[In][Out]; // inputs x outputs, same layout as Layer
+		alignas(64) double biases[Out];
+	};
+
+	// inference-only network with the topology fixed at compile time, e.g.
+	// StaticNetwork<actf::ReLUPolicy, actf::SoftmaxPolicy, 784, 256, 256, 10>
+	// every loop bound is constexpr and the weights live in aligned fixed size arrays so the kernels can be unrolled and vectorized
+	// the object holds all weights inline, create it on the heap with Create()
+	template<typename HiddenActiv, typename OutputActiv, int... Sizes>
+	class StaticNetwork
+	{
+		static_assert(sizeof...(Sizes) >= 2, "a network needs an input and an output layer");
+	public:
+		static constexpr int n_layers = (int)sizeof...(Sizes);
+		static constexpr int layer_c[] = { Sizes... };
+		static constexpr int input_size = layer_c[0];
+		static constexpr int output_size = layer_c[n_layers - 1];
+		static constexpr int max_width = std::max({ Sizes... });
+	private:
+		template<std::size_t... I>
+		static auto MakeLayers(std::index_sequence<I...>) -> std::tuple<StaticLayer<layer_c[I], layer_c[I + 1]>...>;
+
+		using Layers = decltype(MakeLayers(std::make_index_sequence<sizeof...(Sizes) - 1>{}));
+	public:
+		static std::unique_ptr<StaticNetwork> Create()
+		{
+			return std::make_unique<StaticNetwork>();
+		}
+
+		// copies the weights of a dynamic network, fails if the topology or activations differ
+		bool Load(const Network& network)
+		{
+			if (network.GetLayerSizes() != std::vector<int>{ Sizes... } ||
+				network.GetHiddenActivation() != HiddenActiv::type || network.GetOutputActivation() != OutputActiv::type)
+			{
+				return false;
+			}
+			CopyLayers<0>(network);
+			return true;
+		}
+
+		bool Load(const std::string& path)
+		{
+			Network network{ path };
+			return network.IsLoaded() && Load(network);
+		}
+
+		// input: input_size values, output: output_size values
+		void Feed(const double* input, double* output) const
+		{
+			alignas(64) double a[max_width];
+			alignas(64) double b[max_width];
+			std::copy(input, input + input_size, a);
+			Run<0>(a, b, output);
+		}
+
+		util::Matrix<double> Feed(const util::Matrix<double>& input) const
+		{
+			util::Matrix<double> res{ {}, 1, output_size };
+			Feed(input.GetValues().data(), res.GetValues().data());
+			return res;
+		}
+	private:
+		template<std::size_t I>
+		void CopyLayers(const Network& network)
+		{
+			if constexpr (I < sizeof...(Sizes) - 1)
+			{
+				auto& layer = std::get<I>(layers);
+				const Layer& src = network.GetLayer((int)I + 1);
+				std::copy(src.GetWeights().GetValues().begin(), src.GetWeights().GetValues().end(), &layer.weights[0][0]);
+				std::copy(src.GetBiases().GetValues().begin(), src.GetBiases().GetValues().end(), layer.biases);
+				CopyLayers<I + 1>(network);
+			}
+		}
+
+		template<int In, int Out>
+		static void Dense(const StaticLayer<In, Out>& layer, const double* x, double* y)
+		{
+			for (int j = 0; j < Out; j++)
+			{
+				y[j] = layer.biases[j];
+			}
+			for (int i = 0; i < In; i++)
+			{
+				const double xi = x[i];
+				const double* w = layer.weights[i];
+				for (int j = 0; j < Out; j++)
+				{
+					y[j] += xi * w[j];
+				}
+			}
+		}
+
+		// ping-pongs between the two scratch buffers, the last layer writes straight into output
+		template<std::size_t I>
+		void Run(double* in, double* out, double* output) const
+		{
+			using L = std::tuple_element_t<I, Layers>;
+			constexpr bool last = I == sizeof...(Sizes) - 2;
+
+			double* dst = last ? output : out;
+			Dense(std::get<I>(layers), in, dst);
+			if constexpr (last)
+			{
+				OutputActiv::template Apply<L::outputs>(dst);
+			}
+			else
+			{
+				HiddenActiv::template Apply<L::outputs>(dst);
+				Run<I + 1>(out, in, output);
+			}
+		}
+	private:
+		Layers layers;
+	};
+
+	// the production topology
+	using MNISTStaticNetwork = StaticNetwork<actf::ReLUPolicy, actf::SoftmaxPolicy, 784, 256, 256, 10>;
+}
\ No newline at end of file
@@ -0,0 +1,489 @@
+#pragma once
+
+#include "Network.h"
+#include "MNISTReader.h"
+#include "Concurrent.h"
+#include "MatrixStorage.h"
+#include "Random.h"
+#include "Signal.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <numeric>
+#include <thread>
+
+namespace util
+{
+	static constexpr std::uint32_t IDX_LABELS_MAGIC = 2049;
+	static constexpr std::uint32_t IDX_IMAGES_MAGIC = 2051;
+	static constexpr int IDX_PIXELS = 28 * 28;
+	static constexpr std::uint64_t IDX_LABELS_HEADER = 8;
+	static constexpr std::uint64_t IDX_IMAGES_HEADER = 16;
+
+	inline void WriteBigEndian(std::ostream& out, std::uint32_t v)
+	{
+		char b[4] = { (char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v };
+		out.write(b, 4);
+	}
+
+	inline bool ReadBigEndian(std::istream& in, std::uint32_t& v)
+	{
+		unsigned char b[4];
+		if (!in.read(reinterpret_cast<char*>(b), 4))
+		{
+			return false;
+		}
+		v = (std::uint32_t)b[0] << 24 | (std::uint32_t)b[1] << 16 | (std::uint32_t)b[2] << 8 | b[3];
+		return true;
+	}
+
+	// a pair of 28x28 IDX files read by sample range, nothing is kept in memory but the two file handles
+	class IdxSource
+	{
+	public:
+		bool Open(const std::string& imagesPath, const std::string& labelsPath)
+		{
+			images.open(imagesPath, std::ios::binary);
+			labels.open(labelsPath, std::ios::binary);
+			if (!images || !labels)
+			{
+				std::cout << "Data file not found: " << (!images ? imagesPath : labelsPath) << '\n';
+				return false;
+			}
+			std::uint32_t magic = 0, n_images = 0, rows = 0, cols = 0, labelMagic = 0, n_labels = 0;
+			if (!ReadBigEndian(images, magic) || !ReadBigEndian(images, n_images) || !ReadBigEndian(images, rows) || !ReadBigEndian(images, cols)
+				|| !ReadBigEndian(labels, labelMagic) || !ReadBigEndian(labels, n_labels))
+			{
+				std::cout << "Truncated IDX header in " << imagesPath << " or " << labelsPath << '\n';
+				return false;
+			}
+			if (magic != IDX_IMAGES_MAGIC || labelMagic != IDX_LABELS_MAGIC || rows != 28 || cols != 28 || n_images != n_labels)
+			{
+				std::cout << "Not a matching pair of 28x28 IDX image and label files\n";
+				return false;
+			}
+			// a truncated file would otherwise only fail once training reaches the missing samples
+			std::error_code ec, labelEc;
+			const std::uintmax_t imageBytes = std::filesystem::file_size(imagesPath, ec);
+			const std::uintmax_t labelBytes = std::filesystem::file_size(labelsPath, labelEc);
+			if (ec || labelEc || imageBytes < IDX_IMAGES_HEADER + (std::uintmax_t)n_images * IDX_PIXELS || labelBytes < IDX_LABELS_HEADER + (std::uintmax_t)n_labels)
+			{
+				std::cout << "IDX files shorter than the " << n_images << " samples their headers announce: " << imagesPath << ", " << labelsPath << '\n';
+				return false;
+			}
+			count = n_images;
+			return true;
+		}
+
+		std::uint64_t Size() const { return count; }
+
+		// samples [first, first + n)
+		bool Read(std::uint64_t first, std::size_t n, std::uint8_t* pixels, std::uint8_t* labelBytes)
+		{
+			images.seekg((std::streamoff)(IDX_IMAGES_HEADER + first * IDX_PIXELS));
+			labels.seekg((std::streamoff)(IDX_LABELS_HEADER + first));
+			return (bool)images.read(reinterpret_cast<char*>(pixels), (std::streamsize)(n * IDX_PIXELS))
+				&& (bool)labels.read(reinterpret_cast<char*>(labelBytes), (std::streamsize)n);
+		}
+	private:
+		std::ifstream images;
+		std::ifstream labels;
+		std::uint64_t count = 0;
+	};
+
+	// writes `count` SyntheticDigits samples as IDX files, identical to SyntheticDigits(type, count) up to the 8 bit quantization
+	// generated in blocks on all threads and written in order, so any size fits in a few MiB
+	inline bool GenerateSyntheticIdx(const std::string& imagesPath, const std::string& labelsPath, std::uint64_t count, DATATYPE type,
+		int threads = (int)std::max(1u, std::thread::hardware_concurrency()))
+	{
+		if (count > 0xFFFFFFFFull)
+		{
+			std::cout << "IDX files hold at most 2^32 - 1 samples\n";
+			return false;
+		}
+		std::ofstream images(imagesPath, std::ios::binary);
+		std::ofstream labels(labelsPath, std::ios::binary);
+		if (!images || !labels)
+		{
+			std::cout << "Could not create " << (!images ? imagesPath : labelsPath) << '\n';
+			return false;
+		}
+		WriteBigEndian(images, IDX_IMAGES_MAGIC);
+		WriteBigEndian(images, (std::uint32_t)count);
+		WriteBigEndian(images, 28);
+		WriteBigEndian(images, 28);
+		WriteBigEndian(labels, IDX_LABELS_MAGIC);
+		WriteBigEndian(labels, (std::uint32_t)count);
+
+		constexpr std::uint64_t BLOCK = 1 << 16;
+		std::vector<std::uint8_t> pixelBlock(BLOCK * IDX_PIXELS);
+		std::vector<std::uint8_t> labelBlock(BLOCK);
+		auto start = std::chrono::steady_clock::now();
+		auto lastReport = start;
+		for (std::uint64_t first = 0; first < count && !StopRequested(); first += BLOCK)
+		{
+			const std::uint64_t n = std::min(BLOCK, count - first);
+			std::vector<std::thread> workers;
+			for (int t = 0; t < threads; t++)
+			{
+				workers.emplace_back([&, t]()
+				{
+					for (std::uint64_t i = t; i < n; i += threads)
+					{
+						DataPoint<double> dp = SyntheticDigit(type, first + i);
+						AugmentSample(dp.input, type, 0, first + i);
+						std::uint8_t* px = pixelBlock.data() + i * IDX_PIXELS;
+						for (int p = 0; p < IDX_PIXELS; p++)
+						{
+							px[p] = (std::uint8_t)std::lround(std::clamp(dp.input[p], 0.0, 1.0) * 255.0);
+						}
+						labelBlock[i] = (std::uint8_t)dp.label;
+					}
+				});
+			}
+			for (std::thread& w : workers)
+			{
+				w.join();
+			}
+			images.write(reinterpret_cast<const char*>(pixelBlock.data()), (std::streamsize)(n * IDX_PIXELS));
+			labels.write(reinterpret_cast<const char*>(labelBlock.data()), (std::streamsize)n);
+
+			auto now = std::chrono::steady_clock::now();
+			if (std::chrono::duration<double>(now - lastReport).count() >= 10.0)
+			{
+				double seconds = std::chrono::duration<double>(now - start).count();
+				std::cout << first + n << '/' << count << " samples, " << (std::uint64_t)((first + n) / seconds) << " samples/s\n";
+				lastReport = now;
+			}
+		}
+		if (!images || !labels)
+		{
+			std::cout << "Write failed\n";
+			return false;
+		}
+		return !StopRequested();
+	}
+
+	struct StreamConfig
+	{
+		std::vector<int> layers{ 784, 256, 256, 10 };
+		net::actf::ACTIVATION_TYPE hiddenActiv = net::actf::ACTIVATION_TYPE::RELU;
+		net::actf::ACTIVATION_TYPE outputActiv = net::actf::ACTIVATION_TYPE::SOFTMAX;
+		int batchSize = 100;
+		double learnRate = 0.05;
+		int epochs = 1;
+		std::size_t memoryBudgetMb = 256;   // every sample buffer together: chunks, shuffle index and the batch
+		int windowChunks = 8;               // chunks shuffled together, more chunks shuffle better but make them smaller
+		bool augment = false;               // fresh offset and noise every epoch
+		bool readOnly = false;              // measures the input pipeline without training
+		int evalSamples = 2000;             // first points of the test files, 0 skips evaluation
+		double reportSeconds = 10.0;
+
+		std::string loadPath;
+		std::string savePath = "save.txt";
+		std::string trainImages = "train-images.idx3-ubyte";
+		std::string trainLabels = "train-labels.idx1-ubyte";
+		std::string testImages = "t10k-images.idx3-ubyte";
+		std::string testLabels = "t10k-labels.idx1-ubyte";
+	};
+
+	// trains from IDX files of any size with bounded memory: each epoch visits the file chunks in a random order,
+	// a reader thread prefetches them into a fixed set of recycled buffers, and the samples of windowChunks chunks are
+	// shuffled together before they are converted to DataPoints one batch at a time
+	class StreamingTrainer
+	{
+	public:
+		StreamingTrainer(StreamConfig config)
+			: config(config)
+		{}
+
+		int Run()
+		{
+			IdxSource source;
+			if (!source.Open(config.trainImages, config.trainLabels) || source.Size() == 0)
+			{
+				return 1;
+			}
+
+			// buffered samples cost their bytes plus one index entry while in the window
+			const std::size_t batchBytes = (std::size_t)config.batchSize * (IDX_PIXELS + 10) * sizeof(double);
+			const std::size_t budget = config.memoryBudgetMb << 20;
+			const int n_buffers = config.windowChunks + 2;   // the window, one queued and one being read
+			const std::size_t perSample = (std::size_t)n_buffers * (IDX_PIXELS + 1) + (std::size_t)config.windowChunks * sizeof(std::uint32_t);
+			if (budget <= batchBytes || (budget - batchBytes) / perSample < (std::size_t)config.batchSize)
+			{
+				std::cout << "A " << config.memoryBudgetMb << " MiB budget does not fit " << n_buffers << " chunks of one batch each\n";
+				return 1;
+			}
+			chunkSamples = (std::size_t)std::min<std::uint64_t>({ (budget - batchBytes) / perSample, source.Size(), 0xFFFFFFFFull / config.windowChunks });
+			n_chunks = (source.Size() + chunkSamples - 1) / chunkSamples;
+
+			net::Network model{ config.layers, config.hiddenActiv, config.outputActiv };
+			if (!config.loadPath.empty())
+			{
+				model = net::Network{ config.loadPath };
+				if (!model.IsLoaded())
+				{
+					return 1;
+				}
+			}
+			if (!model.MatchesData(IDX_PIXELS, 10))
+			{
+				return 1;
+			}
+			if (config.evalSamples > 0 && !LoadTest())
+			{
+				return 1;
+			}
+
+			std::cout << "Streaming " << source.Size() << " samples in " << n_chunks << " chunks of " << chunkSamples << " ("
+				<< chunkSamples * IDX_PIXELS / (1 << 20) << " MiB), window of " << config.windowChunks << " chunks, "
+				<< (perSample * chunkSamples + batchBytes) / (1 << 20) << " MiB of sample buffers\n";
+
+			BoundedQueue<Chunk*> free{ (std::size_t)n_buffers };
+			BoundedQueue<Chunk*> full{ (std::size_t)n_buffers };
+			std::vector<std::unique_ptr<Chunk>> buffers;
+			for (int i = 0; i < n_buffers; i++)
+			{
+				buffers.push_back(std::make_unique<Chunk>());
+				buffers.back()->pixels.resize(chunkSamples * IDX_PIXELS);
+				buffers.back()->labels.resize(chunkSamples);
+				free.Push(buffers.back().get());
+			}
+			std::thread reader([&]() { Read(source, free, full); });
+
+			start = lastReport = std::chrono::steady_clock::now();
+			std::vector<Chunk*> window;
+			std::vector<std::uint32_t> order;
+			std::vector<DataPoint<double>> batch;
+			bool failed = false;
+			for (int epoch = 0; epoch < config.epochs && !failed && !StopRequested(); epoch++)
+			{
+				std::uint64_t remaining = n_chunks;
+				for (std::uint64_t w = 0; remaining > 0 && !failed && !StopRequested(); w++)
+				{
+					window.clear();
+					for (std::uint64_t i = 0; i < std::min<std::uint64_t>(config.windowChunks, remaining); i++)
+					{
+						Chunk* c = nullptr;
+						if (!full.Pop(c) || c->count == 0)
+						{
+							failed = c != nullptr;
+							break;
+						}
+						window.push_back(c);
+					}
+					if (failed || window.empty())
+					{
+						break;
+					}
+					remaining -= window.size();
+
+					// sample k of the window is sample k % chunkSamples of window chunk k / chunkSamples
+					// samples with a label byte above 9 are left out and counted, like invalid online records
+					order.clear();
+					for (std::size_t c = 0; c < window.size(); c++)
+					{
+						for (std::size_t i = 0; i < window[c]->count; i++)
+						{
+							if (window[c]->labels[i] > 9)
+							{
+								invalid++;
+								continue;
+							}
+							order.push_back((std::uint32_t)(c * chunkSamples + i));
+						}
+					}
+					RandomStream rng{ StreamId(STREAM::SHUFFLE, (std::uint64_t)epoch, w + 1) };
+					for (std::size_t i = order.size(); i > 1; i--)
+					{
+						std::swap(order[i - 1], order[(std::size_t)(rng.Uniform() * (double)i)]);
+					}
+
+					for (std::size_t b = 0; b < order.size() && !StopRequested(); b += config.batchSize)
+					{
+						std::size_t n = std::min<std::size_t>(config.batchSize, order.size() - b);
+						FillBatch(window, order.data() + b, n, epoch, batch);
+						if (!config.readOnly)
+						{
+							model.Learn(batch, config.learnRate);
+						}
+						samples += n;
+						Report(model, epoch, false);
+					}
+
+					for (Chunk* c : window)
+					{
+						free.Push(c);
+					}
+				}
+			}
+
+			free.Close();
+			full.Close();
+			reader.join();
+			if (failed)
+			{
+				std::cout << "Reading " << config.trainImages << " failed\n";
+				return 1;
+			}
+
+			Report(model, config.epochs - 1, true);
+			if (invalid > 0)
+			{
+				std::cout << "Skipped " << invalid << " samples with a label above 9\n";
+			}
+			if (!config.readOnly)
+			{
+				if (!model.Save(config.savePath))
+				{
+					return 1;
+				}
+				std::cout << "Saved to " << config.savePath << '\n';
+			}
+			return 0;
+		}
+	private:
+		struct Chunk
+		{
+			std::uint64_t first = 0;
+			std::size_t count = 0;      // 0 marks a failed read
+			std::vector<std::uint8_t, AlignedAllocator<std::uint8_t>> pixels;
+			std::vector<std::uint8_t> labels;
+		};
+
+		// every epoch reads all chunks once in a random order, running ahead into the next epoch while buffers are free
+		void Read(IdxSource& source, BoundedQueue<Chunk*>& free, BoundedQueue<Chunk*>& full)
+		{
+			std::vector<std::uint64_t> chunkOrder(n_chunks);
+			for (int epoch = 0; epoch < config.epochs; epoch++)
+			{
+				std::iota(chunkOrder.begin(), chunkOrder.end(), 0);
+				RandomStream rng{ StreamId(STREAM::SHUFFLE, (std::uint64_t)epoch, 0) };
+				for (std::size_t i = chunkOrder.size(); i > 1; i--)
+				{
+					std::swap(chunkOrder[i - 1], chunkOrder[(std::size_t)(rng.Uniform() * (double)i)]);
+				}
+
+				for (std::uint64_t chunk : chunkOrder)
+				{
+					Chunk* c = nullptr;
+					if (!free.Pop(c))
+					{
+						return;
+					}
+					c->first = chunk * chunkSamples;
+					c->count = (std::size_t)std::min<std::uint64_t>(chunkSamples, source.Size() - c->first);
+					if (!source.Read(c->first, c->count, c->pixels.data(), c->labels.data()))
+					{
+						c->count = 0;
+						full.Push(c);
+						return;
+					}
+					bytesRead += c->count * (IDX_PIXELS + 1);
+					if (!full.Push(c))
+					{
+						return;
+					}
+				}
+			}
+		}
+
+		// copy assignment into the reused batch keeps its matrices allocated
+		void FillBatch(const std::vector<Chunk*>& window, const std::uint32_t* indices, std::size_t n, int epoch, std::vector<DataPoint<double>>& batch)
+		{
+			batch.resize(n);
+			for (std::size_t i = 0; i < n; i++)
+			{
+				const Chunk& c = *window[indices[i] / chunkSamples];
+				const std::size_t s = indices[i] % chunkSamples;
+				DataPoint<double>& dp = batch[i];
+				if (dp.input.GetSize() != IDX_PIXELS)
+				{
+					dp.input = Matrix<double>{ {}, 1, IDX_PIXELS };
+					dp.expected = Matrix<double>{ {}, 1, 10 };
+				}
+				const std::uint8_t* px = c.pixels.data() + s * IDX_PIXELS;
+				for (int p = 0; p < IDX_PIXELS; p++)
+				{
+					dp.input[p] = (double)px[p] / 255.0;
+				}
+				const int label = c.labels[s];
+				std::fill(dp.expected.GetValues().begin(), dp.expected.GetValues().end(), 0.0);
+				dp.expected[label] = 1.0;
+				dp.label = (double)label;
+				if (config.augment)
+				{
+					AugmentSample(dp.input, DATATYPE::TRAIN, (std::uint64_t)epoch, c.first + s);
+				}
+			}
+		}
+
+		bool LoadTest()
+		{
+			IdxSource test;
+			if (!test.Open(config.testImages, config.testLabels))
+			{
+				return false;
+			}
+			const int n = (int)std::min<std::uint64_t>(config.evalSamples, test.Size());
+			std::vector<std::uint8_t> pixels((std::size_t)n * IDX_PIXELS), labels(n);
+			if (!test.Read(0, n, pixels.data(), labels.data()))
+			{
+				std::cout << "Reading " << config.testImages << " failed\n";
+				return false;
+			}
+			testInputs = Matrix<double>{ {}, n, IDX_PIXELS };
+			for (std::size_t i = 0; i < pixels.size(); i++)
+			{
+				testInputs.GetValues()[i] = (double)pixels[i] / 255.0;
+			}
+			testLabels.assign(labels.begin(), labels.end());
+			return true;
+		}
+
+		void Report(net::Network& model, int epoch, bool last)
+		{
+			auto now = std::chrono::steady_clock::now();
+			if (!last && (config.reportSeconds <= 0.0 || std::chrono::duration<double>(now - lastReport).count() < config.reportSeconds))
+			{
+				return;
+			}
+			lastReport = now;
+			const double seconds = std::chrono::duration<double>(now - start).count();
+			std::cout << std::fixed << std::setprecision(1)
+				<< "epoch " << epoch << " | " << samples << " samples | " << samples / seconds << " samples/s | read "
+				<< (double)bytesRead.load() / (1 << 20) / seconds << " MiB/s";
+			if (!testLabels.empty() && !config.readOnly)
+			{
+				model.Pack();
+				Matrix<double> outputs = model.FeedBatch(testInputs);
+				int correct = 0;
+				for (int r = 0; r < outputs.GetRows(); r++)
+				{
+					correct += TopClass(outputs, r).label == testLabels[r];
+				}
+				std::cout << " | test acc " << std::setprecision(2) << 100.0 * correct / outputs.GetRows() << "% (" << outputs.GetRows() << ")";
+			}
+			std::cout << '\n' << std::defaultfloat << std::setprecision(6);
+		}
+	private:
+		StreamConfig config;
+		std::size_t chunkSamples = 0;
+		std::uint64_t n_chunks = 0;
+
+		Matrix<double> testInputs;
+		std::vector<int> testLabels;
+
+		std::uint64_t samples = 0;
+		std::uint64_t invalid = 0;
+		std::atomic<std::uint64_t> bytesRead{ 0 };
+		std::chrono::steady_clock::time_point start;
+		std::chrono::steady_clock::time_point lastReport;
+	};
+}
\ No newline at end of file
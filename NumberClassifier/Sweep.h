@@ -0,0 +1,242 @@
+#pragma once
+
+#include "Network.h"
+#include "MNISTReader.h"
+#include "Random.h"
+#include "Signal.h"
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+
+namespace util
+{
+	struct SweepConfig
+	{
+		std::vector<std::vector<int>> layers{ { 784, 128, 10 }, { 784, 256, 10 }, { 784, 256, 256, 10 } };
+		std::vector<double> learnRates{ 0.01, 0.05, 0.1 };
+		std::vector<int> batchSizes{ 32, 100 };
+		net::actf::ACTIVATION_TYPE hiddenActiv = net::actf::ACTIVATION_TYPE::RELU;
+		net::actf::ACTIVATION_TYPE outputActiv = net::actf::ACTIVATION_TYPE::SOFTMAX;
+
+		int threads = (int)std::max(1u, std::thread::hardware_concurrency());
+		long long rungSamples = 20000;  // training samples per trial before the first cut, multiplied by eta every rung
+		double eta = 3.0;               // each rung keeps the best 1/eta of the trials
+		int rungs = 3;
+		int evalSamples = 2000;         // test points used for ranking, 0 uses the full test set
+		std::string output = "sweep.csv";
+	};
+
+	// loaded once and only read by the trials
+	struct SharedDataset
+	{
+		std::vector<DataPoint<double>> train;
+		Matrix<double> testInputs;
+		std::vector<int> testLabels;
+
+		SharedDataset(std::vector<DataPoint<double>> trainData, const std::vector<DataPoint<double>>& testData, int evalSamples)
+			: train(std::move(trainData))
+		{
+			int n = evalSamples <= 0 ? (int)testData.size() : std::min(evalSamples, (int)testData.size());
+			int cols = n > 0 ? testData[0].input.GetColumns() : 0;
+			testInputs = Matrix<double>{ {}, n, cols };
+			for (int r = 0; r < n; r++)
+			{
+				std::copy(testData[r].input.GetValues().begin(), testData[r].input.GetValues().end(), testInputs.GetValues().begin() + (std::size_t)r * cols);
+				testLabels.push_back((int)testData[r].label);
+			}
+		}
+	};
+
+	// one configuration of the sweep, owns its network and scratch batch, reads the data through a const reference
+	class Trial
+	{
+	public:
+		Trial(int id, std::vector<int> layers, net::actf::ACTIVATION_TYPE hidden, net::actf::ACTIVATION_TYPE output, double learnRate, int batchSize)
+			: id(id), layers(layers), learnRate(learnRate), batchSize(batchSize), model(layers, hidden, output)
+		{}
+
+		// trains until `target` samples have been seen in total
+		void TrainUntil(const SharedDataset& data, long long target)
+		{
+			auto start = std::chrono::steady_clock::now();
+			while (trained < target && !StopRequested())
+			{
+				if (order.empty() || cursor >= order.size())
+				{
+					Shuffle(data.train.size());
+				}
+				std::size_t n = std::min<std::size_t>({ (std::size_t)batchSize, order.size() - cursor, (std::size_t)(target - trained) });
+				// copy assignment reuses the scratch buffers, the shared points are never written
+				batch.resize(n);
+				for (std::size_t i = 0; i < n; i++)
+				{
+					batch[i] = data.train[order[cursor + i]];
+				}
+				model.Learn(batch, learnRate);
+				cursor += n;
+				trained += (long long)n;
+			}
+			seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		double Evaluate(const SharedDataset& data)
+		{
+			model.Pack();
+			Matrix<double> outputs = model.FeedBatch(data.testInputs);
+			int correct = 0;
+			for (int r = 0; r < outputs.GetRows(); r++)
+			{
+				correct += TopClass(outputs, r).label == data.testLabels[r];
+			}
+			accuracy = outputs.GetRows() > 0 ? (double)correct / outputs.GetRows() : 0.0;
+			return accuracy;
+		}
+
+		int id;
+		std::vector<int> layers;
+		double learnRate;
+		int batchSize;
+		int rung = 0;           // last rung the trial was evaluated in
+		long long trained = 0;
+		double accuracy = 0.0;
+		double seconds = 0.0;
+	private:
+		void Shuffle(std::size_t n)
+		{
+			order.resize(n);
+			std::iota(order.begin(), order.end(), 0);
+			RandomStream rng{ StreamId(STREAM::SHUFFLE, (std::uint64_t)id, epoch++) };
+			for (std::size_t i = n; i > 1; i--)
+			{
+				std::swap(order[i - 1], order[(std::size_t)(rng.Uniform() * (double)i)]);
+			}
+			cursor = 0;
+		}
+	private:
+		net::Network model;
+		std::vector<std::size_t> order;
+		std::size_t cursor = 0;
+		std::uint64_t epoch = 0;
+		std::vector<DataPoint<double>> batch;
+	};
+
+	// grid search with successive halving: every rung trains the survivors to rungSamples * eta^rung samples on a pool of
+	// threads, then keeps the best 1/eta by test accuracy
+	class SweepRunner
+	{
+	public:
+		SweepRunner(SweepConfig config, const SharedDataset& data)
+			: config(config), data(data)
+		{}
+
+		int Run()
+		{
+			// built on this thread so the weight init streams are taken in a fixed order
+			for (const std::vector<int>& l : config.layers)
+			{
+				for (double lr : config.learnRates)
+				{
+					for (int b : config.batchSizes)
+					{
+						trials.push_back(std::make_unique<Trial>((int)trials.size(), l, config.hiddenActiv, config.outputActiv, lr, b));
+					}
+				}
+			}
+
+			std::vector<Trial*> alive;
+			for (auto& t : trials)
+			{
+				alive.push_back(t.get());
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			for (int rung = 0; rung < config.rungs && !alive.empty() && !StopRequested(); rung++)
+			{
+				long long target = (long long)((double)config.rungSamples * std::pow(config.eta, rung));
+				RunRung(alive, rung, target);
+
+				std::sort(alive.begin(), alive.end(), [](const Trial* a, const Trial* b) { return a->accuracy > b->accuracy; });
+				std::cout << "rung " << rung << ": " << alive.size() << " trials at " << target << " samples, best "
+					<< std::fixed << std::setprecision(2) << alive.front()->accuracy * 100.0 << "% (trial " << alive.front()->id << ")\n"
+					<< std::defaultfloat << std::setprecision(6);
+
+				if (rung + 1 < config.rungs)
+				{
+					std::size_t keep = std::max<std::size_t>(1, (std::size_t)std::ceil((double)alive.size() / config.eta));
+					alive.resize(std::min(keep, alive.size()));
+				}
+			}
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			WriteResults();
+			std::cout << "Sweep of " << trials.size() << " trials took " << seconds << " s, results in " << config.output << '\n';
+			return 0;
+		}
+	private:
+		void RunRung(std::vector<Trial*>& alive, int rung, long long target)
+		{
+			std::atomic<std::size_t> next{ 0 };
+			int n_threads = std::max(1, std::min(config.threads, (int)alive.size()));
+			std::vector<std::thread> workers;
+			for (int w = 0; w < n_threads; w++)
+			{
+				workers.emplace_back([&]()
+				{
+					for (std::size_t i = next++; i < alive.size(); i = next++)
+					{
+						alive[i]->TrainUntil(data, target);
+						alive[i]->Evaluate(data);
+						alive[i]->rung = rung;
+					}
+				});
+			}
+			for (std::thread& w : workers)
+			{
+				w.join();
+			}
+		}
+
+		void WriteResults() const
+		{
+			std::vector<const Trial*> sorted;
+			for (const auto& t : trials)
+			{
+				sorted.push_back(t.get());
+			}
+			// later rungs first, then accuracy
+			std::sort(sorted.begin(), sorted.end(), [](const Trial* a, const Trial* b)
+			{
+				return a->rung != b->rung ? a->rung > b->rung : a->accuracy > b->accuracy;
+			});
+
+			std::ofstream csv(config.output);
+			csv << "trial,layers,learn_rate,batch_size,rung,samples,accuracy,seconds\n";
+			std::cout << "trial  layers               lr       batch  rung  samples   accuracy  seconds\n";
+			for (const Trial* t : sorted)
+			{
+				std::ostringstream layers;
+				for (std::size_t i = 0; i < t->layers.size(); i++)
+				{
+					layers << (i ? "-" : "") << t->layers[i];
+				}
+				csv << t->id << ',' << layers.str() << ',' << t->learnRate << ',' << t->batchSize << ',' << t->rung << ','
+					<< t->trained << ',' << t->accuracy << ',' << t->seconds << '\n';
+				std::cout << std::left << std::setw(7) << t->id << std::setw(21) << layers.str() << std::setw(9) << t->learnRate
+					<< std::setw(7) << t->batchSize << std::setw(6) << t->rung << std::setw(10) << t->trained << std::right
+					<< std::fixed << std::setprecision(2) << std::setw(7) << t->accuracy * 100.0 << "%  " << std::setprecision(1) << std::setw(7) << t->seconds << '\n'
+					<< std::defaultfloat << std::setprecision(6);
+			}
+		}
+	private:
+		SweepConfig config;
+		const SharedDataset& data;
+		std::vector<std::unique_ptr<Trial>> trials;
+	};
+}
\ No newline at end of file
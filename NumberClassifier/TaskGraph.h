@@ -0,0 +1,175 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util
+{
+	// fixed set of worker threads sharing one task queue, a thread waiting for its tasks can work along with HelpUntil
+	class ThreadPool
+	{
+	public:
+		ThreadPool(int workers)
+		{
+			for (int i = 0; i < workers; i++)
+			{
+				threads.emplace_back([this]() { Work(); });
+			}
+		}
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				stopping = true;
+			}
+			cv.notify_all();
+			for (std::thread& t : threads)
+			{
+				t.join();
+			}
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		void Submit(std::function<void()> task)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				tasks.push_back(std::move(task));
+			}
+			cv.notify_one();
+		}
+
+		// runs queued tasks on the calling thread until done() holds, done() is checked under the queue lock
+		// so whatever makes it true has to call Wake() afterwards
+		template<typename Done>
+		void HelpUntil(Done done)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			for (;;)
+			{
+				cv.wait(lock, [&]() { return !tasks.empty() || done(); });
+				if (tasks.empty())
+				{
+					return;
+				}
+				std::function<void()> task = std::move(tasks.front());
+				tasks.pop_front();
+				lock.unlock();
+				task();
+				lock.lock();
+			}
+		}
+
+		void Wake()
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			cv.notify_all();
+		}
+
+		int GetWorkers() const { return (int)threads.size(); }
+	private:
+		void Work()
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			for (;;)
+			{
+				cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (tasks.empty())
+				{
+					return;
+				}
+				std::function<void()> task = std::move(tasks.front());
+				tasks.pop_front();
+				lock.unlock();
+				task();
+				lock.lock();
+			}
+		}
+	private:
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::deque<std::function<void()>> tasks;
+		bool stopping = false;
+		std::vector<std::thread> threads;
+	};
+
+	// tasks with dependencies on earlier tasks, each one is queued on the pool the moment its last dependency finishes
+	class TaskGraph
+	{
+	public:
+		// dependencies are ids returned by earlier calls, negative ids are ignored
+		int Add(std::function<void()> task, const std::vector<int>& deps = {})
+		{
+			const int id = (int)nodes.size();
+			nodes.push_back(Node{ std::move(task), {}, 0 });
+			for (int d : deps)
+			{
+				if (d >= 0)
+				{
+					nodes[d].next.push_back(id);
+					nodes[id].deps++;
+				}
+			}
+			return id;
+		}
+
+		// blocks until every task has run, the calling thread executes tasks too
+		void Run(ThreadPool& pool)
+		{
+			const int n = (int)nodes.size();
+			std::vector<std::atomic<int>> remaining(n);
+			std::atomic<int> finished{ 0 };
+			ThreadPool* workers = &pool;
+			std::function<void(int)> schedule = [&](int id)
+			{
+				// the locals of Run may be gone once the last task has counted itself, only the pool is touched after that
+				pool.Submit([&, workers, n, id]()
+				{
+					nodes[id].task();
+					for (int next : nodes[id].next)
+					{
+						if (remaining[next].fetch_sub(1, std::memory_order_acq_rel) == 1)
+						{
+							schedule(next);
+						}
+					}
+					if (finished.fetch_add(1, std::memory_order_acq_rel) + 1 == n)
+					{
+						workers->Wake();
+					}
+				});
+			};
+
+			for (int i = 0; i < n; i++)
+			{
+				remaining[i].store(nodes[i].deps, std::memory_order_relaxed);
+			}
+			for (int i = 0; i < n; i++)
+			{
+				if (nodes[i].deps == 0)
+				{
+					schedule(i);
+				}
+			}
+			pool.HelpUntil([&]() { return finished.load(std::memory_order_acquire) == n; });
+		}
+
+		void Clear() { nodes.clear(); }
+		int GetSize() const { return (int)nodes.size(); }
+	private:
+		struct Node
+		{
+			std::function<void()> task;
+			std::vector<int> next;
+			int deps;
+		};
+		std::vector<Node> nodes;
+	};
+}
\ No newline at end of file
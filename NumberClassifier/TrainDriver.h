@@ -0,0 +1,307 @@
+#pragma once
+
+#include "Network.h"
+#include "Trainer.h"
+#include "MNISTReader.h"
+#include "Cost.h"
+#include "Options.h"
+#include "Signal.h"
+#include "Metrics.h"
+#include "AsyncEval.h"
+#include <chrono>
+#include <iostream>
+#include <memory>
+
+namespace util
+{
+	struct TrainConfig
+	{
+		std::vector<int> layers{ 784, 256, 256, 10 };
+		net::actf::ACTIVATION_TYPE hiddenActiv = net::actf::ACTIVATION_TYPE::RELU;
+		net::actf::ACTIVATION_TYPE outputActiv = net::actf::ACTIVATION_TYPE::SOFTMAX;
+
+		int batchSize = 100;
+		int threads = 1;                // data-parallel Learn, every thread takes a slice of each batch
+		bool taskGraph = false;         // the threads run each batch as a task graph instead (Network::Learn with a pool)
+		double learnRate = 0.05;
+		int epochs = 1;                 // 0 trains until stopped
+		int evalInterval = 100;         // steps between evaluations, 0 evaluates at the end of each epoch only
+		int evalSamples = 1000;         // test points per evaluation, 0 uses the full test set
+		bool asyncEval = false;         // full test set evaluations of weight snapshots on a separate thread
+		int checkpointInterval = 500;   // steps between checkpoints, 0 only saves at the end
+		int warmupSteps = 10;           // steps excluded from the steady state throughput
+
+		std::string loadPath;           // empty starts from random weights
+		std::string savePath = "save.txt";
+
+		std::string trainImages = "train-images.idx3-ubyte";
+		std::string trainLabels = "train-labels.idx1-ubyte";
+		std::string testImages = "t10k-images.idx3-ubyte";
+		std::string testLabels = "t10k-labels.idx1-ubyte";
+
+		MetricsConfig metrics;
+
+		static bool FromOptions(const Options& opt, TrainConfig& cfg)
+		{
+			cfg.layers = opt.GetIntList("layers", cfg.layers);
+			cfg.batchSize = opt.GetInt("batch", cfg.batchSize);
+			cfg.threads = opt.GetInt("threads", cfg.threads);
+			cfg.taskGraph = opt.GetFlag("task-graph");
+			cfg.learnRate = opt.GetDouble("lr", cfg.learnRate);
+			cfg.epochs = opt.GetInt("epochs", cfg.epochs);
+			cfg.evalInterval = opt.GetInt("eval-interval", cfg.evalInterval);
+			cfg.evalSamples = opt.GetInt("eval-samples", cfg.evalSamples);
+			cfg.asyncEval = opt.GetFlag("async-eval");
+			cfg.checkpointInterval = opt.GetInt("checkpoint-interval", cfg.checkpointInterval);
+			cfg.warmupSteps = opt.GetInt("warmup", cfg.warmupSteps);
+			cfg.loadPath = opt.Get("load", cfg.loadPath);
+			cfg.savePath = opt.Get("save", cfg.savePath);
+			cfg.trainImages = opt.Get("train-images", cfg.trainImages);
+			cfg.trainLabels = opt.Get("train-labels", cfg.trainLabels);
+			cfg.testImages = opt.Get("test-images", cfg.testImages);
+			cfg.testLabels = opt.Get("test-labels", cfg.testLabels);
+			cfg.metrics.csvPath = opt.Get("metrics-csv", cfg.metrics.csvPath);
+			cfg.metrics.jsonPath = opt.Get("metrics-jsonl", cfg.metrics.jsonPath);
+			cfg.metrics.summarySeconds = opt.GetDouble("summary-seconds", cfg.metrics.summarySeconds);
+			if (opt.GetFlag("full-eval"))
+			{
+				cfg.evalSamples = 0;
+			}
+
+			if (!net::actf::FromString(opt.Get("hidden", "relu"), cfg.hiddenActiv) ||
+				!net::actf::FromString(opt.Get("output", "softmax"), cfg.outputActiv))
+			{
+				std::cout << "Unknown activation, expected sigmoid, relu or softmax\n";
+				return false;
+			}
+			if (cfg.layers.size() < 2 || cfg.batchSize <= 0 || cfg.threads <= 0 || cfg.learnRate <= 0.0)
+			{
+				std::cout << "Need at least two layers, a positive batch size and thread count and a positive learning rate\n";
+				return false;
+			}
+			return opt.Valid();
+		}
+	};
+
+	// non-interactive training loop, stops after the configured epochs or on SIGINT/SIGTERM
+	class TrainDriver
+	{
+	public:
+		TrainDriver(TrainConfig config)
+			: config(config)
+		{}
+
+		int Run()
+		{
+			std::cout << "Loading...\n";
+
+			MNISTReader train_reader(config.trainImages, config.trainLabels);
+			std::vector<DataPoint<double>> train_data = train_reader.GetData(DATATYPE::TRAIN);
+
+			MNISTReader test_reader(config.testImages, config.testLabels);
+			std::vector<DataPoint<double>> test_data = test_reader.GetData(DATATYPE::TEST);
+
+			if (train_data.empty() || test_data.empty())
+			{
+				std::cout << "No training or test data\n";
+				return 1;
+			}
+
+			net::Network model{ config.layers, config.hiddenActiv, config.outputActiv };
+			if (!config.loadPath.empty())
+			{
+				model = net::Network{ config.loadPath };
+				if (!model.IsLoaded())
+				{
+					return 1;
+				}
+			}
+			if (!model.MatchesData(train_data[0].input.GetSize(), train_data[0].expected.GetSize()))
+			{
+				return 1;
+			}
+
+			Trainer trainer{ config.batchSize, std::move(train_data), std::move(test_data) };
+			const int n_batches = (int)trainer.GetTrainingDataBatches().size();
+			net::DataParallel parallel{ model, config.taskGraph ? 1 : config.threads };
+			std::unique_ptr<ThreadPool> pool;
+			if (config.taskGraph)
+			{
+				pool = std::make_unique<ThreadPool>(config.threads - 1);
+			}
+			std::unique_ptr<AsyncEvaluator> evaluator;
+			if (config.asyncEval)
+			{
+				evaluator = std::make_unique<AsyncEvaluator>(trainer.GetTestData());
+			}
+
+			InstallStopHandler();
+
+			std::cout << "Training " << n_batches << " batches per epoch, batch size " << config.batchSize << ", " << config.threads << " thread(s)"
+				<< (config.taskGraph ? " running a task graph" : "") << (config.asyncEval ? ", evaluating asynchronously" : "") << '\n';
+
+			// from here until Close() all console output goes through the metrics writer
+			MetricsLogger metrics{ config.metrics };
+			bool stopped = false;
+			for (int epoch = 0; config.epochs == 0 || epoch < config.epochs; epoch++)
+			{
+				for (int b = 0; b < n_batches && !StopRequested(); b++)
+				{
+					auto start = std::chrono::steady_clock::now();
+					if (pool)
+					{
+						trainer.Train(model, config.learnRate, b, *pool);
+					}
+					else
+					{
+						trainer.Train(parallel, config.learnRate, b);
+					}
+					auto end = std::chrono::steady_clock::now();
+
+					step++;
+					const std::vector<DataPoint<double>>& batch = trainer.GetTrainingDataBatches()[b];
+					const double seconds = std::chrono::duration<double>(end - start).count();
+					if (step > config.warmupSteps)
+					{
+						trainSeconds += seconds;
+						trainedSamples += (long long)batch.size();
+					}
+
+					// the batch outputs are left over from the forward pass inside Learn
+					MetricRecord r;
+					r.epoch = epoch;
+					r.step = step;
+					r.trainLoss = COST(batch);
+					r.trainAccuracy = net::cstf::Accuracy(batch);
+					r.stepSeconds = seconds;
+					r.samplesPerSecond = SamplesPerSecond();
+					metrics.Push(r);
+
+					if (config.evalInterval > 0 && step % config.evalInterval == 0)
+					{
+						Evaluate(model, trainer, metrics, epoch, b, evaluator.get());
+					}
+					if (evaluator)
+					{
+						evaluator->Drain([&](const MetricRecord& e) { metrics.Push(e); });
+					}
+					if (config.checkpointInterval > 0 && step % config.checkpointInterval == 0)
+					{
+						model.Save(config.savePath);
+					}
+				}
+
+				if (StopRequested())
+				{
+					stopped = true;
+					break;
+				}
+				if (config.evalInterval == 0)
+				{
+					Evaluate(model, trainer, metrics, epoch, n_batches - 1, evaluator.get());
+				}
+			}
+			if (evaluator)
+			{
+				// the last snapshot is still evaluated, only the end of training waits for it
+				evaluator->Finish();
+				evaluator->Drain([&](const MetricRecord& e) { metrics.Push(e); });
+			}
+			metrics.Close();
+			if (stopped)
+			{
+				std::cout << "Stop requested\n";
+			}
+			if (evaluator && evaluator->Skipped() > 0)
+			{
+				std::cout << evaluator->Skipped() << " snapshot(s) replaced before they were evaluated\n";
+			}
+
+			if (!model.Save(config.savePath))
+			{
+				return 1;
+			}
+
+			std::cout << "Finished after " << step << " steps, saved to " << config.savePath << '\n';
+			std::cout << "Steady state throughput: " << SamplesPerSecond() << " samples/s\n";
+			return 0;
+		}
+	private:
+		void Evaluate(net::Network& model, Trainer& trainer, MetricsLogger& metrics, int epoch, int batch, AsyncEvaluator* evaluator)
+		{
+			// the training batch outputs are left over from the forward pass inside Learn
+			const std::vector<DataPoint<double>>& tr_batch = trainer.GetTrainingDataBatches()[batch];
+			double tr_acc = net::cstf::Accuracy(tr_batch);
+			double tr_cost = COST(tr_batch);
+
+			if (evaluator)
+			{
+				// the result comes back through Drain tagged with this step
+				MetricRecord r;
+				r.epoch = epoch;
+				r.step = step;
+				r.trainLoss = tr_cost;
+				r.trainAccuracy = tr_acc;
+				r.samplesPerSecond = SamplesPerSecond();
+				evaluator->Offer(model, r);
+				return;
+			}
+
+			// repacking costs one pass over the weights and every test forward pass below uses it
+			model.Pack();
+
+			double te_acc = 0.0;
+			double te_cost = 0.0;
+			std::size_t n_test = 0;
+			if (config.evalSamples <= 0)
+			{
+				trainer.Test(model);
+				te_acc = net::cstf::Accuracy(trainer.GetTestData());
+				te_cost = COST(trainer.GetTestData());
+				n_test = trainer.GetTestData().size();
+			}
+			else
+			{
+				// rotate through the test set so successive evaluations see different samples
+				const std::vector<DataPoint<double>>& test = trainer.GetTestData();
+				std::size_t count = std::min<std::size_t>(config.evalSamples, test.size());
+				std::vector<DataPoint<double>> sample;
+				sample.reserve(count);
+				for (std::size_t i = 0; i < count; i++)
+				{
+					sample.push_back(test[(evalOffset + i) % test.size()]);
+				}
+				evalOffset = (evalOffset + count) % test.size();
+
+				model.CalculateOutputs(sample);
+				te_acc = net::cstf::Accuracy(sample);
+				te_cost = COST(sample);
+				n_test = count;
+			}
+
+			MetricRecord r;
+			r.kind = METRIC::EVAL;
+			r.epoch = epoch;
+			r.step = step;
+			r.trainLoss = tr_cost;
+			r.trainAccuracy = tr_acc;
+			r.testLoss = te_cost;
+			r.testAccuracy = te_acc;
+			r.testSamples = (int)n_test;
+			r.samplesPerSecond = SamplesPerSecond();
+			metrics.Push(r);
+		}
+
+		double SamplesPerSecond() const
+		{
+			return trainSeconds > 0.0 ? (double)trainedSamples / trainSeconds : 0.0;
+		}
+	private:
+		TrainConfig config;
+
+		int step = 0;
+		std::size_t evalOffset = 0;
+		double trainSeconds = 0.0;
+		long long trainedSamples = 0;
+	};
+}
\ No newline at end of file
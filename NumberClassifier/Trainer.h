@@ -2,6 +2,7 @@
 
 #include "Utility.h"
 #include "Network.h"
+#include "DataParallel.h"
 #include <functional>
 
 namespace util
@@ -69,6 +70,16 @@ namespace util
 			model.Learn(batched_trainData[batch], learnRate);
 		}
 
+		void Train(net::Network& model, double learnRate, int batch, ThreadPool& pool)
+		{
+			model.Learn(batched_trainData[batch], learnRate, pool);
+		}
+
+		void Train(net::DataParallel& parallel, double learnRate, int batch)
+		{
+			parallel.Learn(batched_trainData[batch], learnRate);
+		}
+
 		void Test(net::Network& model)
 		{
 			model.CalculateOutputs(testData);
@@ -2,24 +2,60 @@
 
 #include <vector>
 #include <cassert>
-#include <random>
+#include <algorithm>
+#include "Random.h"
+#include "MatrixStorage.h"
 
 #define SELF (*this)
 
 namespace util
 {
+	// cache blocking of the matrix kernels, neither changes the order in which any element is summed
+	// the defaults suit a 32 KiB L1 / 256 KiB+ L2, the autotuner picks them per host (see Autotune.h)
+	struct KernelTuning
+	{
+		int gemmBlock = 128;    // rows of b kept in cache while every row of a passes over them (Multiply without transposes)
+		int rowBlock = 32;      // input rows per sweep over the packed weight panels (Layer::PackedWeighted)
+	};
+
+	inline KernelTuning _kernelTuning;
+
+	// set before any threads use the kernels
+	inline void SetKernelTuning(const KernelTuning& tuning)
+	{
+		_kernelTuning = tuning;
+	}
+
+	inline const KernelTuning& GetKernelTuning()
+	{
+		return _kernelTuning;
+	}
+
 	template<typename T>
 	class Matrix
 	{
 	public:
-		Matrix(std::vector<T> values, int rows, int columns, T init = (T)0)
-			: values(values), rows(rows), columns(columns)
+		using Storage = MatrixStorage<T>;
+
+		Matrix(const std::vector<T>& values, int rows, int columns, T init = (T)0)
+			: rows(rows), columns(columns)
 		{
+			this->values.assign(values.begin(), values.end());
 			this->values.resize((std::size_t)rows * columns, init);
 		}
 		Matrix()
-			: values(0), rows(0), columns(0)
+			: rows(0), columns(0)
 		{}
+
+		// non-owning matrix over rows * columns values at data, results assigned to it are written into that buffer
+		static Matrix View(T* data, int rows, int columns)
+		{
+			Matrix res;
+			res.values = Storage::View(data, (std::size_t)rows * columns);
+			res.rows = rows;
+			res.columns = columns;
+			return res;
+		}
 	public:
 		// operators
 		const T& operator()(int row, int column) const
@@ -42,18 +78,102 @@ namespace util
 		Matrix operator*(const Matrix& rhs) const // row dot column
 		{
 			assert(columns == rhs.rows);
-			Matrix res{{}, rows, rhs.columns};
-			for (int i = 0; i < rows; i++)
+			return Multiply(SELF, false, rhs, false);
+		}
+
+		// op(a) * op(b) without building transposed copies, like the op arguments of BLAS gemm
+		static Matrix Multiply(const Matrix& a, bool transA, const Matrix& b, bool transB)
+		{
+			Matrix res{ {}, transA ? a.columns : a.rows, transB ? b.rows : b.columns };
+			MultiplyAdd(res, a, transA, b, transB);
+			return res;
+		}
+
+		// c += op(a) * op(b), every layout gets a loop order that walks both operands along their rows
+		// each element sums its products in ascending k, the same order as the plain triple loop
+		static void MultiplyAdd(Matrix& c, const Matrix& a, bool transA, const Matrix& b, bool transB)
+		{
+			const int m = c.rows;
+			const int n = c.columns;
+			const int k = transA ? a.rows : a.columns;
+			assert(m == (transA ? a.columns : a.rows) && n == (transB ? b.rows : b.columns) && k == (transB ? b.columns : b.rows));
+
+			T* __restrict C = c.values.data();
+			const T* __restrict A = a.values.data();
+			const T* __restrict B = b.values.data();
+			if (!transA && !transB)
 			{
-				for (int j = 0; j < rhs.columns; j++)
+				// C(i,:) += A(i,p) * B(p,:), gemmBlock rows of B at a time so they stay cached across the rows of A
+				const int block = GetKernelTuning().gemmBlock > 0 ? GetKernelTuning().gemmBlock : k;
+				for (int p0 = 0; p0 < k; p0 += block)
 				{
-					for (int k = 0; k < rhs.rows; k++)
+					const int p1 = std::min(k, p0 + block);
+					for (int i = 0; i < m; i++)
 					{
-						res(i, j) += SELF(i, k) * rhs(k, j);
+						T* Ci = C + (std::size_t)i * n;
+						for (int p = p0; p < p1; p++)
+						{
+							const T aip = A[(std::size_t)i * k + p];
+							const T* Bp = B + (std::size_t)p * n;
+							for (int j = 0; j < n; j++)
+							{
+								Ci[j] += aip * Bp[j];
+							}
+						}
+					}
+				}
+			}
+			else if (transA && !transB)
+			{
+				// C(i,:) += A(p,i) * B(p,:), the outer product form of the weight gradients
+				for (int p = 0; p < k; p++)
+				{
+					const T* Ap = A + (std::size_t)p * m;
+					const T* Bp = B + (std::size_t)p * n;
+					for (int i = 0; i < m; i++)
+					{
+						const T api = Ap[i];
+						T* Ci = C + (std::size_t)i * n;
+						for (int j = 0; j < n; j++)
+						{
+							Ci[j] += api * Bp[j];
+						}
+					}
+				}
+			}
+			else if (!transA && transB)
+			{
+				// C(i,j) += A(i,:) . B(j,:), deltas through the weights without transposing them
+				for (int i = 0; i < m; i++)
+				{
+					const T* Ai = A + (std::size_t)i * k;
+					for (int j = 0; j < n; j++)
+					{
+						const T* Bj = B + (std::size_t)j * k;
+						T acc = (T)0;
+						for (int p = 0; p < k; p++)
+						{
+							acc += Ai[p] * Bj[p];
+						}
+						C[(std::size_t)i * n + j] += acc;
+					}
+				}
+			}
+			else
+			{
+				for (int i = 0; i < m; i++)
+				{
+					for (int j = 0; j < n; j++)
+					{
+						T acc = (T)0;
+						for (int p = 0; p < k; p++)
+						{
+							acc += A[(std::size_t)p * m + i] * B[(std::size_t)j * k + p];
+						}
+						C[(std::size_t)i * n + j] += acc;
 					}
 				}
 			}
-			return res;
 		}
 
 		Matrix operator*(const T& rhs) const
@@ -68,7 +188,7 @@ namespace util
 			return res;
 		}
 
-		Matrix operator+(const Matrix& rhs)
+		Matrix operator+(const Matrix& rhs) const
 		{
 			assert(rows == rhs.rows && columns == rhs.columns);
 			Matrix res({}, rows, columns);
@@ -79,7 +199,7 @@ namespace util
 			return res;
 		}
 
-		Matrix operator-(const Matrix& rhs)
+		Matrix operator-(const Matrix& rhs) const
 		{
 			assert(rows == rhs.rows && columns == rhs.columns);
 			Matrix res({}, rows, columns);
@@ -96,30 +216,43 @@ namespace util
 		}
 	public:
 		// utility
-		Matrix GetTransposed()
+		// copies in TILE x TILE blocks so both the reads and the writes stay within a few cache lines
+		Matrix GetTransposed() const
 		{
+			constexpr int TILE = 32;
 			Matrix res{ {}, columns, rows };
-			for (int r = 0; r < rows; r++)
+			const T* src = values.data();
+			T* dst = res.values.data();
+			for (int r0 = 0; r0 < rows; r0 += TILE)
 			{
-				for (int c = 0; c < columns; c++)
+				const int r1 = std::min(r0 + TILE, rows);
+				for (int c0 = 0; c0 < columns; c0 += TILE)
 				{
-					res(c, r) = SELF(r, c);
+					const int c1 = std::min(c0 + TILE, columns);
+					for (int r = r0; r < r1; r++)
+					{
+						for (int c = c0; c < c1; c++)
+						{
+							dst[(std::size_t)c * rows + r] = src[(std::size_t)r * columns + c];
+						}
+					}
 				}
 			}
 			return res;
 		}
-		bool SizeEqu(const Matrix& rhs)
+		bool SizeEqu(const Matrix& rhs) const
 		{
 			return rows == rhs.rows && columns == rhs.columns;
 		}
 	public:
 		// getters/settors
-		std::vector<T>& GetValues() { return values; }
-		int GetRows() { return rows; }
-		int GetColumns() { return columns; }
-		int GetSize() { return rows * columns; }
+		Storage& GetValues() { return values; }
+		const Storage& GetValues() const { return values; }
+		int GetRows() const { return rows; }
+		int GetColumns() const { return columns; }
+		int GetSize() const { return rows * columns; }
 	private:
-		std::vector<T> values;
+		Storage values;
 		int rows;
 		int columns;
 	};
@@ -137,12 +270,26 @@ namespace util
 		T label;
 	};
 
-	inline std::random_device _rd;
-	inline std::mt19937 _rng(/*_rd()*/36456355);
-	template<typename T, typename distr>
-	inline T Random(distr dist)
+	// top class of one output row
+	struct Prediction
 	{
-		return dist(_rng);
+		int label = -1;
+		double probability = 0.0;
+	};
+
+	template<typename T>
+	inline Prediction TopClass(const Matrix<T>& outputs, int row = 0)
+	{
+		Prediction p;
+		for (int c = 0; c < outputs.GetColumns(); c++)
+		{
+			if (p.label < 0 || outputs(row, c) > p.probability)
+			{
+				p.label = c;
+				p.probability = (double)outputs(row, c);
+			}
+		}
+		return p;
 	}
 
 	template <typename T>